@@ -0,0 +1,552 @@
+// Performance and quality regression harness.
+//
+// Build it in this directory with:  g++ -O3 -fopenmp -I.. bench.cpp $(ls ../*.cpp | grep -v main.cpp) -o bench
+// then run:                        ./bench                       compare with the baseline of the build
+//                                  ./bench --write baseline.json record a new baseline
+//
+// The cases are made from the ground truth of the Lena test, cropped or mirrored to each resolution,
+// with the Gaussian noise of a fixed seed, so the PSNR of a case only changes with the algorithm.
+// Each case is run in its own process on POSIX hosts, so that the peak RSS is that of the case only.
+// The integer or floating-point version is selected by USE_INTEGER at compile time,
+// so each of them has its own baseline, i.e. baseline_int.json or baseline_float.json.
+// The timings depend on the host, so record a baseline on the same host before comparing the speed.
+// A small frame is also denoised streamed and in memory after the cases, which must be the same.
+#include <iostream>
+#include <string>
+#include <math.h>
+#include <omp.h>
+#include "bm3d.h"
+#include "bm3d_wiener.h"
+#include "cbm3d.h"
+#include "cbm3d_wiener.h"
+#include "kernels.h"
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#define BENCH_FORK				1
+#else
+#define BENCH_FORK				0
+#endif
+
+#define SRC_SIZE				512		// width and height of the source image
+
+static const char *trace_prefix = NULL;	// prefix of the trace files of the cases, NULL if not traced
+
+/* A case of the harness, all with the parameters of main.cpp. */
+struct BenchCase
+{
+	const char *name;		// name of the case in the baselines
+	int w;					// width
+	int h;					// height
+	int chnl;				// 1 for grayscale, 3 for YUV 4:4:4
+	int bit_depth;			// bit depth of the samples, the source is scaled up to it
+	double noise;			// sigma of the added noise, in the unit of 8-bit samples
+	int sigma1;				// sigma of the first step, in the unit of 8-bit samples
+	int sigma2;				// sigma of the second step, 0 to run the first step only
+};
+
+static const BenchCase cases[] = {
+	{ "gray_256_s25",			256,  256,  1, 8,  25, 36, 25 },
+	{ "gray_512_s15",			512,  512,  1, 8,  15, 22, 15 },
+	{ "gray_512_s25",			512,  512,  1, 8,  25, 36, 25 },
+	{ "gray_512_s50",			512,  512,  1, 8,  50, 72, 50 },
+	{ "gray_512_s25_step1",		512,  512,  1, 8,  25, 36, 0  },
+	{ "gray_1024x768_s25",		1024, 768,  1, 8,  25, 36, 25 },
+	{ "gray10_512_s25",			512,  512,  1, 10, 25, 36, 25 },
+	{ "color_256_s50",			256,  256,  3, 8,  50, 72, 50 },
+	{ "color_512_s25",			512,  512,  3, 8,  25, 36, 25 },
+	{ "color_512_s25_step1",	512,  512,  3, 8,  25, 36, 0  },
+	{ "color_1024x768_s25",		1024, 768,  3, 8,  25, 36, 25 },
+};
+static const int ncases = sizeof(cases) / sizeof(cases[0]);
+
+/* Measurements of a case. */
+struct BenchResult
+{
+	double time1;			// wall time of the first step, in seconds
+	double time2;			// wall time of the second step, in seconds
+	double mpix_s;			// megapixels per second of the whole case
+	long peak_rss;			// peak resident set size, in KB, 0 if unknown
+	double psnr1;			// PSNR of the first step
+	double psnr2;			// PSNR of the second step, 0 if not run
+};
+
+/* Tolerances of the comparison with the baseline. */
+struct BenchTolerance
+{
+	double time;			// relative slowdown of the wall time
+	double rss;				// relative growth of the peak RSS
+	double psnr;			// drop of the PSNR, in dB
+};
+
+// Gaussian noise of a fixed seed, the same on all hosts (xorshift64* and Box-Muller)
+struct NoiseGen
+{
+	uint64_t s;
+
+	double uniform()
+	{
+		s ^= s >> 12;
+		s ^= s << 25;
+		s ^= s >> 27;
+		return ((s * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double gauss()
+	{
+		double u = uniform(), v = uniform();
+		return sqrt(-2 * log(u > 0 ? u : 1e-300)) * cos(6.283185307179586 * v);
+	}
+};
+
+// index of the mirrored source image for a coordinate of any size
+static int mirror(int x)
+{
+	x %= 2 * SRC_SIZE;
+	return x < SRC_SIZE ? x : 2 * SRC_SIZE - 1 - x;
+}
+
+template <typename ImageType>
+static double get_psnr(const ImageType *img1, const ImageType *img2, int pixels, int vmax)
+{
+	double mse = 0;
+	for (int i = 0; i < pixels; i++)
+	{
+		double diff = (double)img1[i] - (double)img2[i];
+		mse += diff * diff;
+	}
+	mse /= pixels;
+	return mse > 0 ? 10 * log10((double)vmax * vmax / mse) : 99;
+}
+
+template <typename ImageType>
+static void run_case(const BenchCase &c, const uint8_t *src, int repeat, BenchResult *res)
+{
+	int n = c.w * c.h * c.chnl;
+	int vmax = (1 << c.bit_depth) - 1;
+	double scale = (double)vmax / 255;
+	ImageType *gt    = new ImageType[n];
+	ImageType *noisy = new ImageType[n];
+	ImageType *basic = new ImageType[n];
+	ImageType *clean = new ImageType[n];
+
+	NoiseGen rng = { 0x9E3779B97F4A7C15ULL };
+	for (int ch = 0; ch < c.chnl; ch++)
+	{
+		for (int y = 0; y < c.h; y++)
+		{
+			for (int x = 0; x < c.w; x++)
+			{
+				int i = (ch * c.h + y) * c.w + x;
+				double v = src[(ch * SRC_SIZE + mirror(y)) * SRC_SIZE + mirror(x)] * scale;
+				double nv = floor(v + c.noise * scale * rng.gauss() + 0.5);
+				gt[i] = (ImageType)floor(v + 0.5);
+				noisy[i] = (ImageType)(nv < 0 ? 0 : nv > vmax ? vmax : nv);
+			}
+		}
+	}
+	int sigma1 = (int)floor(c.sigma1 * scale + 0.5);
+	int sigma2 = (int)floor(c.sigma2 * scale + 0.5);
+
+	BM3D_T<ImageType> *step1 = NULL;
+	BM3D_WIE_T<ImageType> *step2 = NULL;
+	if (c.chnl == 1)
+		step1 = new BM3D_T<ImageType>(c.w, c.h, 16, 8, 3, 16, 1, 16, 1, c.bit_depth);
+	else
+		step1 = new CBM3D_T<ImageType>(c.w, c.h, 16, 8, 3, 16, 1, 16, 1, c.bit_depth);
+	if (c.sigma2 > 0)
+	{
+		if (c.chnl == 1)
+			step2 = new BM3D_WIE_T<ImageType>(c.w, c.h, 32, 8, 3, 16, 1, 16, 1, c.bit_depth);
+		else
+			step2 = new CBM3D_WIE_T<ImageType>(c.w, c.h, 32, 8, 3, 16, 1, 16, 1, c.bit_depth);
+	}
+
+	// the minimum times of the repeated runs, whose outputs are the same, without the stage timings of run()
+	res->time1 = res->time2 = 1e30;
+	for (int r = 0; r < repeat; r++)
+	{
+		// only the first run is traced
+		if (trace_prefix && r == 0)
+			trace_start((std::string(trace_prefix) + c.name + ".json").c_str());
+		double t0 = omp_get_wtime();
+		step1->load(noisy, sigma1);
+		while (step1->next_line(basic) >= 0);
+		double t1 = omp_get_wtime();
+		if (step2)
+		{
+			step2->load(noisy, basic, sigma2);
+			while (step2->next_line(clean) >= 0);
+		}
+		double t2 = omp_get_wtime();
+		trace_stop();
+		res->time1 = t1 - t0 < res->time1 ? t1 - t0 : res->time1;
+		res->time2 = t2 - t1 < res->time2 ? t2 - t1 : res->time2;
+	}
+	res->mpix_s = (double)c.w * c.h / (res->time1 + res->time2) / 1e6;
+	res->psnr1 = get_psnr(basic, gt, n, vmax);
+	res->psnr2 = step2 ? get_psnr(clean, gt, n, vmax) : 0;
+
+	res->peak_rss = 0;
+#if BENCH_FORK
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	res->peak_rss = ru.ru_maxrss;
+#ifdef __APPLE__
+	res->peak_rss /= 1024;	// in bytes on macOS
+#endif
+#endif
+
+	delete step1;
+	delete step2;
+	delete[] gt;
+	delete[] noisy;
+	delete[] basic;
+	delete[] clean;
+}
+
+static void run_case(const BenchCase &c, const uint8_t *src, int repeat, BenchResult *res)
+{
+	if (c.bit_depth > 8)
+		run_case<uint16_t>(c, src, repeat, res);
+	else
+		run_case<uint8_t>(c, src, repeat, res);
+}
+
+// rows of the noisy/basic planes of a frame, read by the engines as a row source
+struct FrameSource : RowSource<uint8_t>
+{
+	const uint8_t *planes[2];	// noisy and basic planes, the basic one is NULL for the first step
+	int w;
+
+	void read_row(int y, uint8_t *const *rows)
+	{
+		for (int i = 0; i < 2 && planes[i]; i++) {
+			memcpy(rows[i], planes[i] + y * w, w);
+		}
+	}
+};
+
+// rows written by the engines to a row sink, stored in a frame
+struct FrameSink : RowSink<uint8_t>
+{
+	uint8_t *frame;
+	int w;
+
+	void write_rows(int y, int n, const uint8_t *const *rows, int stride)
+	{
+		for (int i = 0; i < n; i++) {
+			memcpy(frame + (y + i) * w, rows[0] + i * stride, w);
+		}
+	}
+};
+
+/* Check that the streamed frames (load_source() and next_line_sink()) are the same as the frames in memory
+ * (load_planes() and next_line_planes()), also in place, for both steps of a small grayscale frame cropped from the source.
+ * The steps of the reference patches are also beyond the vertical search window radius, whose leaving rows are out of the ring.
+ * Returns the number of the mismatched configurations.
+ */
+static int check_streaming(const uint8_t *src)
+{
+	static const int configs[][2] = { { 3, 16 }, { 5, 4 }, { 7, 2 } };	// (pstep, swinr)
+	const int w = 70, h = 66, n = w * h;
+	uint8_t *noisy = new uint8_t[n];
+	uint8_t *basic = new uint8_t[n];
+	uint8_t *clean = new uint8_t[n];
+	uint8_t *streamed = new uint8_t[n];
+	uint8_t *inplace = new uint8_t[n];
+
+	NoiseGen rng = { 0x9E3779B97F4A7C15ULL };
+	for (int i = 0; i < n; i++)
+	{
+		double nv = floor(src[i / w * SRC_SIZE + i % w] + 25 * rng.gauss() + 0.5);
+		noisy[i] = (uint8_t)(nv < 0 ? 0 : nv > 255 ? 255 : nv);
+	}
+	int failed = 0;
+	for (size_t k = 0; k < sizeof(configs) / sizeof(configs[0]); k++)
+	{
+		int pstep = configs[k][0], swinr = configs[k][1];
+		BM3D_T<uint8_t> step1(w, h, 16, 8, pstep, swinr, 1, swinr, 1);
+		BM3D_WIE_T<uint8_t> step2(w, h, 32, 8, pstep, swinr, 1, swinr, 1);
+		const uint8_t *planes[1] = { noisy };
+		const uint8_t *basics[1] = { basic };
+		int strides[1] = { w };
+		FrameSource source;
+		source.planes[0] = noisy;
+		source.planes[1] = NULL;
+		source.w = w;
+		FrameSink sink;
+		sink.frame = streamed;
+		sink.w = w;
+		PlaneOut<uint8_t> out;
+		out.data = basic;
+		out.stride = w;
+
+		step1.load_planes(planes, strides, 36);
+		while (step1.next_line_planes(&out) >= 0);
+		step1.load_source(&source, 36);
+		while (step1.next_line_sink(&sink) >= 0);
+		bool ok = memcmp(basic, streamed, n) == 0;
+
+		memcpy(inplace, noisy, n);
+		const uint8_t *inplaces[1] = { inplace };
+		out.data = inplace;
+		step1.load_planes(inplaces, strides, 36);
+		while (step1.next_line_planes(&out) >= 0);
+		ok &= memcmp(basic, inplace, n) == 0;
+
+		out.data = clean;
+		step2.load_planes(planes, strides, basics, strides, 25);
+		while (step2.next_line_planes(&out) >= 0);
+		source.planes[1] = basic;
+		step2.load_source(&source, 25);
+		while (step2.next_line_sink(&sink) >= 0);
+		ok &= memcmp(clean, streamed, n) == 0;
+
+		if (!ok)
+			printf("    MISMATCH of the streamed frame, pstep %d, swinr %d\n", pstep, swinr);
+		failed += !ok;
+	}
+
+	delete[] noisy;
+	delete[] basic;
+	delete[] clean;
+	delete[] streamed;
+	delete[] inplace;
+	return failed;
+}
+
+/* Run a case in a child process, whose peak RSS doesn't include the cases before.
+ * Returns false if the case failed.
+ */
+static bool run_isolated(const BenchCase &c, const uint8_t *src, int repeat, BenchResult *res)
+{
+#if BENCH_FORK
+	int fd[2];
+	if (pipe(fd) != 0) return false;
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) return false;
+	if (pid == 0)
+	{
+		close(fd[0]);
+		run_case(c, src, repeat, res);
+		ssize_t n = write(fd[1], res, sizeof(*res));
+		_exit(n == (ssize_t)sizeof(*res) ? 0 : 1);
+	}
+	close(fd[1]);
+	ssize_t n = read(fd[0], res, sizeof(*res));
+	close(fd[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return n == (ssize_t)sizeof(*res) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+	run_case(c, src, repeat, res);
+	return true;
+#endif
+}
+
+/* Get a number of a case of the baseline, i.e. the ("key": value) in the object of ("name": "<name>").
+ * Only the files written by write_results() are read, which put a case on a line.
+ */
+static bool find_value(const std::string &json, const char *name, const char *key, double *value)
+{
+	std::string tag = std::string("\"name\": \"") + name + "\"";
+	size_t pos = json.find(tag);
+	if (pos == std::string::npos) return false;
+	size_t end = json.find('}', pos);
+	std::string k = std::string("\"") + key + "\":";
+	size_t kp = json.find(k, pos);
+	if (kp == std::string::npos || kp > end) return false;
+	*value = strtod(json.c_str() + kp + k.size(), NULL);
+	return true;
+}
+
+static bool read_file(const char *fname, std::string *text)
+{
+	FILE *f = fopen(fname, "rb");
+	if (NULL == f) return false;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		text->append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+static void write_results(FILE *f, const bool *selected, const BenchResult *res)
+{
+	fprintf(f, "{\n");
+	int threads = USE_THREADS_NUM < omp_get_thread_limit() ? USE_THREADS_NUM : omp_get_thread_limit();
+	fprintf(f, "  \"config\": {\"integer\": %d, \"l2_dist\": %d, \"threads\": %d, \"procs\": %d, \"cpu_level\": %d},\n",
+		USE_INTEGER, USE_L2_DIST, threads, omp_get_num_procs(), cpu_level());
+	fprintf(f, "  \"cases\": [\n");
+	bool first = true;
+	for (int i = 0; i < ncases; i++)
+	{
+		if (!selected[i]) continue;
+		const BenchCase &c = cases[i];
+		const BenchResult &r = res[i];
+		fprintf(f, "%s    {\"name\": \"%s\", \"w\": %d, \"h\": %d, \"chnl\": %d, \"bit_depth\": %d, "
+			"\"time1\": %.4f, \"time2\": %.4f, \"mpix_s\": %.4f, \"peak_rss_kb\": %ld, \"psnr1\": %.4f, \"psnr2\": %.4f}",
+			first ? "" : ",\n", c.name, c.w, c.h, c.chnl, c.bit_depth, r.time1, r.time2, r.mpix_s, r.peak_rss, r.psnr1, r.psnr2);
+		first = false;
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+/* Compare a measurement with the baseline, and print the verdict.
+ * The higher values are better if (higher), and the difference beyond (tol) fails,
+ * relatively if (relative), otherwise absolutely.
+ */
+static bool check(const std::string &base, const char *name, const char *key, double cur, double tol, bool relative, bool higher)
+{
+	double ref;
+	if (!find_value(base, name, key, &ref) || ref <= 0) return true;
+	double diff = relative ? (cur - ref) / ref : cur - ref;
+	bool ok = higher ? diff >= -tol : diff <= tol;
+	if (!ok)
+		printf("    REGRESSION %-12s %10.4f -> %10.4f (%+.2f%s)\n", key, ref, cur, relative ? diff * 100 : diff, relative ? "%" : " dB");
+	return ok;
+}
+
+static void usage()
+{
+	printf(
+		"usage: bench [options]\n"
+		"  --image <file>       ground truth of the Lena test, YUV 4:4:4 512x512 (default ../test/yuv444_512x512_lena_gt.yuv)\n"
+		"  --baseline <file>    baseline to compare with (default baseline_int.json or baseline_float.json)\n"
+		"  --write <file>       write the results as a new baseline instead of comparing\n"
+		"  --json <file>        also write the results to a file when comparing\n"
+		"  --cases <substring>  run only the cases whose names contain the substring\n"
+		"  --repeat <n>         runs of each case, the minimum time is taken (default 3)\n"
+		"  --time-tol <r>       relative slowdown allowed (default 0.10)\n"
+		"  --rss-tol <r>        relative growth of the peak RSS allowed (default 0.10)\n"
+		"  --psnr-tol <dB>      drop of the PSNR allowed (default 0.01)\n"
+		"  --trace <prefix>     write the timeline of the first run of each case to <prefix><case>.json (USE_TRACE)\n"
+		"  --list               list the cases\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *image = "../test/yuv444_512x512_lena_gt.yuv";
+	const char *baseline = USE_INTEGER ? "baseline_int.json" : "baseline_float.json";
+	const char *write_to = NULL;
+	const char *json_to = NULL;
+	const char *filter = "";
+	int repeat = 3;
+	BenchTolerance tol = { 0.10, 0.10, 0.01 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string a = argv[i];
+		bool has = i + 1 < argc;
+		if (a == "--image" && has)			image = argv[++i];
+		else if (a == "--baseline" && has)	baseline = argv[++i];
+		else if (a == "--write" && has)		write_to = argv[++i];
+		else if (a == "--json" && has)		json_to = argv[++i];
+		else if (a == "--cases" && has)		filter = argv[++i];
+		else if (a == "--repeat" && has)	repeat = atoi(argv[++i]);
+		else if (a == "--time-tol" && has)	tol.time = atof(argv[++i]);
+		else if (a == "--rss-tol" && has)	tol.rss = atof(argv[++i]);
+		else if (a == "--psnr-tol" && has)	tol.psnr = atof(argv[++i]);
+		else if (a == "--trace" && has)		trace_prefix = argv[++i];
+		else if (a == "--list")
+		{
+			for (int k = 0; k < ncases; k++) {
+				printf("%s\n", cases[k].name);
+			}
+			return 0;
+		}
+		else
+		{
+			usage();
+			return a == "--help" ? 0 : 2;
+		}
+	}
+	repeat = repeat > 0 ? repeat : 1;
+
+	uint8_t *src = new uint8_t[SRC_SIZE * SRC_SIZE * 3];
+	FILE *f = fopen(image, "rb");
+	if (NULL == f || fread(src, 1, SRC_SIZE * SRC_SIZE * 3, f) != SRC_SIZE * SRC_SIZE * 3)
+	{
+		printf("Failed to read: %s\n", image);
+		return 2;
+	}
+	fclose(f);
+
+	std::string base;
+	bool compare = write_to == NULL;
+	if (compare && !read_file(baseline, &base))
+	{
+		printf("No baseline: %s, the results are only printed\n", baseline);
+		compare = false;
+	}
+
+	bool selected[ncases];
+	BenchResult res[ncases];
+	int failed = 0;
+	printf("%-22s %9s %9s %9s %10s %8s %8s\n", "case", "step1 s", "step2 s", "Mpix/s", "RSS KB", "PSNR1", "PSNR2");
+	for (int i = 0; i < ncases; i++)
+	{
+		const BenchCase &c = cases[i];
+		selected[i] = strstr(c.name, filter) != NULL;
+		if (!selected[i]) continue;
+
+		BenchResult &r = res[i];
+		if (!run_isolated(c, src, repeat, &r))
+		{
+			printf("%-22s FAILED\n", c.name);
+			selected[i] = false;
+			failed++;
+			continue;
+		}
+		printf("%-22s %9.3f %9.3f %9.3f %10ld %8.3f %8.3f\n", c.name, r.time1, r.time2, r.mpix_s, r.peak_rss, r.psnr1, r.psnr2);
+
+		if (compare)
+		{
+			double ref;
+			if (!find_value(base, c.name, "psnr1", &ref))
+			{
+				printf("    not in the baseline\n");
+				continue;
+			}
+			bool ok = true;
+			ok &= check(base, c.name, "psnr1", r.psnr1, tol.psnr, false, true);
+			ok &= check(base, c.name, "psnr2", r.psnr2, tol.psnr, false, true);
+			ok &= check(base, c.name, "mpix_s", r.mpix_s, tol.time / (1 + tol.time), true, true);
+			ok &= check(base, c.name, "peak_rss_kb", (double)r.peak_rss, tol.rss, true, false);
+			failed += !ok;
+		}
+	}
+
+	// checked after the cases, as a child forked once the threads of the OpenMP are started would hang on them
+	int mismatched = check_streaming(src);
+	printf("streamed vs in-memory frames: %s\n", mismatched ? "MISMATCH" : "same");
+
+	if (write_to || json_to)
+	{
+		const char *fname = write_to ? write_to : json_to;
+		FILE *out = fopen(fname, "w");
+		if (NULL == out)
+		{
+			printf("Failed to open: %s\n", fname);
+			return 2;
+		}
+		write_results(out, selected, res);
+		fclose(out);
+		printf("Results written to %s\n", fname);
+	}
+	if (compare && failed)
+		printf("%d case(s) regressed against %s\n", failed, baseline);
+	else if (compare)
+		printf("No regression against %s\n", baseline);
+	delete[] src;
+
+	return failed || mismatched ? 1 : 0;
+}
@@ -0,0 +1,393 @@
+#include <iostream>
+#include "block_match.h"
+#include "kernels.h"
+#include "trace.h"
+
+template <typename AccType>
+static inline AccType get_dist(int a, int b)
+{
+	int diff = a - b;
+#if USE_L2_DIST
+	return (AccType)diff * diff;
+#else
+	return diff >= 0 ? diff : -diff;
+#endif
+}
+
+// a row of the distances of a tile, by the SIMD kernels if the distances are as wide as theirs
+template <typename PartType, typename ImageType>
+static inline void accumulate_part(PartType *acc, const ImageType *cand, ImageType ref, int n)
+{
+	for (int j = 0; j < n; j++) {
+		acc[j] += get_dist<PartType>(ref, cand[j]);
+	}
+}
+
+static inline void accumulate_part(uint16_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+	accumulate_dist_row(acc, cand, ref, n);
+}
+
+static inline void accumulate_part(uint32_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+	accumulate_dist_row(acc, cand, ref, n);
+}
+
+static inline void accumulate_part(uint64_t *acc, const uint16_t *cand, uint16_t ref, int n)
+{
+	accumulate_dist_row(acc, cand, ref, n);
+}
+
+template <typename ImageType>
+BlockMatcher<ImageType>::BlockMatcher(int psize_, int pstep_, int swinrh_, int ssteph_, int swinrv_, int sstepv_)
+	: psize(psize_), pstep(pstep_), swinrh(swinrh_), ssteph(ssteph_), swinrv(swinrv_), sstepv(sstepv_)
+{
+	// the distances computed by the last patch can be partially reused when stepping forward
+	nbuf = (psize + pstep - 1) / pstep;
+	nsh  = (2 * swinrh + ssteph) / ssteph;
+	nsv  = (2 * swinrv + sstepv) / sstepv;
+
+	// the windows whose buffers don't fit in (MATCH_TILE_BYTES) are split into tiles of rows which do
+#if USE_L2_DIST
+	tile16 = false;
+#else
+	tile16 = (int64_t)psize * psize * (ImageType)~0 <= 0xFFFF;
+#endif
+	int part = tile16 ? (int)sizeof(uint16_t) : (int)sizeof(AccType);
+	tile_rows = 0;
+	ntiles = 1;
+	tile_bytes = 0;
+	tile_buf = NULL;
+	if ((int64_t)(nbuf + 1) * nsv * nsh * sizeof(AccType) > MATCH_TILE_BYTES)
+	{
+		tile_rows = MATCH_TILE_BYTES / ((nbuf + 1) * nsh * part);
+		tile_rows = tile_rows > 1 ? tile_rows : 1;
+		ntiles = (nsv + tile_rows - 1) / tile_rows;
+		ntiles = ntiles > USE_THREADS_NUM ? ntiles : USE_THREADS_NUM;	// a tile for each thread at least
+		ntiles = ntiles < nsv ? ntiles : nsv;
+		tile_rows = (nsv + ntiles - 1) / ntiles;	// balance the tiles
+		ntiles = (nsv + tile_rows - 1) / tile_rows;
+		tile_bytes = ((nbuf + 1) * tile_rows * nsh * part + 63) & ~63;
+		tile_buf = new uint8_t[USE_THREADS_NUM * tile_bytes];
+	}
+	best = NULL;
+	best_cap = 0;
+	nbest = new int[USE_THREADS_NUM * MATCH_TILE_REFS];
+	nparts = 0;
+	chunk0 = chunk1 = nrefs = 0;
+	next_rx = 0;
+
+	dist_buf = tile_rows ? NULL : new AccType[nsh * nsv * nbuf];
+	dist_sum = tile_rows ? NULL : new AccType[nsh * nsv];
+	index = NULL;
+}
+
+template <typename ImageType>
+BlockMatcher<ImageType>::~BlockMatcher()
+{
+	delete[] dist_buf;
+	delete[] dist_sum;
+	delete[] tile_buf;
+	delete[] best;
+	delete[] nbest;
+	delete index;
+}
+
+template <typename ImageType>
+void BlockMatcher<ImageType>::set_search_mode(int mode, int max_sim)
+{
+	delete index;
+	index = mode == SEARCH_MODE_INDEX ? new PatchIndex<ImageType>(psize, ssteph, swinrv, max_sim) : NULL;
+}
+
+/* The column (x) of the reference patch is recorded in the step ((step + x / pstep) % nbuf) of the sliding buffer.
+ * If all the candidates of the columns are inside the image, the rows are read in place, 
+ * otherwise the pixels are read one by one with the virtual border of the image.
+ */
+template <typename ImageType>
+void BlockMatcher<ImageType>::accumulate(const PlaneView<ImageType> &image, int rx, int ry, int x0, int x1, int step)
+{
+	bool inside = image.inside(rx + x0 - swinrh, rx + x1 + swinrh);
+
+	// each thread takes a share of the rows of the search window, whose span shows the load of the thread
+#pragma omp parallel num_threads(USE_THREADS_NUM)
+	{
+		double t0 = trace_begin();
+#pragma omp for nowait
+		for (int i = 0; i < nsv; i++)
+		{
+			int sy = i * sstepv - swinrv;
+			for (int y = 0; y < psize; y++)
+			{
+				const ImageType *rrow = image.row(ry + y);
+				const ImageType *crow = image.row(ry + y + sy);
+				for (int x = x0; x < x1; x++)
+				{
+					AccType *buf = dist_buf + ((step + x / pstep) % nbuf * nsv + i) * nsh;
+					if (inside && ssteph == 1)
+					{
+						accumulate_dist_row(buf, crow + rx + x - swinrh, rrow[rx + x], nsh);
+					}
+					else if (inside)
+					{
+						ImageType r = rrow[rx + x];
+						const ImageType *c = crow + rx + x - swinrh;
+						for (int j = 0; j < nsh; j++)
+						{
+							buf[j] += get_dist<AccType>(r, c[j * ssteph]);
+						}
+					}
+					else
+					{
+						ImageType r = image.at(rx + x, ry + y);
+						for (int j = 0; j < nsh; j++)
+						{
+							buf[j] += get_dist<AccType>(r, image.at(rx + x - swinrh + j * ssteph, ry + y + sy));
+						}
+					}
+				}
+			}
+		}
+		trace_span("match rows", t0);
+	}
+}
+
+template <typename ImageType>
+void BlockMatcher<ImageType>::start_line(const PlaneView<ImageType> &image, int rx, int ry)
+{
+	if (index)
+	{
+		index->start_line(image, ry);
+		return;
+	}
+	if (tile_rows)
+	{
+		// the chunks of the line are matched by match() when their first reference patches come
+		nrefs = (image.w_ext - psize) / pstep + 1;
+		chunk0 = chunk1 = 0;
+		return;
+	}
+	restart(image, rx, ry);
+}
+
+template <typename ImageType>
+void BlockMatcher<ImageType>::restart(const PlaneView<ImageType> &image, int rx, int ry)
+{
+	memset(dist_buf, 0, nsh * nsv * nbuf * sizeof(AccType));
+	memset(dist_sum, 0, nsh * nsv * sizeof(AccType));
+
+	// initialize the distance buffer
+	accumulate(image, rx, ry, 0, psize - pstep, 0);
+	for (int i = 0; i < nbuf - 2; i++)
+	{
+		AccType *buf = dist_buf + i * nsv * nsh;
+		for (int idx = 0; idx < nsh * nsv; idx++) {
+			dist_sum[idx] += buf[idx];
+		}
+	}
+	ncnt = nbuf;
+	next_rx = rx;
+}
+
+template <typename ImageType>
+void BlockMatcher<ImageType>::match(const PlaneView<ImageType> &image, int rx, int ry, Group3D *g3d)
+{
+	if (index)
+	{
+		index->match(image, rx, ry, g3d);
+		return;
+	}
+	if (tile_rows)
+	{
+		int k = rx / pstep;
+		if (k < chunk0 || k >= chunk1) match_chunk(image, k, ry, g3d);
+
+		// the lists of the threads are in the order of the tiles, so the ties are broken as the window
+		g3d->set_reference();
+		for (int t = 0; t < nparts; t++)
+		{
+			int l = t * MATCH_TILE_REFS + k - chunk0;
+			const TileMatch *m = best + l * best_cap;
+			for (int p = 0; p < nbest[l]; p++) {
+				g3d->insert_patch(m[p].sx, m[p].sy, m[p].dist);
+			}
+		}
+		return;
+	}
+	if (rx != next_rx) restart(image, rx, ry);	// the reference patches between are skipped, e.g. out of a RegionMask
+	accumulate(image, rx, ry, psize - pstep, psize, ncnt);
+
+	AccType *buf0 = dist_buf + (ncnt - 0) % nbuf * nsv * nsh;
+	AccType *buf1 = dist_buf + (ncnt - 1) % nbuf * nsv * nsh;
+	AccType *buf2 = dist_buf + (ncnt - 2) % nbuf * nsv * nsh;
+#pragma omp parallel for num_threads(USE_THREADS_NUM)
+	for (int idx = 0; idx < nsh * nsv; idx++)
+	{
+		dist_sum[idx] += buf2[idx] + buf1[idx];
+	}
+
+	g3d->set_reference();
+	for (int idx = 0, sy = -swinrv; sy <= swinrv; sy += sstepv)
+	{
+		for (int sx = -swinrh; sx <= swinrh; sx += ssteph, idx++)
+		{
+			g3d->insert_patch(sx, sy, dist_sum[idx]);
+		}
+	}
+
+#pragma omp parallel for num_threads(USE_THREADS_NUM)
+	for (int idx = 0; idx < nsh * nsv; idx++)
+	{
+		dist_sum[idx] -= buf1[idx] + buf0[idx];
+		buf0[idx] = 0;
+	}
+	ncnt++;
+	next_rx = rx + pstep;
+}
+
+/* The same as accumulate(), but for the rows [i0, i1) of the search window into the buffers of a tile. */
+template <typename ImageType>
+template <typename PartType>
+void BlockMatcher<ImageType>::accumulate_tile(const PlaneView<ImageType> &image, int rx, int ry, int i0, int i1, 
+	int x0, int x1, int step, PartType *buf)
+{
+	bool inside = image.inside(rx + x0 - swinrh, rx + x1 + swinrh);
+	int n = (i1 - i0) * nsh;
+	for (int i = i0; i < i1; i++)
+	{
+		int sy = i * sstepv - swinrv;
+		for (int y = 0; y < psize; y++)
+		{
+			const ImageType *rrow = image.row(ry + y);
+			const ImageType *crow = image.row(ry + y + sy);
+			for (int x = x0; x < x1; x++)
+			{
+				PartType *acc = buf + (step + x / pstep) % nbuf * n + (i - i0) * nsh;
+				if (inside && ssteph == 1)
+				{
+					accumulate_part(acc, crow + rx + x - swinrh, rrow[rx + x], nsh);
+				}
+				else if (inside)
+				{
+					ImageType r = rrow[rx + x];
+					const ImageType *c = crow + rx + x - swinrh;
+					for (int j = 0; j < nsh; j++)
+					{
+						acc[j] += get_dist<PartType>(r, c[j * ssteph]);
+					}
+				}
+				else
+				{
+					ImageType r = image.at(rx + x, ry + y);
+					for (int j = 0; j < nsh; j++)
+					{
+						acc[j] += get_dist<PartType>(r, image.at(rx + x - swinrh + j * ssteph, ry + y + sy));
+					}
+				}
+			}
+		}
+	}
+}
+
+/* The tile slides along the chunk as the whole window along the line, i.e. start_line() and match(),
+ * and each candidate is inserted into the list of its reference patch as into a Group3D.
+ */
+template <typename ImageType>
+template <typename PartType>
+void BlockMatcher<ImageType>::match_tile(const PlaneView<ImageType> &image, int ry, int i0, int i1, int k0, int k1, 
+	PartType *buf, TileMatch *list, int *nlist, DistType max_dist)
+{
+	int n = (i1 - i0) * nsh;
+	PartType *sum = buf + nbuf * n;
+	memset(buf, 0, (nbuf + 1) * n * sizeof(PartType));
+
+	accumulate_tile(image, k0 * pstep, ry, i0, i1, 0, psize - pstep, 0, buf);
+	for (int i = 0; i < nbuf - 2; i++)
+	{
+		for (int idx = 0; idx < n; idx++) {
+			sum[idx] += buf[i * n + idx];
+		}
+	}
+
+	for (int k = k0, cnt = nbuf; k < k1; k++, cnt++)
+	{
+		accumulate_tile(image, k * pstep, ry, i0, i1, psize - pstep, psize, cnt, buf);
+
+		PartType *buf0 = buf + (cnt - 0) % nbuf * n;
+		PartType *buf1 = buf + (cnt - 1) % nbuf * n;
+		PartType *buf2 = buf + (cnt - 2) % nbuf * n;
+		for (int idx = 0; idx < n; idx++) {
+			sum[idx] += buf2[idx] + buf1[idx];
+		}
+
+		TileMatch *m = list + (k - k0) * best_cap;
+		int num = nlist[k - k0];
+		for (int i = i0, idx = 0; i < i1; i++)
+		{
+			int sy = i * sstepv - swinrv;
+			for (int sx = -swinrh; sx <= swinrh; sx += ssteph, idx++)
+			{
+				DistType d = sum[idx];
+				if ((sx == 0 && sy == 0) || d > max_dist) continue;
+				if (num == best_cap && d >= m[num - 1].dist) continue;
+
+				int p = num < best_cap ? num++ : num - 1;
+				for (; p > 0 && m[p - 1].dist > d; p--) {
+					m[p] = m[p - 1];
+				}
+				m[p].sx = sx;
+				m[p].sy = sy;
+				m[p].dist = d;
+			}
+		}
+		nlist[k - k0] = num;
+
+		for (int idx = 0; idx < n; idx++)
+		{
+			sum[idx] -= buf1[idx] + buf0[idx];
+			buf0[idx] = 0;
+		}
+	}
+}
+
+/* Each thread takes a run of the tiles, so that the lists of the threads are in the order of the tiles. */
+template <typename ImageType>
+void BlockMatcher<ImageType>::match_chunk(const PlaneView<ImageType> &image, int k0, int ry, const Group3D *g3d)
+{
+	if (g3d->max_patches > best_cap)
+	{
+		delete[] best;
+		best_cap = g3d->max_patches;
+		best = new TileMatch[USE_THREADS_NUM * MATCH_TILE_REFS * best_cap];
+	}
+	chunk0 = k0;
+	chunk1 = k0 + MATCH_TILE_REFS < nrefs ? k0 + MATCH_TILE_REFS : nrefs;
+	DistType max_dist = g3d->max_dist;
+
+#pragma omp parallel num_threads(USE_THREADS_NUM)
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		if (t == 0) nparts = nt;
+
+		TileMatch *list = best + t * MATCH_TILE_REFS * best_cap;
+		int *nlist = nbest + t * MATCH_TILE_REFS;
+		for (int k = 0; k < MATCH_TILE_REFS; k++) {
+			nlist[k] = 0;
+		}
+		for (int tile = ntiles * t / nt; tile < ntiles * (t + 1) / nt; tile++)
+		{
+			double t0 = trace_begin();
+			int i0 = tile * tile_rows;
+			int i1 = i0 + tile_rows < nsv ? i0 + tile_rows : nsv;
+			if (tile16)
+				match_tile(image, ry, i0, i1, chunk0, chunk1, (uint16_t *)(tile_buf + t * tile_bytes), list, nlist, max_dist);
+			else
+				match_tile(image, ry, i0, i1, chunk0, chunk1, (AccType *)(tile_buf + t * tile_bytes), list, nlist, max_dist);
+			trace_span("match tile", t0, tile);
+		}
+	}
+}
+
+template struct BlockMatcher<uint8_t>;
+template struct BlockMatcher<uint16_t>;
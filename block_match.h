@@ -0,0 +1,110 @@
+#ifndef __BLOCK_MATCH_H__
+#define __BLOCK_MATCH_H__
+
+#include <iostream>
+#include <omp.h>
+
+#include "global_define.h"
+#include "plane_view.h"
+#include "group_3d.h"
+#include "patch_index.h"
+
+/* Block-matching of a line of reference patches.
+ * The distances of all the candidates in the search window are accumulated column by column, 
+ * and recorded step by step (pstep columns a step) in a sliding buffer, 
+ * so that the distances computed for the last reference patch can be partially reused when stepping forward.
+ * The grouping process of each line of reference patches is independent.
+ * The candidates are not pruned by the lower bounds of their distances (e.g. of the patch means or the partial sums)
+ * against the maximum distance or the worst of the best ones, as the columns of a candidate are shared by
+ * the ceil(psize / pstep) reference patches covering them, and can only be skipped if none of them needs the candidate,
+ * which is too rare to pay for the bounds.
+ * Each step of the sliding buffer stores the distances of all the candidates contiguously, 
+ * so that a row of the candidates can be accumulated with the SIMD kernels.
+ * In the SEARCH_MODE_INDEX, the search window is replaced by the PatchIndex of the band, and the buffers are unused.
+ * If the buffers of the whole window exceed (MATCH_TILE_BYTES), the window is split into tiles of rows,
+ * each of which slides along a chunk of (MATCH_TILE_REFS) reference patches with its own small buffers kept in the cache,
+ * and the best candidates of each tile are merged into the groups in the order of the tiles, so the groups are the same.
+ * The distances of a tile are 16-bit if a patch distance fits, i.e. the L1 distance of 8-bit patches up to 16x16.
+ * The default window (radius 16, 17 KB of buffers) is already tiled, as the tiles are faster than the whole window at any radius,
+ * e.g. 1.2s rather than 1.6s for the Step1 of the Lena test on a thread.
+ */
+template <typename ImageType>
+struct BlockMatcher
+{
+	typedef typename SampleTraits<ImageType>::AccType AccType;
+
+	/* A candidate of the best ones of a reference patch found in some tiles. */
+	struct TileMatch
+	{
+		int sx;				// horizontal offset to the reference patch
+		int sy;				// vertical offset to the reference patch
+		DistType dist;		// distance to the reference patch
+	};
+
+	int psize;				// patch size
+	int pstep;				// reference patch step
+
+	int swinrh;				// horizontal search window radius
+	int ssteph;				// horizontal search step
+	int swinrv;				// vertical search window radius
+	int sstepv;				// vertical search step
+
+	AccType *dist_buf;		// sliding buffer to record the distances step by step, size: nbuf * nsv * nsh
+	AccType *dist_sum;		// distances buffer of each candidate patch
+
+	int nbuf;				// number of steps in a single patch, ceil(psize / pstep)
+	int ncnt;				// counter of the steps
+	int next_rx;			// column of the reference patch following the last one matched
+
+	int nsh;				// number of horizontal candidate patches in a searching window
+	int nsv;				// number of vertical candidate patches in a searching window
+
+	int tile_rows;			// rows of the search window of a tile, 0 if the whole window is matched at once
+	int ntiles;				// tiles of the search window
+	bool tile16;			// whether the distances of a tile are 16-bit
+	int tile_bytes;			// size of the buffers of a tile
+	uint8_t *tile_buf;		// buffers of the tile of each thread, size: USE_THREADS_NUM * tile_bytes
+	TileMatch *best;		// best candidates of each reference patch of the chunk by each thread, size: USE_THREADS_NUM * MATCH_TILE_REFS * best_cap
+	int *nbest;				// number of the best candidates of each list
+	int best_cap;			// capacity of a list, i.e. the maximum similar patches
+	int nparts;				// threads of the last chunk, whose lists are merged in order
+	int chunk0;				// first reference patch (in steps) of the chunk matched
+	int chunk1;				// last reference patch of the chunk, exclusive
+	int nrefs;				// reference patches of the line
+
+	PatchIndex<ImageType> *index;	// index of the band for the SEARCH_MODE_INDEX, NULL for the search window
+
+	BlockMatcher(int psize_, int pstep_, int swinrh_, int ssteph_, int swinrv_, int sstepv_);
+	~BlockMatcher();
+
+	// select the SEARCH_MODE_WINDOW or SEARCH_MODE_INDEX, whose index ranks the candidates of (max_sim) patches
+	void set_search_mode(int mode, int max_sim);
+
+	// reset the distances buffers for a new line, whose first reference patch is at (rx, ry) of the image
+	void start_line(const PlaneView<ImageType> &image, int rx, int ry);
+
+	// restart the distances buffers of the line from the reference patch at (rx, ry)
+	void restart(const PlaneView<ImageType> &image, int rx, int ry);
+
+	// find the similar patches of the reference patch at (rx, ry), usually (pstep) right to the last one,
+	// otherwise the window restarts from it
+	void match(const PlaneView<ImageType> &image, int rx, int ry, Group3D *g3d);
+
+	// accumulate the distances of the columns [x0, x1) of the reference patch to all the candidates
+	void accumulate(const PlaneView<ImageType> &image, int rx, int ry, int x0, int x1, int step);
+
+	// match the chunk of reference patches from the (k0)th one of the line by the tiles, for the groups like (g3d)
+	void match_chunk(const PlaneView<ImageType> &image, int k0, int ry, const Group3D *g3d);
+
+	// match the reference patches [k0, k1) of the line to the candidates of the rows [i0, i1) of the search window,
+	// and insert the best ones into the lists (list) of each reference patch
+	template <typename PartType>
+	void match_tile(const PlaneView<ImageType> &image, int ry, int i0, int i1, int k0, int k1, PartType *buf,
+		TileMatch *list, int *nlist, DistType max_dist);
+
+	// accumulate the distances of the columns [x0, x1) of the reference patch to the candidates of the rows [i0, i1)
+	template <typename PartType>
+	void accumulate_tile(const PlaneView<ImageType> &image, int rx, int ry, int i0, int i1, int x0, int x1, int step, PartType *buf);
+};
+
+#endif
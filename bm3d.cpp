@@ -1,5 +1,7 @@
 #include <iostream>
 #include "bm3d.h"
+#include "kernels.h"
+#include "trace.h"
 
 #if USE_INTEGER
 const PatchType Kaiser[64] = {
@@ -12,6 +14,13 @@ const PatchType Kaiser[64] = {
 	5,  7,  9, 10, 10,  9,  7, 5,
 	3,  5,  6,  7,  7,  6,  5, 3 
 };
+
+const PatchType Kaiser4x4[16] = {
+	3,  6,  6, 3,
+	6, 13, 13, 6,
+	6, 13, 13, 6,
+	3,  6,  6, 3
+};
 #else
 const PatchType Kaiser[64] = {
 	0.1924f, 0.2989f, 0.3846f, 0.4325f, 0.4325f, 0.3845f, 0.2989f, 0.1924f,
@@ -23,19 +32,17 @@ const PatchType Kaiser[64] = {
 	0.2989f, 0.4642f, 0.5974f, 0.6717f, 0.6717f, 0.5974f, 0.4642f, 0.2989f,
 	0.1924f, 0.2989f, 0.3846f, 0.4325f, 0.4325f, 0.3845f, 0.2989f, 0.1924f
 };
-#endif
 
-static inline DistType get_dist(ImageType a, ImageType b)
-{
-	int diff = (int)a - b;
-#if USE_L2_DIST
-	return diff * diff;
-#else
-	return diff >= 0 ? diff : -diff;
+const PatchType Kaiser4x4[16] = {
+	0.1924f, 0.4055f, 0.4055f, 0.1924f,
+	0.4055f, 0.8544f, 0.8544f, 0.4055f,
+	0.4055f, 0.8544f, 0.8544f, 0.4055f,
+	0.1924f, 0.4055f, 0.4055f, 0.1924f
+};
 #endif
-}
 
-BM3D::BM3D(
+template <typename ImageType>
+BM3D_T<ImageType>::BM3D_T(
 	int w_,					// width
 	int h_,					// height
 	int max_sim,			// maximum similar patches
@@ -44,10 +51,14 @@ BM3D::BM3D(
 	int swinrh_,			// horizontal search window radius
 	int ssteph_,			// horizontal search step
 	int swinrv_,			// vertical search window radius
-	int sstepv_			// vertical search step
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
 ) : orig_w(w_), orig_h(h_), psize(psize_), pstep(pstep_),
-	swinrh(swinrh_), ssteph(ssteph_), swinrv(swinrv_), sstepv(sstepv_)
+	swinrh(swinrh_), ssteph(ssteph_), swinrv(swinrv_), sstepv(sstepv_), bit_depth(bit_depth_)
 {
+	// samples deeper than the PatchType can hold are shifted right before the transform
+	shift = bit_depth > PATCH_MAX_DEPTH ? bit_depth - PATCH_MAX_DEPTH : 0;
+
 	// pad the last patch to ensure a completed step (copy the last row/column)
 	int w_pad = (orig_w - psize + pstep - 1) / pstep * pstep + psize - orig_w;
 	int h_pad = (orig_h - psize + pstep - 1) / pstep * pstep + psize - orig_h;
@@ -56,38 +67,41 @@ BM3D::BM3D(
 	w = orig_w + w_pad + swinrh * 2;
 	h = orig_h + h_pad + swinrv * 2;
 
-	g3d   = new Group3D(psize, psize, max_sim);
-	noisy = new ImageType[w * h]();
-
-	numerator   = new PatchType[w * (psize + swinrv * 2)];
-	denominator = new PatchType[w * (psize + swinrv * 2)];
+	g3d     = new Group3D(psize, psize, max_sim);
+	g3d->shift = shift;
+	matcher = new BlockMatcher<ImageType>(psize, pstep, swinrh, ssteph, swinrv, sstepv);
+	stats   = new PatchStats<ImageType>(psize, pstep, w, swinrv);	// only the rows of the search window are kept above the line
+	region  = new RegionMask(orig_w, orig_h, psize, pstep);
+	zeros   = new ImageType[orig_w]();
+	stream_in = NULL;
+	sink_out  = NULL;
+	noise_var = 0;
 
-	// the distances computed by the last patch can be partially reused when stepping forward
-	nbuf = (psize + pstep - 1) / pstep;
-	nsh  = (2 * swinrh + ssteph) / ssteph;
-	nsv  = (2 * swinrv + sstepv) / sstepv;
-
-	dist_buf = new DistType[nsh * nsv * nbuf];
-	dist_sum = new DistType[nsh * nsv];
+	lbuf = new LineBuffer(w, psize + swinrv * 2);
 
 	row_cnt = h;	// avoid processing without the noisy image initialization
 }
 
-BM3D::~BM3D()
+template <typename ImageType>
+BM3D_T<ImageType>::~BM3D_T()
 {
 	delete g3d;
-	delete[] noisy;
-	delete[] numerator;
-	delete[] denominator;
-	delete[] dist_buf;
-	delete[] dist_sum;
+	delete matcher;
+	delete stats;
+	delete region;
+	delete[] zeros;
+	delete lbuf;
+	delete stream_in;
+	delete sink_out;
 }
 
-void BM3D::run(ImageType *clean)
+template <typename ImageType>
+void BM3D_T<ImageType>::run(ImageType *clean)
 {
 	gtime = 0;
 	ftime = 0;
 	atime = 0;
+	perf.reset();
 
 	if (row_cnt > 0) 
 		reset();
@@ -104,42 +118,117 @@ void BM3D::run(ImageType *clean)
 			  << (double)gtime / stime * 100 << ' ' 
 			  << (double)ftime / stime * 100 << ' ' 
 			  << (double)atime / stime * 100 << std::endl;
+
+	perf.report("Step1");
 }
 
-void BM3D::reset()
+template <typename ImageType>
+void BM3D_T<ImageType>::set_mask(const uint8_t *mask, int stride, int halo)
+{
+	region->set_mask(mask, stride, halo);
+}
+
+template <typename ImageType>
+void BM3D_T<ImageType>::set_roi(int x, int y, int rw, int rh, int halo)
+{
+	region->set_roi(x, y, rw, rh, halo);
+}
+
+template <typename ImageType>
+void BM3D_T<ImageType>::set_search_mode(int mode)
+{
+	matcher->set_search_mode(mode, g3d->max_patches);
+}
+
+/* The rows above the first line are never aggregated by the tile, so the line buffers start empty there as well,
+ * and the lines stop once the last row of the tile is written out, i.e. (swinrv) rows above the next line.
+ */
+template <typename ImageType>
+int BM3D_T<ImageType>::run_tile(int x, int y, int tw, int th, ImageType *const *planes, const int *strides)
+{
+	if (x < 0 || y < 0 || tw <= 0 || th <= 0 || x + tw > orig_w || y + th > orig_h) return -1;	// the tile must be within the image
+
+	region->set_tile(x, y, tw, th, swinrh > swinrv ? swinrh : swinrv);
+	reset();
+	row_cnt = region->first_line();
+
+	PlaneOut<ImageType> out(planes[0], strides[0], 0, y);	// the first row of the tile is the row (y)
+	while (row_cnt - swinrv < y + th && next_line_planes(&out) >= 0);
+	region->set_mask(NULL, 0, 0);
+	return th;
+}
+
+template <typename ImageType>
+void BM3D_T<ImageType>::reset()
 {
 	row_cnt = 0;
-	memset(numerator,   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-	memset(denominator, 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+	lbuf->reset();
+	if (stream_in) stream_in->restart();
 }
 
-void BM3D::load(ImageType *org_noisy, int sigma, DistType max_mdist, int sigmau, int sigmav)
+template <typename ImageType>
+void BM3D_T<ImageType>::load(ImageType *org_noisy, int sigma, DistType max_mdist, int sigmau, int sigmav)
+{
+	const ImageType *planes[1] = {org_noisy};
+	const int strides[1] = {orig_w};
+	load_planes(planes, strides, sigma, max_mdist, sigmau, sigmav);
+}
+
+template <typename ImageType>
+void BM3D_T<ImageType>::load_planes(const ImageType *const *planes, const int *strides, int sigma, DistType max_mdist, int sigmau, int sigmav)
 {
 	row_cnt = 0;
-	g3d->set_thresholds(sigma, max_mdist * psize * psize);
+	g3d->set_thresholds(sigma, scale_mdist(max_mdist, bit_depth) * psize * psize);
+
+	noise_var = (double)sigma * sigma;
+	stats->reset();
+	if (stream_in) stream_in->set_source(NULL);
 
-	int w_pad = w - 2 * swinrh - orig_w;
-	int h_pad = h - 2 * swinrv - orig_h;
+	// pad the last patch with the last row/column, and the surrounding with zeros
+	noisy = PlaneView<ImageType>(planes[0], strides[0], orig_w, orig_h, w - 2 * swinrh, h - 2 * swinrv, zeros);
+	lbuf->reset();
+}
 
-	ImageType *tmp_noisy = noisy + swinrv * w + swinrh;
-	for (int i = 0; i < orig_h; i++)
+template <typename ImageType>
+void BM3D_T<ImageType>::load_source(RowSource<ImageType> *source, int sigma, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (stream_in == NULL || stream_in->nplanes != 1)
 	{
-		memcpy(tmp_noisy, org_noisy, orig_w * sizeof(ImageType));
-		for (int j = 0; j < w_pad; j++)
-		{
-			// edge padding
-			tmp_noisy[orig_w + j] = tmp_noisy[orig_w + j - 1];
-		}
-		tmp_noisy += w;
-		org_noisy += orig_w;
+		delete stream_in;
+		stream_in = new RowRing<ImageType>(1, orig_w, orig_h, psize + swinrv * 2);
 	}
-	for (int i = 0; i < h_pad; i++)
+
+	const ImageType *planes[1] = {stream_in->ring(0)};
+	const int strides[1] = {orig_w};
+	BM3D_T<ImageType>::load_planes(planes, strides, sigma, max_mdist);
+	noisy.ring = stream_in->rows;
+	stream_in->set_source(source);
+}
+
+template <typename ImageType>
+int BM3D_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out(clean, orig_w);
+	return next_line_planes(&out);
+}
+
+/* The rows completed by a line are written to a window of at most (psize + 2 * swinrv) rows, and then passed to the sink at once. */
+template <typename ImageType>
+int BM3D_T<ImageType>::next_line_sink(RowSink<ImageType> *sink)
+{
+	if (sink_out == NULL || sink_out->nplanes != 1)
 	{
-		memcpy(tmp_noisy, tmp_noisy - w, (orig_w + w_pad) * sizeof(ImageType));
-		tmp_noisy += w;
+		delete sink_out;
+		sink_out = new SinkRows<ImageType>(1, orig_w, psize + swinrv * 2);
 	}
-	memset(numerator,   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-	memset(denominator, 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+
+	PlaneOut<ImageType> out;
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	sink_out->out_planes(&out, out_row);
+
+	int output_rows = next_line_planes(&out);
+	sink_out->flush(sink, out_row, output_rows);
+	return output_rows;
 }
 
 /* Porcess a line of reference patches, the location of the line is recorded by (this->row_cnt).
@@ -154,64 +243,67 @@ void BM3D::load(ImageType *org_noisy, int sigma, DistType max_mdist, int sigmau,
  * so that the (this->row_cnt) increases step by step from 0 to the end of the image, 
  * as the numerator/denominator buffer records only partial information and updates progressively.
  */
-int BM3D::next_line(ImageType *clean)
+template <typename ImageType>
+int BM3D_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
 {
 	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
 
-	refer = noisy + (row_cnt + swinrv) * w + swinrh;	// the first reference patch of the line
-	numer = numerator   + swinrv * w + swinrh;
-	denom = denominator + swinrv * w + swinrh;
-
-	memset(dist_buf, 0, nsh * nsv * nbuf * sizeof(DistType));
-	memset(dist_sum, 0, nsh * nsv * sizeof(DistType));
+	// pull the rows needed by the search windows of the line
+	if (stream_in) stream_in->fill(row_cnt + psize + swinrv);
 
-	// initialize the distance buffer
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
+	refx = swinrh;
+	int nactive = region->start_line(row_cnt);	// reference patches of the line touching the region
+	if (nactive > 0)
 	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++)
-			{
-				for (int x = 0; x < psize - pstep; x++)
-				{
-					dist_buf[nbuf * idx + x / pstep] += get_dist(refer[y * w + x], refer[(y + sy) * w + x + sx]);
-				}
-			}
-			for (int i = 0; i < nbuf - 2; i++) {
-				dist_sum[idx] += dist_buf[nbuf * idx + i];
-			}
-		}
+		matcher->start_line(noisy, 0, row_cnt);
+		stats->start_line(noisy, row_cnt);
 	}
-	ncnt = nbuf;
 
 	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
 	// proceesing the line
-	for (int x = 0; x < orig_w + pstep - psize; x += pstep, ncnt++)
+	for (int x = 0; nactive > 0 && x < orig_w + pstep - psize; x += pstep)
 	{
+		if (!region->active(x / pstep))
+		{
+			stats->next_patch();
+			refx += pstep;
+			continue;
+		}
+
 		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
 		grouping();
+		matched += g3d->num;
+		nrefs++;
+		perf.end(PERF_STAGE_GROUPING);
 		gtime += clock() - t;
 
 		t = clock();
-		filtering();
+		perf.begin(PERF_STAGE_FILTERING);
+		if (flat_patch())
+			g3d->mean_filtering();
+		else
+			filtering();
+		perf.end(PERF_STAGE_FILTERING);
 		ftime += clock() - t;
 
 		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
 		aggregation();
+		perf.end(PERF_STAGE_AGGREGATION);
 		atime += clock() - t;
 
-		refer += pstep;
-		numer += pstep;
-		denom += pstep;
+		stats->next_patch();
+		refx += pstep;
 	}
 
 	// output the completed rows
-	numer = numerator   + swinrh;
-	denom = denominator + swinrh;
-
+	int first_row = 0;
 	int output_rows;
+	int out_row = 0;	// image row of the first output row
 	if (row_cnt < swinrv) 
 	{
 		if (row_cnt + pstep <= swinrv) {
@@ -220,8 +312,7 @@ int BM3D::next_line(ImageType *clean)
 		}
 		else {
 			output_rows = row_cnt + pstep - swinrv;
-			numer += (pstep - output_rows) * w;
-			denom += (pstep - output_rows) * w;
+			first_row = pstep - output_rows;
 		}
 	} 
 	else 
@@ -230,106 +321,88 @@ int BM3D::next_line(ImageType *clean)
 			output_rows = orig_h - row_cnt + swinrv;	// the last line of reference patches
 		else
 			output_rows = pstep;
-		clean += orig_w * (row_cnt - swinrv);
+		out_row = row_cnt - swinrv;
 	}
 
-	for (int i = 0, r = 0; r < output_rows; r++)
+	for (int r = 0; r < output_rows; r++)
 	{
-		for (int c = 0; c < orig_w; c++, i++)
-		{
-			clean[i] = (ImageType)(numer[c] / denom[c]);
-		}
-		numer += w;
-		denom += w;
+		if (!region->writes(out_row + r)) continue;
+		ImageType *row = out->row(out_row + r);
+		const PatchType *numer = lbuf->numer_row(first_row + r) + swinrh;
+		const PatchType *denom = lbuf->denom_row(first_row + r) + swinrh;
+		const ImageType *in = noisy.row(out_row + r);
+		region->output_row(&row, &in, &numer, &denom, 1, out_row + r, (1 << bit_depth) - 1, shift);
 	}
 
-	// remove the fisrt (pstep) rows of the numerator and denominator buffers
-	// and insert (pstep) new rows to the end of the buffers
+	// discard the fisrt (pstep) rows of the numerator and denominator buffers
+	// and recycle them as (pstep) new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
 	shift_numer_denom();
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
 
 	row_cnt += pstep;
 	return output_rows;
 }
 
-void BM3D::grouping()
+template <typename ImageType>
+void BM3D_T<ImageType>::grouping()
 {
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
-	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++)
-			{
-				for (int x = psize - pstep; x < psize; x++)
-				{
-					dist_buf[nbuf * idx + (ncnt + x / pstep) % nbuf] += get_dist(refer[y * w + x], refer[(y + sy) * w + x + sx]);
-				}
-			}
-			dist_sum[idx] += dist_buf[nbuf * idx + (ncnt - 2) % nbuf];
-			dist_sum[idx] += dist_buf[nbuf * idx + (ncnt - 1) % nbuf];
-		}
-	}
+	matcher->match(noisy, refx - swinrh, row_cnt, g3d);
+	g3d->fill_patches_values(noisy, refx - swinrh, row_cnt);
+}
 
-	g3d->set_reference();
-	for (int idx = 0, sy = -swinrv; sy <= swinrv; sy += sstepv)
-	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph, idx++)
-		{
-			g3d->insert_patch(sx, sy, dist_sum[idx]);
-		}
-	}
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int i = 0; i < nsv; i++)
-	{
-		for (int j = 0; j < nsh; j++)
-		{
-			int idx = i * nsh + j;
-			dist_sum[idx] -= dist_buf[nbuf * idx + (ncnt - 1) % nbuf];
-			dist_sum[idx] -= dist_buf[nbuf * idx + (ncnt - 0) % nbuf];
-			dist_buf[nbuf * idx + ncnt % nbuf] = 0;
-		}
-	}
+template <typename ImageType>
+void BM3D_T<ImageType>::filtering()
+{
+	filtering(g3d);
+}
 
-	g3d->fill_patches_values(refer, w);
+template <typename ImageType>
+void BM3D_T<ImageType>::filtering(Group3D *group)
+{
+	group->transform_3d();
+	group->hard_thresholding();
+	group->inv_transform_3d();
 }
 
-void BM3D::filtering()
+/* A patch is flat if its variance exceeds that of its noise by less than (FLAT_VAR_RATIO), as the variance of the noise is included.
+ * The noise is estimated by the differences of the horizontal neighbours of the patch, as the given sigma is often overestimated
+ * for smoother results, and it's bounded by the sigma^2, so that a fine texture isn't taken as the noise.
+ * The ratio is negative by default, as the differences of a smooth texture are still added to the noise of the patch.
+ */
+template <typename ImageType>
+bool BM3D_T<ImageType>::flat_patch() const
 {
-	g3d->transform_3d();
-	g3d->hard_thresholding();
-	g3d->inv_transform_3d();
+	double noise = stats->noise();
+	noise = noise < noise_var ? noise : noise_var;
+	return stats->variance() < (1 + FLAT_VAR_RATIO) * noise;
 }
 
-void BM3D::aggregation()
+/* The Kaiser window is weighted once per group, and then each patch is accumulated row by row.
+ */
+template <typename ImageType>
+void BM3D_T<ImageType>::aggregation()
 {
-	PatchType weight = g3d->get_weight();
-	for (int p = 0; p < g3d->num; p++)
-	{
-		int x = g3d->patch[p]->x;
-		int y = g3d->patch[p]->y;
-		for (int i = 0, r = 0; r < psize; r++)
-		{
-			for (int c = 0; c < psize; c++, i++)
-			{
-				numer[(r + y) * w + c + x] += Kaiser[i] * weight * g3d->patch[p]->values[i];
-				denom[(r + y) * w + c + x] += Kaiser[i] * weight;
-			}
-		}
-	}
+	aggregation(g3d, lbuf);
 }
 
-void BM3D::shift_numer_denom()
+template <typename ImageType>
+void BM3D_T<ImageType>::aggregation(Group3D *group, LineBuffer *buf)
 {
-	numer = numerator;
-	denom = denominator;
-	for (int i = 0; i < 2 * swinrv + psize - pstep; i++)
-	{
-		memcpy(numer, numer + w * pstep, w * sizeof(PatchType));
-		memcpy(denom, denom + w * pstep, w * sizeof(PatchType));
-		numer += w;
-		denom += w;
-	}
-	memset(numer, 0, w * pstep * sizeof(PatchType));
-	memset(denom, 0, w * pstep * sizeof(PatchType));
-}
\ No newline at end of file
+	group->set_aggregation_weight(Kaiser, group->get_weight());
+
+	group->aggregate(buf, refx, swinrv);
+}
+
+template <typename ImageType>
+void BM3D_T<ImageType>::shift_numer_denom()
+{
+	lbuf->shift(pstep);
+}
+
+template class BM3D_T<uint8_t>;
+template class BM3D_T<uint16_t>;
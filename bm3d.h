@@ -8,9 +8,17 @@
 #include "global_define.h"
 #include "patch_2d.h"
 #include "group_3d.h"
+#include "block_match.h"
+#include "patch_stats.h"
+#include "row_source.h"
+#include "row_sink.h"
+#include "perf_counters.h"
+#include "region_mask.h"
 
 // 8x8 Kaiser window
 extern const PatchType Kaiser[64];
+// 4x4 Kaiser window of the subsampled chroma patches
+extern const PatchType Kaiser4x4[16];
 
 /* Implementation of the first step, i.e. Hard-thresholding, of the BM3D denoising method for graysacle images.
  * Note that the implementation only supports graysacle images, or YUV 4:0:0 format.
@@ -19,10 +27,11 @@ extern const PatchType Kaiser[64];
  * For example, if Y = a*R + b*G + c*B, we can compute that sigmaY = sqrt(a*a + b*b + c*c) * sigmaR/G/B.
  * We can approximately compute sigmaY = 0.6 * sigmaR/G/B for the BT.601 or BT.709.
  */
-class BM3D
+template <typename ImageType>
+class BM3D_T
 {
 public:
-	BM3D(
+	BM3D_T(
 		int w_,						// width
 		int h_,						// height
 		int max_sim = 16,			// maximum similar patches
@@ -31,9 +40,10 @@ public:
 		int swinrh_ = 16,			// horizontal search window radius
 		int ssteph_ = 1,			// horizontal search step
 		int swinrv_ = 16,			// vertical search window radius
-		int sstepv_ = 1				// vertical search step
+		int sstepv_ = 1,			// vertical search step
+		int bit_depth_ = SampleTraits<ImageType>::max_depth	// bit depth of the samples
 	);
-	virtual ~BM3D();
+	virtual ~BM3D_T();
 
 	/* Load a new grayscale image and reset the buffers. */
 	virtual void load(
@@ -44,6 +54,54 @@ public:
 		int sigmav = -1				// sigma of the V component, has no use for YUV 4:0:0
 	);
 
+	/* Load the planes of a new image in place and reset the buffers.
+	 * The planes are not copied but read directly with their own strides (in pixels), 
+	 * so they must be kept valid until the whole image is processed.
+	 * The output can be written to the input planes themselves, as the output rows are never read again.
+	 */
+	virtual void load_planes(
+		const ImageType *const *planes,	// pointers of the input noisy planes, only the first one is used for grayscale images
+		const int *strides,			// strides of the planes
+		int sigma,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, has no use for YUV 4:0:0
+		int sigmav = -1				// sigma of the V component, has no use for YUV 4:0:0
+	);
+
+	/* Load a new grayscale image from a row source and reset the buffers.
+	 * Only the (psize + 2 * swinrv) rows needed by the current line of reference patches are kept in a ring, 
+	 * and the following rows are pulled from the source as the lines advance, i.e. rows[0] is the noisy row.
+	 */
+	virtual void load_source(
+		RowSource<ImageType> *source,	// source of the input noisy rows, kept valid until the whole image is processed
+		int sigma,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, has no use for YUV 4:0:0
+		int sigmav = -1				// sigma of the V component, has no use for YUV 4:0:0
+	);
+
+	/* Denoise only the nonzero pixels of a mask, e.g. the faces flagged by a detector, and pass the others through.
+	 * Only the reference patches touching the mask dilated by the (halo) are processed, see RegionMask.
+	 * The mask has the size of the image, and is kept valid until the whole image is processed, NULL to denoise the whole image.
+	 * The YUV 4:2:0/4:2:2 engines ignore the region and denoise the whole image.
+	 */
+	virtual void set_mask(
+		const uint8_t *mask,		// nonzero pixels to denoise
+		int stride,					// distance (in pixels) between two adjacent rows of the mask
+		int halo = 0				// dilation of the mask to select the reference patches, the search window radius for exact results
+	);
+
+	/* Denoise only the rectangle [x, x + rw) x [y, y + rh), e.g. a crop, and pass the others through, see set_mask(). */
+	virtual void set_roi(int x, int y, int rw, int rh, int halo = 0);
+
+	/* Select the grouping, i.e. SEARCH_MODE_WINDOW (default) or SEARCH_MODE_INDEX.
+	 * The index mode matches the approximate nearest patches of the whole width of the band of the search window
+	 * by the PatchIndex, rather than all the candidates of the window, so that the repeated structures far apart are grouped,
+	 * at a cost independent of the horizontal window radius (swinrh).
+	 * The YUV 4:2:0/4:2:2 engines ignore the mode and keep the window.
+	 */
+	virtual void set_search_mode(int mode);
+
 	/* reset the buffers and redirect the processing reference patch to the first one of the noisy image */
 	virtual void reset();
 
@@ -52,21 +110,66 @@ public:
 		ImageType *clean			// pointer of the output denoised grayscale image
 	);
 
+	/* Denoise just a line of reference patches and write out the completed rows to the output plane. */
+	virtual int next_line_planes(
+		const PlaneOut<ImageType> *out	// output denoised plane
+	);
+
+	/* Denoise just a line of reference patches and pass the completed rows to the sink, 
+	 * so that the output needs no whole image, i.e. rows[0] is the denoised row.
+	 * Returns the same as next_line().
+	 */
+	virtual int next_line_sink(
+		RowSink<ImageType> *sink	// sink of the output denoised rows
+	);
+
 	/* Denoise a whole grayscale image and write out the result. */
 	void run(
 		ImageType *clean			// pointer of the output denoised grayscale image
 	);
 
+	/* Denoise only the tile [x, x + tw) x [y, y + th) of the loaded image, e.g. a tile requested by a viewer,
+	 * and write it to the output planes, which begin at the top-left pixel of the tile.
+	 * The lines of reference patches start at the first one whose groups can reach the tile rather than the top of the image,
+	 * and only the reference patches within the search window radius of the tile are processed (see set_roi()),
+	 * so the tile is exactly the same as denoising the whole image, at the cost of the tile with a halo of (swinr + psize).
+	 * In the SEARCH_MODE_INDEX, the reference patches farther than the window can be grouped with the tile too, which are missed.
+	 * The tiles are independent, so they can be denoised concurrently by several engines loaded with the same image.
+	 * The region set by set_roi() or set_mask() is cleared.
+	 * Returns the rows of the tile, or -1 if the tile is empty or not within the image,
+	 * or the engine can't denoise a tile, e.g. the YUV 4:2:0/4:2:2 engines.
+	 */
+	virtual int run_tile(
+		int x, int y,				// top-left pixel of the tile
+		int tw, int th,				// width and height of the tile
+		ImageType *const *planes,	// pointers of the output planes, beginning at the top-left pixel of the tile, only the first one is used for grayscale images
+		const int *strides			// strides of the output planes
+	);
+
+	/* Hardware counters of the stages since the last run() or reset() of the counters, 
+	 * e.g. to report them per frame when the lines are pulled by next_line(). Nothing is counted unless USE_PERF_COUNTERS.
+	 */
+	PerfCounters *counters() { return &perf; }
+
 	/* grouping step of a single patch */
 	void grouping();
 
 	/* filtering step of a single patch */
 	void filtering();
 
+	/* hard-threshold filtering of the group */
+	void filtering(Group3D *group);
+
+	/* whether the current reference patch is flat, whose group is replaced by its mean rather than filtered */
+	bool flat_patch() const;
+
 	/* aggregation step of a single patch */
 	void aggregation();
 
-	/* discard the first (pstep) rows and shift the remains of the numerator/denominator buffer */
+	/* aggregation of the filtered group into the line buffers */
+	void aggregation(Group3D *group, LineBuffer *buf);
+
+	/* discard the first (pstep) rows of the numerator/denominator buffer and recycle them as the last rows */
 	void shift_numer_denom();
 
 protected:
@@ -74,7 +177,10 @@ protected:
 	int orig_h;			// original image height
 	int w;				// padded image width
 	int h;				// padded image height
-	ImageType *noisy;	// padded noisy image
+	PlaneView<ImageType> noisy;	// view of the noisy image, padded virtually
+	ImageType *zeros;	// a row of zeros, used as the rows out of the image
+	RowRing<ImageType> *stream_in;	// rings of the rows pulled from a row source, NULL if never streamed
+	SinkRows<ImageType> *sink_out;	// rows passed to a row sink, NULL if never used
 
 	int psize;			// patch size
 	int pstep;			// reference patch step
@@ -86,28 +192,28 @@ protected:
 	int sstepv;			// vertical search step
 
 	Group3D *g3d;		// 3d group containg the reference patch and all its similar ones
-	ImageType *refer;	// reference patch pointer (top-left)
+	BlockMatcher<ImageType> *matcher;	// block-matching of the reference patches line by line
+	PatchStats<ImageType> *stats;		// variances of the reference patches of the line
+	RegionMask *region;					// region to denoise, the whole image by default
 
-	int row_cnt;		// counter of the processed rows of the original image
+	double noise_var;	// variance of the noise, i.e. sigma^2, which bounds the noise estimated by each reference patch
 
-	PatchType *numerator;		// size: w * (2 * swinrv + psize)
-	PatchType *denominator;		// size: w * (2 * swinrv + psize)
-	PatchType *numer;			// template pointer
-	PatchType *denom;			// template pointer
+	int bit_depth;		// bit depth of the samples
+	int shift;			// right shift of the samples to fit the precision of the PatchType
 
-	DistType *dist_buf;		// sliding buffer to record the distances step by step
-	DistType *dist_sum;		// distances buffer of each candidate patch
-
-	int nbuf;				// number of steps in a single patch, ceil(psize / pstep)
-	int ncnt;				// counter of the steps
+	int row_cnt;		// counter of the processed rows of the original image
 
-	int nsh;				// number of horizontal candidate patches in a searching window
-	int nsv;				// number of vertical candidate patches in a searching window
+	LineBuffer *lbuf;	// numerator and denominator line buffers, size: w * (2 * swinrv + psize)
+	int refx;			// column of the current reference patch in the line buffers
 
 	clock_t gtime;			// timer of the grouping step
 	clock_t ftime;			// timer of the filtering step
 	clock_t atime;			// timer of the aggregation step
+	PerfCounters perf;		// hardware counters of the stages (USE_PERF_COUNTERS)
 };
 
+typedef BM3D_T<uint8_t>  BM3D;		// 8-bit samples
+typedef BM3D_T<uint16_t> BM3D16;	// 9 to 16-bit samples
+
 #endif
 
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <algorithm>
+#include "bm3d_batch.h"
+#include "trace.h"
+
+template <typename ImageType>
+BM3D_BATCH_T<ImageType>::BM3D_BATCH_T(int chnl_, int en_step2_, int nworkers_, int bit_depth_)
+	: chnl(chnl_), en_step2(en_step2_), bit_depth(bit_depth_)
+{
+	nworkers = nworkers_ > 0 ? nworkers_ : omp_get_num_procs();
+	workers = new Worker[nworkers];
+	for (int i = 0; i < nworkers; i++)
+	{
+		workers[i].w = 0;
+		workers[i].h = 0;
+		workers[i].step1 = NULL;
+		workers[i].step2 = NULL;
+		workers[i].basic = NULL;
+	}
+	order = NULL;
+	order_size = 0;
+}
+
+template <typename ImageType>
+BM3D_BATCH_T<ImageType>::~BM3D_BATCH_T()
+{
+	for (int i = 0; i < nworkers; i++)
+	{
+		delete workers[i].step1;
+		delete workers[i].step2;
+		delete[] workers[i].basic;
+	}
+	delete[] workers;
+	delete[] order;
+}
+
+// order of the images by size, i.e. by height and then by width
+template <typename ImageType>
+struct BatchOrder
+{
+	const BatchImage<ImageType> *images;
+
+	bool operator()(int a, int b) const
+	{
+		return images[a].h != images[b].h ? images[a].h < images[b].h : images[a].w < images[b].w;
+	}
+};
+
+/* The images are sorted by size, so that the consecutive images picked by a worker likely share its engines. */
+template <typename ImageType>
+void BM3D_BATCH_T<ImageType>::run(BatchImage<ImageType> *images, int n)
+{
+	if (n > order_size)
+	{
+		delete[] order;
+		order = new int[n];
+		order_size = n;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		order[i] = i;
+	}
+	BatchOrder<ImageType> by_size = {images};
+	std::stable_sort(order, order + n, by_size);
+
+	// a single worker runs outside any parallel region, as the nested regions under an inactive one get new teams every time
+	int nw = nworkers < n ? nworkers : n;
+	if (nw <= 1)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			denoise(workers, images[order[i]]);
+		}
+		return;
+	}
+
+#pragma omp parallel num_threads(nw)
+	{
+		Worker *wk = workers + omp_get_thread_num();
+#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i < n; i++)
+		{
+			double t0 = trace_begin();
+			denoise(wk, images[order[i]]);
+			trace_span("image", t0, order[i]);
+		}
+	}
+}
+
+template <typename ImageType>
+void BM3D_BATCH_T<ImageType>::denoise(Worker *wk, const BatchImage<ImageType> &img)
+{
+	if (wk->w != img.w || wk->h != img.h)
+	{
+		delete wk->step1;
+		delete wk->step2;
+		delete[] wk->basic;
+		wk->step2 = NULL;
+		wk->basic = NULL;
+
+		// the same parameters as main.cpp, at present the psize must be 8
+		if (chnl == 1)
+			wk->step1 = new BM3D_T<ImageType>(img.w, img.h, 16, 8, 3, 16, 1, 16, 1, bit_depth);
+		else
+			wk->step1 = new CBM3D_T<ImageType>(img.w, img.h, 16, 8, 3, 16, 1, 16, 1, bit_depth);
+
+		if (en_step2)
+		{
+			if (chnl == 1)
+				wk->step2 = new BM3D_WIE_T<ImageType>(img.w, img.h, 32, 8, 3, 16, 1, 16, 1, bit_depth);
+			else
+				wk->step2 = new CBM3D_WIE_T<ImageType>(img.w, img.h, 32, 8, 3, 16, 1, 16, 1, bit_depth);
+			wk->basic = new ImageType[img.w * img.h * chnl];
+		}
+		wk->w = img.w;
+		wk->h = img.h;
+	}
+
+	// the noisy image is never written, as the output of the first step goes to the basic image if there's the second one
+	ImageType *out1 = en_step2 ? wk->basic : img.clean;
+	wk->step1->load((ImageType *)img.noisy, img.sigma);
+	while (wk->step1->next_line(out1) >= 0);
+
+	if (en_step2)
+	{
+		wk->step2->load((ImageType *)img.noisy, wk->basic, img.sigma_wie);
+		while (wk->step2->next_line(img.clean) >= 0);
+	}
+}
+
+template class BM3D_BATCH_T<uint8_t>;
+template class BM3D_BATCH_T<uint16_t>;
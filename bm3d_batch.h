@@ -0,0 +1,75 @@
+#ifndef __BM3D_BATCH_H__
+#define __BM3D_BATCH_H__
+
+#include "bm3d.h"
+#include "bm3d_wiener.h"
+#include "cbm3d.h"
+#include "cbm3d_wiener.h"
+
+/* An image of a batch, stored as the frames of main.cpp, i.e. a grayscale plane or the planar Y/U/V (4:4:4) planes. */
+template <typename ImageType>
+struct BatchImage
+{
+	int w;						// width
+	int h;						// height
+	const ImageType *noisy;		// input noisy image
+	ImageType *clean;			// output denoised image, which can be the input one
+	int sigma;					// sigma of the first step, the same for Y/U/V
+	int sigma_wie;				// sigma of the second step, the same for Y/U/V
+};
+
+/* Denoising of a batch of small images, e.g. thumbnails or crops, of the same or mixed sizes.
+ * A small image has only a few lines of reference patches, so the parallel regions inside the grouping
+ * and the aggregation cost more than they save. The images are rather spread across the workers,
+ * each of which denoises a whole image at a time by its own engines, without the nested parallel regions
+ * (the nested parallelism of OpenMP is disabled by default).
+ * The engines and the basic image of a worker are kept across the images and the batches,
+ * and rebuilt only if the size of the image changes, so the images are scheduled by their sizes.
+ */
+template <typename ImageType>
+class BM3D_BATCH_T
+{
+public:
+	BM3D_BATCH_T(
+		int chnl_,					// channels of the images, 1 for grayscale or 3 for YUV 4:4:4
+		int en_step2_ = 1,			// enable the second step, i.e. Wiener filtering
+		int nworkers_ = 0,			// number of workers, the number of processors if <= 0
+		int bit_depth_ = SampleTraits<ImageType>::max_depth	// bit depth of the samples
+	);
+	~BM3D_BATCH_T();
+
+	/* Denoise a batch of images and write out the results. */
+	void run(
+		BatchImage<ImageType> *images,	// images of the batch
+		int n						// number of images
+	);
+
+protected:
+	/* Engines and buffers of a worker, for the images of a single size. */
+	struct Worker
+	{
+		int w;					// width of the engines, 0 if not built yet
+		int h;					// height of the engines
+		BM3D_T<ImageType> *step1;		// BM3D or CBM3D
+		BM3D_WIE_T<ImageType> *step2;	// BM3D_WIE or CBM3D_WIE, NULL if the second step is disabled
+		ImageType *basic;		// basic image of the first step, size: w * h * chnl
+	};
+
+	/* denoise an image by a worker, whose engines are rebuilt for the size of the image if needed */
+	void denoise(Worker *wk, const BatchImage<ImageType> &img);
+
+	int chnl;				// channels of the images
+	int en_step2;			// enable the second step
+	int bit_depth;			// bit depth of the samples
+
+	int nworkers;			// number of workers
+	Worker *workers;		// engines and buffers of the workers
+
+	int *order;				// indices of the images sorted by size
+	int order_size;			// capacity of the (order)
+};
+
+typedef BM3D_BATCH_T<uint8_t>  BM3D_BATCH;		// 8-bit samples
+typedef BM3D_BATCH_T<uint16_t> BM3D_BATCH16;	// 9 to 16-bit samples
+
+#endif
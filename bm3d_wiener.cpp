@@ -1,17 +1,10 @@
 #include <iostream>
 #include "bm3d_wiener.h"
+#include "kernels.h"
+#include "trace.h"
 
-static inline DistType get_dist(ImageType a, ImageType b)
-{
-	int diff = (int)a - b;
-#if USE_L2_DIST
-	return diff * diff;
-#else
-	return diff >= 0 ? diff : -diff;
-#endif
-}
-
-BM3D_WIE::BM3D_WIE(
+template <typename ImageType>
+BM3D_WIE_T<ImageType>::BM3D_WIE_T(
 	int w_,					// width
 	int h_,					// height
 	int max_sim,			// maximum similar patches
@@ -20,10 +13,14 @@ BM3D_WIE::BM3D_WIE(
 	int swinrh_,			// horizontal search window radius
 	int ssteph_,			// horizontal search step
 	int swinrv_,			// vertical search window radius
-	int sstepv_			// vertical search step
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
 ) : orig_w(w_), orig_h(h_), psize(psize_), pstep(pstep_),
-	swinrh(swinrh_), ssteph(ssteph_), swinrv(swinrv_), sstepv(sstepv_)
+	swinrh(swinrh_), ssteph(ssteph_), swinrv(swinrv_), sstepv(sstepv_), bit_depth(bit_depth_)
 {
+	// samples deeper than the PatchType can hold are shifted right before the transform
+	shift = bit_depth > PATCH_MAX_DEPTH ? bit_depth - PATCH_MAX_DEPTH : 0;
+
 	// pad the last patch to ensure a completed step (copy the last row/column)
 	int w_pad = (orig_w - psize + pstep - 1) / pstep * pstep + psize - orig_w;
 	int h_pad = (orig_h - psize + pstep - 1) / pstep * pstep + psize - orig_h;
@@ -34,40 +31,43 @@ BM3D_WIE::BM3D_WIE(
 
 	g3d_noisy = new Group3D(psize, psize, max_sim);
 	g3d_basic = new Group3D(psize, psize, max_sim);
-	noisy = new ImageType[w * h]();
-	basic = new ImageType[w * h]();
-
-	numerator   = new PatchType[w * (psize + swinrv * 2)];
-	denominator = new PatchType[w * (psize + swinrv * 2)];
-
-	// the distances computed by the last patch can be partially reused when stepping forward
-	nbuf = (psize + pstep - 1) / pstep;
-	nsh  = (2 * swinrh + ssteph) / ssteph;
-	nsv  = (2 * swinrv + sstepv) / sstepv;
-
-	dist_buf = new DistType[nsh * nsv * nbuf];
-	dist_sum = new DistType[nsh * nsv];
+	g3d_noisy->shift = shift;
+	g3d_basic->shift = shift;
+	matcher = new BlockMatcher<ImageType>(psize, pstep, swinrh, ssteph, swinrv, sstepv);
+	stats   = new PatchStats<ImageType>(psize, pstep, w, swinrv);	// only the rows of the search window are kept above the line
+	region  = new RegionMask(orig_w, orig_h, psize, pstep);
+	zeros   = new ImageType[orig_w]();
+	stream_in = NULL;
+	sink_out  = NULL;
+	flat_var  = 0;
+	noise_var = 0;
+
+	lbuf = new LineBuffer(w, psize + swinrv * 2);
 
 	row_cnt = h;	// avoid processing without the noisy image initialization
 }
 
-BM3D_WIE::~BM3D_WIE()
+template <typename ImageType>
+BM3D_WIE_T<ImageType>::~BM3D_WIE_T()
 {
 	delete g3d_noisy;
 	delete g3d_basic;
-	delete[] noisy;
-	delete[] basic;
-	delete[] numerator;
-	delete[] denominator;
-	delete[] dist_buf;
-	delete[] dist_sum;
+	delete matcher;
+	delete stats;
+	delete region;
+	delete[] zeros;
+	delete lbuf;
+	delete stream_in;
+	delete sink_out;
 }
 
-void BM3D_WIE::run(ImageType *clean)
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::run(ImageType *clean)
 {
 	gtime = 0;
 	ftime = 0;
 	atime = 0;
+	perf.reset();
 
 	if (row_cnt > 0) 
 		reset();
@@ -84,50 +84,121 @@ void BM3D_WIE::run(ImageType *clean)
 			  << (double)gtime / stime * 100 << ' ' 
 			  << (double)ftime / stime * 100 << ' ' 
 			  << (double)atime / stime * 100 << std::endl;
+
+	perf.report("Step2");
 }
 
-void BM3D_WIE::reset()
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::set_mask(const uint8_t *mask, int stride, int halo)
 {
-	row_cnt = 0;
-	memset(numerator,   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-	memset(denominator, 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+	region->set_mask(mask, stride, halo);
 }
 
-void BM3D_WIE::load(ImageType *org_noisy, ImageType *org_basic, int sigma, DistType max_mdist, int sigmau, int sigmav)
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::set_roi(int x, int y, int rw, int rh, int halo)
+{
+	region->set_roi(x, y, rw, rh, halo);
+}
+
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::set_search_mode(int mode)
+{
+	matcher->set_search_mode(mode, g3d_basic->max_patches);
+}
+
+template <typename ImageType>
+int BM3D_WIE_T<ImageType>::run_tile(int x, int y, int tw, int th, ImageType *const *planes, const int *strides)
+{
+	if (x < 0 || y < 0 || tw <= 0 || th <= 0 || x + tw > orig_w || y + th > orig_h) return -1;	// the tile must be within the image
+
+	region->set_tile(x, y, tw, th, swinrh > swinrv ? swinrh : swinrv);
+	reset();
+	row_cnt = region->first_line();
+
+	PlaneOut<ImageType> out(planes[0], strides[0], 0, y);	// the first row of the tile is the row (y)
+	while (row_cnt - swinrv < y + th && next_line_planes(&out) >= 0);
+	region->set_mask(NULL, 0, 0);
+	return th;
+}
+
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::reset()
 {
 	row_cnt = 0;
-	g3d_basic->max_dist = max_mdist * psize * psize;
-	g3d_basic->thres = sigma * sigma * (1 << (COEFF_DICI_BITS * 2));
+	lbuf->reset();
+	if (stream_in) stream_in->restart();
+}
 
-	int w_pad = w - 2 * swinrh - orig_w;
-	int h_pad = h - 2 * swinrv - orig_h;
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::load(ImageType *org_noisy, ImageType *org_basic, int sigma, DistType max_mdist, int sigmau, int sigmav)
+{
+	const ImageType *noisy_planes[1] = {org_noisy};
+	const ImageType *basic_planes[1] = {org_basic};
+	const int strides[1] = {orig_w};
+	load_planes(noisy_planes, strides, basic_planes, strides, sigma, max_mdist, sigmau, sigmav);
+}
+
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::load_planes(const ImageType *const *noisy_planes, const int *noisy_strides, 
+	const ImageType *const *basic_planes, const int *basic_strides, int sigma, DistType max_mdist, int sigmau, int sigmav)
+{
+	row_cnt = 0;
+	g3d_basic->max_dist = scale_mdist(max_mdist, bit_depth) * psize * psize;
+	g3d_basic->thres = wiener_thres(sigma, shift);
+
+	// the basic patches are (nearly) free of the noise, so the threshold is much lower
+	noise_var = (double)sigma * sigma;
+	flat_var  = FLAT_VAR_RATIO_WIE * noise_var;
+	stats->reset();
+	if (stream_in) stream_in->set_source(NULL);
+
+	// pad the last patch with the last row/column, and the surrounding with zeros
+	noisy = PlaneView<ImageType>(noisy_planes[0], noisy_strides[0], orig_w, orig_h, w - 2 * swinrh, h - 2 * swinrv, zeros);
+	basic = PlaneView<ImageType>(basic_planes[0], basic_strides[0], orig_w, orig_h, w - 2 * swinrh, h - 2 * swinrv, zeros);
+	lbuf->reset();
+}
 
-	ImageType *tmp_noisy = noisy + swinrv * w + swinrh;
-	ImageType *tmp_basic = basic + swinrv * w + swinrh;
-	for (int i = 0; i < orig_h; i++)
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::load_source(RowSource<ImageType> *source, int sigma, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (stream_in == NULL || stream_in->nplanes != 2)
 	{
-		memcpy(tmp_noisy, org_noisy, orig_w * sizeof(ImageType));
-		memcpy(tmp_basic, org_basic, orig_w * sizeof(ImageType));
-		for (int j = 0; j < w_pad; j++)
-		{
-			// edge padding
-			tmp_noisy[orig_w + j] = tmp_noisy[orig_w + j - 1];
-			tmp_basic[orig_w + j] = tmp_basic[orig_w + j - 1];
-		}
-		tmp_noisy += w;
-		tmp_basic += w;
-		org_noisy += orig_w;
-		org_basic += orig_w;
+		delete stream_in;
+		stream_in = new RowRing<ImageType>(2, orig_w, orig_h, psize + swinrv * 2);
 	}
-	for (int i = 0; i < h_pad; i++)
+
+	const ImageType *noisy_planes[1] = {stream_in->ring(0)};
+	const ImageType *basic_planes[1] = {stream_in->ring(1)};
+	const int strides[1] = {orig_w};
+	BM3D_WIE_T<ImageType>::load_planes(noisy_planes, strides, basic_planes, strides, sigma, max_mdist);
+	noisy.ring = stream_in->rows;
+	basic.ring = stream_in->rows;
+	stream_in->set_source(source);
+}
+
+template <typename ImageType>
+int BM3D_WIE_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out(clean, orig_w);
+	return next_line_planes(&out);
+}
+
+template <typename ImageType>
+int BM3D_WIE_T<ImageType>::next_line_sink(RowSink<ImageType> *sink)
+{
+	if (sink_out == NULL || sink_out->nplanes != 1)
 	{
-		memcpy(tmp_noisy, tmp_noisy - w, (orig_w + w_pad) * sizeof(ImageType));
-		memcpy(tmp_basic, tmp_basic - w, (orig_w + w_pad) * sizeof(ImageType));
-		tmp_noisy += w;
-		tmp_basic += w;
+		delete sink_out;
+		sink_out = new SinkRows<ImageType>(1, orig_w, psize + swinrv * 2);
 	}
-	memset(numerator,   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-	memset(denominator, 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+
+	PlaneOut<ImageType> out;
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	sink_out->out_planes(&out, out_row);
+
+	int output_rows = next_line_planes(&out);
+	sink_out->flush(sink, out_row, output_rows);
+	return output_rows;
 }
 
 /* Porcess a line of reference patches, the location of the line is recorded by (this->row_cnt).
@@ -142,67 +213,74 @@ void BM3D_WIE::load(ImageType *org_noisy, ImageType *org_basic, int sigma, DistT
  * so that the (this->row_cnt) increases step by step from 0 to the end of the image, 
  * as the numerator/denominator buffer records only partial information and updates progressively.
  */
-int BM3D_WIE::next_line(ImageType *clean)
+template <typename ImageType>
+int BM3D_WIE_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
 {
 	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
 
-	refer_noisy = noisy + (row_cnt + swinrv) * w + swinrh;	// the first reference patch of the line
-	refer_basic = basic + (row_cnt + swinrv) * w + swinrh;	// the first reference patch of the line
-
-	numer = numerator   + swinrv * w + swinrh;
-	denom = denominator + swinrv * w + swinrh;
-
-	memset(dist_buf, 0, nsh * nsv * nbuf * sizeof(DistType));
-	memset(dist_sum, 0, nsh * nsv * sizeof(DistType));
+	// pull the rows needed by the search windows of the line
+	if (stream_in) stream_in->fill(row_cnt + psize + swinrv);
 
-	// initialize the distance buffer
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
+	refx = swinrh;
+	int nactive = region->start_line(row_cnt);	// reference patches of the line touching the region
+	if (nactive > 0)
 	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++)
-			{
-				for (int x = 0; x < psize - pstep; x++)
-				{
-					dist_buf[nbuf * idx + x / pstep] += get_dist(refer_basic[y * w + x], refer_basic[(y + sy) * w + x + sx]);
-				}
-			}
-			for (int i = 0; i < nbuf - 2; i++) {
-				dist_sum[idx] += dist_buf[nbuf * idx + i];
-			}
-		}
+		matcher->start_line(basic, 0, row_cnt);
+		stats->start_line(basic, row_cnt);
 	}
-	ncnt = nbuf;
 
 	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
 	// proceesing the line
-	for (int x = 0; x < orig_w + pstep - psize; x += pstep, ncnt++)
+	for (int x = 0; nactive > 0 && x < orig_w + pstep - psize; x += pstep)
 	{
+		if (!region->active(x / pstep))
+		{
+			stats->next_patch();
+			refx += pstep;
+			continue;
+		}
+
 		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
 		grouping();
+		matched += g3d_basic->num;
+		nrefs++;
+		perf.end(PERF_STAGE_GROUPING);
 		gtime += clock() - t;
 
 		t = clock();
-		filtering();
+		perf.begin(PERF_STAGE_FILTERING);
+		double var = stats->variance();
+		if (var < flat_var)
+		{
+			// the DC coefficient of a flat group is kept (weight near one), and the weights of the AC ones are estimated 
+			// by the variance of the basic patch, as the transforms keep the energy
+			double ac = var / (var + noise_var);
+			g3d_noisy->mean_filtering();
+			g3d_noisy->wie_wgt_sum = (int)((1 + (g3d_noisy->num * psize * psize - 1) * ac) * (1 << WIENER_WEIGHT_BITS));
+		}
+		else
+			filtering();
+		perf.end(PERF_STAGE_FILTERING);
 		ftime += clock() - t;
 
 		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
 		aggregation();
+		perf.end(PERF_STAGE_AGGREGATION);
 		atime += clock() - t;
 
-		refer_noisy += pstep;
-		refer_basic += pstep;
-		numer += pstep;
-		denom += pstep;
+		stats->next_patch();
+		refx += pstep;
 	}
 
 	// output the completed rows
-	numer = numerator   + swinrh;
-	denom = denominator + swinrh;
-
+	int first_row = 0;
 	int output_rows;
+	int out_row = 0;	// image row of the first output row
 	if (row_cnt < swinrv) 
 	{
 		if (row_cnt + pstep <= swinrv) {
@@ -211,8 +289,7 @@ int BM3D_WIE::next_line(ImageType *clean)
 		}
 		else {
 			output_rows = row_cnt + pstep - swinrv;
-			numer += (pstep - output_rows) * w;
-			denom += (pstep - output_rows) * w;
+			first_row = pstep - output_rows;
 		}
 	} 
 	else 
@@ -221,136 +298,100 @@ int BM3D_WIE::next_line(ImageType *clean)
 			output_rows = orig_h - row_cnt + swinrv;	// the last line of reference patches
 		else
 			output_rows = pstep;
-		clean += orig_w * (row_cnt - swinrv);
+		out_row = row_cnt - swinrv;
 	}
 
-	for (int i = 0, r = 0; r < output_rows; r++)
+	for (int r = 0; r < output_rows; r++)
 	{
-		for (int c = 0; c < orig_w; c++, i++)
-		{
-			clean[i] = (ImageType)(numer[c] / denom[c]);
-		}
-		numer += w;
-		denom += w;
+		if (!region->writes(out_row + r)) continue;
+		ImageType *row = out->row(out_row + r);
+		const PatchType *numer = lbuf->numer_row(first_row + r) + swinrh;
+		const PatchType *denom = lbuf->denom_row(first_row + r) + swinrh;
+		const ImageType *in = noisy.row(out_row + r);
+		region->output_row(&row, &in, &numer, &denom, 1, out_row + r, (1 << bit_depth) - 1, shift);
 	}
 
-	// remove the fisrt (pstep) rows of the numerator and denominator buffers
-	// and insert (pstep) new rows to the end of the buffers
+	// discard the fisrt (pstep) rows of the numerator and denominator buffers
+	// and recycle them as (pstep) new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
 	shift_numer_denom();
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
 
 	row_cnt += pstep;
 	return output_rows;
 }
 
-void BM3D_WIE::grouping()
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::grouping()
 {
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
-	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++)
-			{
-				for (int x = psize - pstep; x < psize; x++)
-				{
-					dist_buf[nbuf * idx + (ncnt + x / pstep) % nbuf] += get_dist(refer_basic[y * w + x], refer_basic[(y + sy) * w + x + sx]);
-				}
-			}
-			dist_sum[idx] += dist_buf[nbuf * idx + (ncnt - 2) % nbuf];
-			dist_sum[idx] += dist_buf[nbuf * idx + (ncnt - 1) % nbuf];
-		}
-	}
-
-	g3d_noisy->set_reference();
-	g3d_basic->set_reference();
+	matcher->match(basic, refx - swinrh, row_cnt, g3d_basic);
+	g3d_noisy->copy_matches(g3d_basic);
 
-	for (int idx = 0, sy = -swinrv; sy <= swinrv; sy += sstepv)
-	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph, idx++)
-		{
-			g3d_basic->insert_patch(sx, sy, dist_sum[idx]);
-		}
-	}
-	g3d_noisy->num = g3d_basic->num;
-	for (int p = 0; p < g3d_basic->num; p++)
-	{
-		g3d_noisy->patch[p]->update(g3d_basic->patch[p]->x, g3d_basic->patch[p]->y, 0);
-	}
-
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int i = 0; i < nsv; i++)
-	{
-		for (int j = 0; j < nsh; j++)
-		{
-			int idx = i * nsh + j;
-			dist_sum[idx] -= dist_buf[nbuf * idx + (ncnt - 1) % nbuf];
-			dist_sum[idx] -= dist_buf[nbuf * idx + (ncnt - 0) % nbuf];
-			dist_buf[nbuf * idx + ncnt % nbuf] = 0;
-		}
-	}
+	g3d_noisy->fill_patches_values(noisy, refx - swinrh, row_cnt);
+	g3d_basic->fill_patches_values(basic, refx - swinrh, row_cnt);
+}
 
-	g3d_noisy->fill_patches_values(refer_noisy, w);
-	g3d_basic->fill_patches_values(refer_basic, w);
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::filtering()
+{
+	filtering(g3d_noisy, g3d_basic);
 }
 
-void BM3D_WIE::filtering()
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::filtering(Group3D *noisy_g3d, Group3D *basic_g3d)
 {
-	g3d_noisy->transform_3d();
-	g3d_basic->transform_3d();
+	noisy_g3d->transform_3d();
+	basic_g3d->transform_3d();
 
 	// the Hadamard transform in g3d has not been normalized
-	double noisy_variance = g3d_basic->thres * g3d_basic->num;
-	// wiener filtering
-	double wie_wgt = 0.;
-	for (int p = 0; p < g3d_basic->num; p++)
+	float noisy_variance = (float)basic_g3d->thres * basic_g3d->num;
+	// wiener filtering, and the weights are summed up for the weight of the group
+	noisy_g3d->wie_wgt_sum = 0;
+	for (int p = 0; p < basic_g3d->num; p++)
 	{
-		for (int i = 0; i < psize * psize; i++)
-		{
-			wie_wgt = (double)g3d_basic->patch[p]->values[i] * g3d_basic->patch[p]->values[i];
-			wie_wgt = wie_wgt / (wie_wgt + noisy_variance);
-			wie_wgt_sum += wie_wgt;
-			g3d_noisy->patch[p]->values[i] = (PatchType)((double)g3d_noisy->patch[p]->values[i] * wie_wgt);
-		}
+		noisy_g3d->wie_wgt_sum += wiener_row(noisy_g3d->patch[p]->values, basic_g3d->patch[p]->values, 
+								  basic_g3d->w * basic_g3d->h, noisy_variance);
 	}
 
-	g3d_noisy->inv_transform_3d();
+	noisy_g3d->inv_transform_3d();
 }
 
-void BM3D_WIE::aggregation()
+template <typename ImageType>
+PatchType BM3D_WIE_T<ImageType>::get_weight(const Group3D *noisy_g3d)
 {
 #if USE_INTEGER
-	PatchType weight = 1;
+	return 1;
 #else
-	PatchType weight = 64. / wie_wgt_sum;
+	if (noisy_g3d->wie_wgt_sum == 0) return 64;
+	return (PatchType)(64. * (1 << WIENER_WEIGHT_BITS) / noisy_g3d->wie_wgt_sum);
 #endif
+}
 
-	for (int p = 0; p < g3d_noisy->num; p++)
-	{
-		int x = g3d_noisy->patch[p]->x;
-		int y = g3d_noisy->patch[p]->y;
-		for (int i = 0, r = 0; r < psize; r++)
-		{
-			for (int c = 0; c < psize; c++, i++)
-			{
-				numer[(r + y) * w + c + x] += Kaiser[i] * weight * g3d_noisy->patch[p]->values[i];
-				denom[(r + y) * w + c + x] += Kaiser[i] * weight;
-			}
-		}
-	}
+/* The Kaiser window is weighted once per group, and then each patch is accumulated row by row.
+ */
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::aggregation()
+{
+	aggregation(g3d_noisy, lbuf);
 }
 
-void BM3D_WIE::shift_numer_denom()
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::aggregation(Group3D *noisy_g3d, LineBuffer *buf)
 {
-	numer = numerator;
-	denom = denominator;
-	for (int i = 0; i < 2 * swinrv + psize - pstep; i++)
-	{
-		memcpy(numer, numer + w * pstep, w * sizeof(PatchType));
-		memcpy(denom, denom + w * pstep, w * sizeof(PatchType));
-		numer += w;
-		denom += w;
-	}
-	memset(numer, 0, w * pstep * sizeof(PatchType));
-	memset(denom, 0, w * pstep * sizeof(PatchType));
-}
\ No newline at end of file
+	noisy_g3d->set_aggregation_weight(Kaiser, get_weight(noisy_g3d));
+
+	noisy_g3d->aggregate(buf, refx, swinrv);
+}
+
+template <typename ImageType>
+void BM3D_WIE_T<ImageType>::shift_numer_denom()
+{
+	lbuf->shift(pstep);
+}
+
+template class BM3D_WIE_T<uint8_t>;
+template class BM3D_WIE_T<uint16_t>;
@@ -1,17 +1,10 @@
 #include <iostream>
 #include "cbm3d.h"
+#include "kernels.h"
+#include "trace.h"
 
-static inline DistType get_dist(ImageType a, ImageType b)
-{
-	int diff = (int)a - b;
-#if USE_L2_DIST
-	return diff * diff;
-#else
-	return diff >= 0 ? diff : -diff;
-#endif
-}
-
-CBM3D::CBM3D(
+template <typename ImageType>
+CBM3D_T<ImageType>::CBM3D_T(
 	int w_,					// width
 	int h_,					// height
 	int max_sim,			// maximum similar patches
@@ -20,155 +13,381 @@ CBM3D::CBM3D(
 	int swinrh_,			// horizontal search window radius
 	int ssteph_,			// horizontal search step
 	int swinrv_,			// vertical search window radius
-	int sstepv_				// vertical search step
-) : BM3D(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_)
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
+) : Base(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_, bit_depth_)
 {
-	noisy_yuv[0]       = noisy;
-	numerator_yuv[0]   = numerator;
-	denominator_yuv[0] = denominator;
-
+	// the U/V share the denominator of Y, as they are aggregated at the same patches with the same weights
+	lbuf_yuv[0] = lbuf;
+	g3d_yuv[0] = g3d;
 	for (int i = 1; i < 3; i++)
 	{
-		noisy_yuv[i]       = new ImageType[w * h]();
-		numerator_yuv[i]   = new PatchType[w * (psize + swinrv * 2)];
-		denominator_yuv[i] = new PatchType[w * (psize + swinrv * 2)];
+		lbuf_yuv[i] = new LineBuffer(w, psize + swinrv * 2, false);
+		g3d_yuv[i] = new Group3D(psize, psize, max_sim);
+		g3d_yuv[i]->shift = shift;
+		row_sums[i] = new int64_t[3 * (psize + swinrv * 2)];
 	}
+	row_sums[0] = NULL;	// the Y bands are never tested
+	for (int i = 0; i < 3; i++)
+	{
+		band_y0[i] = band_y1[i] = 0;
+	}
+
+	packed_in  = NULL;
+	packed_out = NULL;
+
+	// the threads only pay off with more than one core
+	chan_threads = (CHANNEL_PARALLEL && omp_get_num_procs() > 1) ? 3 : 1;
+	chroma_mode = CHROMA_MODE_FULL;
 }
 
-CBM3D::~CBM3D()
+template <typename ImageType>
+CBM3D_T<ImageType>::~CBM3D_T()
 {
 	for (int i = 1; i < 3; i++)
 	{
-		delete[] noisy_yuv[i];
-		delete[] numerator_yuv[i];
-		delete[] denominator_yuv[i];
+		delete lbuf_yuv[i];
+		delete g3d_yuv[i];
+		delete[] row_sums[i];
 	}
+	delete packed_in;
+	delete packed_out;
 
 	// the ~BM3D is called after the ~CBM3D
-	noisy       = noisy_yuv[0];
-	numerator   = numerator_yuv[0];
-	denominator = denominator_yuv[0];
+	lbuf = lbuf_yuv[0];
+}
+
+template <typename ImageType>
+int CBM3D_T<ImageType>::run_tile(int x, int y, int tw, int th, ImageType *const *planes, const int *strides)
+{
+	if (x < 0 || y < 0 || tw <= 0 || th <= 0 || x + tw > orig_w || y + th > orig_h) return -1;	// the tile must be within the image
+
+	region->set_tile(x, y, tw, th, swinrh > swinrv ? swinrh : swinrv);
+	reset();
+	row_cnt = region->first_line();
+
+	PlaneOut<ImageType> out[3];	// the first rows of the tile are the row (y)
+	for (int i = 0; i < 3; i++)
+	{
+		out[i] = PlaneOut<ImageType>(planes[i], strides[i], 0, y);
+	}
+	while (row_cnt - swinrv < y + th && next_line_planes(out) >= 0);
+	region->set_mask(NULL, 0, 0);
+	return th;
 }
 
-void CBM3D::reset()
+template <typename ImageType>
+void CBM3D_T<ImageType>::reset()
 {
 	row_cnt = 0;
 	for (int i = 0; i < 3; i++)
 	{
-		memset(numerator_yuv[i],   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-		memset(denominator_yuv[i], 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+		lbuf_yuv[i]->reset();
+		band_y1[i] = band_y0[i];
 	}
+	if (stream_in) stream_in->restart();
 }
 
-void CBM3D::load(ImageType *org_noisy_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+template <typename ImageType>
+void CBM3D_T<ImageType>::set_chroma_mode(int mode)
+{
+	chroma_mode = mode;
+
+	// the U/V are aggregated at fewer patches than the Y in the reduced mode, so they need their own denominators
+	bool has_denom = mode != CHROMA_MODE_FULL;
+	if (has_denom != (lbuf_yuv[1]->denominator != NULL))
+	{
+		for (int i = 1; i < 3; i++)
+		{
+			delete lbuf_yuv[i];
+			lbuf_yuv[i] = new LineBuffer(w, psize + swinrv * 2, has_denom);
+		}
+	}
+}
+
+/* The variance of the noise is estimated by the squared differences of the horizontal neighbours, i.e. 2 * sigma^2,
+ * as the given sigma is often overestimated for smoother results, and it's bounded by the sigma^2,
+ * so that a fine texture isn't taken as the noise.
+ */
+template <typename ImageType>
+bool CBM3D_T<ImageType>::flat_band(int i)
+{
+	// the rows out of the plane are either replicated or never aggregated for a flat band
+	const PlaneView<ImageType> &plane = noisy_yuv[i];
+	int y0 = row_cnt - swinrv > 0 ? row_cnt - swinrv : 0;
+	int y1 = row_cnt + psize + swinrv < plane.h ? row_cnt + psize + swinrv : plane.h;
+	int nrows = psize + swinrv * 2;
+
+	// the band slides down line by line, otherwise it's summed again, e.g. for a new frame or a tile
+	if (y0 < band_y0[i] || y0 >= band_y1[i] || y1 < band_y1[i])
+	{
+		band_y0[i] = band_y1[i] = y0;
+		band_sum[i] = band_sqr[i] = band_dif[i] = 0;
+	}
+	for (; band_y0[i] < y0; band_y0[i]++)
+	{
+		const int64_t *sums = row_sums[i] + band_y0[i] % nrows * 3;
+		band_sum[i] -= sums[0];
+		band_sqr[i] -= sums[1];
+		band_dif[i] -= sums[2];
+	}
+	for (; band_y1[i] < y1; band_y1[i]++)
+	{
+		const ImageType *row = plane.row(band_y1[i]);
+		int64_t sum = row[0], sqr = (int64_t)row[0] * row[0], dif = 0;
+		for (int x = 1; x < plane.w; x++)
+		{
+			int64_t d = (int64_t)row[x] - row[x - 1];
+			sum += row[x];
+			sqr += (int64_t)row[x] * row[x];
+			dif += d * d;
+		}
+		int64_t *sums = row_sums[i] + band_y1[i] % nrows * 3;
+		sums[0] = sum;
+		sums[1] = sqr;
+		sums[2] = dif;
+		band_sum[i] += sum;
+		band_sqr[i] += sqr;
+		band_dif[i] += dif;
+	}
+
+	double n = (double)(y1 - y0) * plane.w;
+	double mean = band_sum[i] / n;
+	double noise = plane.w > 1 ? band_dif[i] / ((y1 - y0) * (plane.w - 1) * 2.0) : 0;
+	noise = noise < sigma2_yuv[i] ? noise : sigma2_yuv[i];
+	return band_sqr[i] / n - mean * mean <= (1 + FLAT_BAND_RATIO) * noise;
+}
+
+template <typename ImageType>
+void CBM3D_T<ImageType>::load(ImageType *org_noisy_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	const ImageType *planes[3];
+	const int strides[3] = {orig_w, orig_w, orig_w};
+	for (int i = 0; i < 3; i++)
+	{
+		planes[i] = org_noisy_yuv + i * (orig_w * orig_h);
+	}
+	load_planes(planes, strides, sigmay, max_mdist, sigmau, sigmav);
+}
+
+template <typename ImageType>
+void CBM3D_T<ImageType>::load_planes(const ImageType *const *planes, const int *strides, int sigmay, DistType max_mdist, int sigmau, int sigmav)
 {
 	for (int i = 0; i < 3; i++)
 	{
-		noisy       = noisy_yuv[i];
-		numerator   = numerator_yuv[i];
-		denominator = denominator_yuv[i];
+		lbuf = lbuf_yuv[i];
+		Base::load_planes(planes + i, strides + i, sigmay, max_mdist);
+		noisy_yuv[i] = noisy;
+	}
 
-		BM3D::load(org_noisy_yuv, sigmay, max_mdist);
-		org_noisy_yuv += (orig_w * orig_h);
+	thres_yuv[0] = hard_thres(sigmay, shift);
+	thres_yuv[1] = sigmau < 0 ? thres_yuv[0] : hard_thres(sigmau, shift);
+	thres_yuv[2] = sigmav < 0 ? thres_yuv[0] : hard_thres(sigmav, shift);
+	for (int i = 0; i < 3; i++)
+	{
+		g3d_yuv[i]->thres = thres_yuv[i];
 	}
 
-	hard_thres[0] = (PatchType)(HARD_THRES_MULTIPLIER * sigmay) * (1 << COEFF_DICI_BITS);
-	hard_thres[1] = sigmau < 0 ? hard_thres[0] : (PatchType)(HARD_THRES_MULTIPLIER * sigmau) * (1 << COEFF_DICI_BITS);
-	hard_thres[2] = sigmav < 0 ? hard_thres[0] : (PatchType)(HARD_THRES_MULTIPLIER * sigmav) * (1 << COEFF_DICI_BITS);
+	int sigma_yuv[3] = {sigmay, sigmau < 0 ? sigmay : sigmau, sigmav < 0 ? sigmay : sigmav};
+	for (int i = 0; i < 3; i++)
+	{
+		sigma2_yuv[i] = (double)sigma_yuv[i] * sigma_yuv[i];
+		band_y1[i] = band_y0[i];	// a new frame
+	}
 }
 
-int CBM3D::next_line(ImageType *clean)
+template <typename ImageType>
+void CBM3D_T<ImageType>::load_source(RowSource<ImageType> *source, int sigmay, DistType max_mdist, int sigmau, int sigmav)
 {
-	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	if (stream_in == NULL || stream_in->nplanes != 3)
+	{
+		delete stream_in;
+		stream_in = new RowRing<ImageType>(3, orig_w, orig_h, psize + swinrv * 2);
+	}
 
+	const ImageType *planes[3];
+	const int strides[3] = {orig_w, orig_w, orig_w};
+	for (int i = 0; i < 3; i++)
+	{
+		planes[i] = stream_in->ring(i);
+	}
+	load_planes(planes, strides, sigmay, max_mdist, sigmau, sigmav);
 	for (int i = 0; i < 3; i++)
 	{
-		refer_yuv[i] = noisy_yuv[i]       + swinrh + (row_cnt + swinrv) * w;
-		numer_yuv[i] = numerator_yuv[i]   + swinrh + swinrv * w;
-		denom_yuv[i] = denominator_yuv[i] + swinrh + swinrv * w;
+		noisy_yuv[i].ring = stream_in->rows;
 	}
+	stream_in->set_source(source);
+}
 
-	memset(dist_buf, 0, nsh * nsv * nbuf * sizeof(DistType));
-	memset(dist_sum, 0, nsh * nsv * sizeof(DistType));
+/* The rings hold the rows of the search window of a line of reference patches, 
+ * which are converted from the packed frame line by line.
+ */
+template <typename ImageType>
+void CBM3D_T<ImageType>::load_packed(const ImageType *const *planes, const int *strides, int format, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (packed_in == NULL || packed_in->format != format)
+	{
+		delete packed_in;
+		delete packed_out;
+		packed_in  = new PackedFrame<ImageType>(format, orig_w, orig_h, psize + swinrv * 2, psize + swinrv * 2, bit_depth);
+		packed_out = new PackedFrame<ImageType>(format, orig_w, orig_h, psize + swinrv * 2, psize + swinrv * 2, bit_depth);
+	}
+	packed_in->set_input(planes, strides);
+	packed_in->reset();
+	packed_out->reset();
 
-	// initialize the distance buffer
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
+	const ImageType *yuv[3];
+	int yuv_strides[3];
+	int rings[3];
+	packed_in->in_planes(yuv, yuv_strides, rings);
+	load_planes(yuv, yuv_strides, sigmay, max_mdist, sigmau, sigmav);
+	for (int i = 0; i < 3; i++)
 	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++) {
-				for (int x = 0; x < psize - pstep; x++) {
-					dist_buf[nbuf * idx + x / pstep] += get_dist(refer_yuv[0][y * w + x], refer_yuv[0][(y + sy) * w + x + sx]);
-				}
-			}
-			for (int i = 0; i < nbuf - 2; i++) {
-				dist_sum[idx] += dist_buf[nbuf * idx + i];
-			}
-		}
+		noisy_yuv[i].ring = rings[i];
 	}
-	ncnt = nbuf;
+}
 
-	clock_t t;
-	// proceesing the line
-	for (int x = 0; x < orig_w + pstep - psize; x += pstep, ncnt++)
+template <typename ImageType>
+int CBM3D_T<ImageType>::next_line_packed(ImageType *const *planes, const int *strides)
+{
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+
+	// convert the rows needed by the search windows of the line
+	packed_in->fill(row_cnt + psize + swinrv, row_cnt + psize + swinrv);
+
+	PlaneOut<ImageType> out[3];
+	packed_out->set_output(planes, strides);
+	packed_out->out_planes(out);
+
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	int output_rows = next_line_planes(out);
+	packed_out->store(out_row + output_rows, out_row + output_rows);
+	return output_rows;
+}
+
+template <typename ImageType>
+int CBM3D_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out[3];
+	for (int i = 0; i < 3; i++)
 	{
-		refer = refer_yuv[0];
-		numer = numer_yuv[0];
-		denom = denom_yuv[0];
+		out[i] = PlaneOut<ImageType>(clean + i * (orig_w * orig_h), orig_w);
+	}
+	return next_line_planes(out);
+}
 
-		g3d->thres = hard_thres[0];
+template <typename ImageType>
+int CBM3D_T<ImageType>::next_line_sink(RowSink<ImageType> *sink)
+{
+	if (sink_out == NULL || sink_out->nplanes != 3)
+	{
+		delete sink_out;
+		sink_out = new SinkRows<ImageType>(3, orig_w, psize + swinrv * 2);
+	}
 
-		t = clock();
-		grouping();
-		gtime += clock() - t;
+	PlaneOut<ImageType> out[3];
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	sink_out->out_planes(out, out_row);
 
-		t = clock();
-		filtering();
-		ftime += clock() - t;
+	int output_rows = next_line_planes(out);
+	sink_out->flush(sink, out_row, output_rows);
+	return output_rows;
+}
 
-		t = clock();
-		aggregation();
-		atime += clock() - t;
+template <typename ImageType>
+int CBM3D_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
+{
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
 
-		for (int i = 1; i < 3; i++)
-		{
-			refer = refer_yuv[i];
-			numer = numer_yuv[i];
-			denom = denom_yuv[i];
+	// pull the rows needed by the search windows of the line
+	if (stream_in) stream_in->fill(row_cnt + psize + swinrv);
 
-			g3d->thres = hard_thres[i];
+	refx = swinrh;
+	noisy = noisy_yuv[0];
+	int nactive = region->start_line(row_cnt);	// reference patches of the line touching the region
+	if (nactive > 0) matcher->start_line(noisy_yuv[0], 0, row_cnt);
 
-			t = clock();
-			g3d->fill_patches_values(refer, w);
-			gtime += clock() - t;
+	// the groups of the flat U/V bands are replaced by their means, as they hold the noise only,
+	// which keeps the reference patches of a constant band, e.g. the neutral chroma of grayscale content,
+	// and the detailed ones are filtered at every other reference patch in the reduced mode
+	bool reduced = chroma_mode == CHROMA_MODE_REDUCED;
+	bool flat[3] = {false, reduced && flat_band(1), reduced && flat_band(2)};
+	int chroma_step = (reduced && 2 * pstep <= psize) ? 2 : 1;	// the skipped patches must be covered by the neighbours
 
-			t = clock();
-			filtering();
-			ftime += clock() - t;
+	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
+	// proceesing the line
+	int xend = orig_w + pstep - psize;
+	for (int x = 0, k = 0; nactive > 0 && x < xend; x += pstep, k++)
+	{
+		if (!region->active(k))
+		{
+			refx += pstep;
+			continue;
+		}
+		// the pixels of the region in a skipped chroma patch are covered by the neighbours in the region,
+		// as a neighbour touching the region is never skipped by it
+		bool chroma = k % chroma_step == 0 || x + pstep >= xend;
 
-			t = clock();
-			aggregation();
-			atime += clock() - t;
+		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
+		grouping();
+		matched += g3d->num;
+		nrefs++;
+		for (int i = 1; i < 3; i++)
+		{
+			if (flat[i] && band_dif[i] == 0)
+				g3d_yuv[i]->set_reference();	// a constant band, whose reference patches are passed through
+			else if (flat[i] || chroma)
+				g3d_yuv[i]->copy_matches(g3d);
 		}
+		perf.end(PERF_STAGE_GROUPING);
+		gtime += clock() - t;
 
+		// each channel has its own group and line buffers, so the channels are filtered concurrently,
+		// and then aggregated concurrently, so that each stage is timed on its own
+		t = clock();
+		perf.begin(PERF_STAGE_FILTERING);
+#pragma omp parallel for num_threads(chan_threads) if (chan_threads > 1)
 		for (int i = 0; i < 3; i++)
 		{
-			refer_yuv[i] += pstep;
-			numer_yuv[i] += pstep;
-			denom_yuv[i] += pstep;
+			double t0 = trace_begin();
+			if (i > 0)
+			{
+				if (!flat[i] && !chroma) continue;
+				g3d_yuv[i]->fill_patches_values(noisy_yuv[i], refx - swinrh, row_cnt);
+			}
+			if (flat[i])
+				g3d_yuv[i]->mean_filtering();
+			else
+				filtering(g3d_yuv[i]);
+			trace_span("filter channel", t0, i);
 		}
-	}
+		perf.end(PERF_STAGE_FILTERING);
+		ftime += clock() - t;
 
-	// output the completed rows
-	for (int i = 0; i < 3; i++)
-	{
-		numer_yuv[i] = numerator_yuv[i] + swinrh;
-		denom_yuv[i] = denominator_yuv[i] + swinrh;
+		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
+#pragma omp parallel for num_threads(chan_threads) if (chan_threads > 1)
+		for (int i = 0; i < 3; i++)
+		{
+			double t0 = trace_begin();
+			if (i > 0 && !flat[i] && !chroma) continue;
+			aggregation(g3d_yuv[i], lbuf_yuv[i]);
+			trace_span("aggregate channel", t0, i);
+		}
+		perf.end(PERF_STAGE_AGGREGATION);
+		atime += clock() - t;
+
+		refx += pstep;
 	}
 
+	// output the completed rows
+	int first_row = 0;
 	int output_rows;
+	int out_row = 0;	// image row of the first output row
 	if (row_cnt < swinrv)
 	{
 		if (row_cnt + pstep <= swinrv) {
@@ -177,10 +396,7 @@ int CBM3D::next_line(ImageType *clean)
 		}
 		else {
 			output_rows = row_cnt + pstep - swinrv;
-			for (int i = 0; i < 3; i++) {
-				numer_yuv[i] += (pstep - output_rows) * w;
-				denom_yuv[i] += (pstep - output_rows) * w;
-			}
+			first_row = pstep - output_rows;
 		}
 	}
 	else
@@ -189,34 +405,44 @@ int CBM3D::next_line(ImageType *clean)
 			output_rows = orig_h - row_cnt + swinrv;
 		else
 			output_rows = pstep;
-		clean += orig_w * (row_cnt - swinrv);
+		out_row = row_cnt - swinrv;
 	}
 
-	for (int i = 0; i < 3; i++)
+	// all the Y/U/V rows are written out at once
+	for (int r = 0; r < output_rows; r++)
 	{
-		numer = numer_yuv[i];
-		denom = denom_yuv[i];
-		for (int idx = 0, r = 0; r < output_rows; r++)
+		if (!region->writes(out_row + r)) continue;
+		ImageType *rows[3];
+		const ImageType *in[3];
+		const PatchType *numer[3];
+		const PatchType *denom[3];
+		for (int i = 0; i < 3; i++)
 		{
-			for (int c = 0; c < orig_w; c++, idx++)
-			{
-				clean[idx] = (ImageType)(numer[c] / denom[c]);
-			}
-			numer += w;
-			denom += w;
+			rows[i]  = out[i].row(out_row + r);
+			in[i]    = noisy_yuv[i].row(out_row + r);
+			numer[i] = lbuf_yuv[i]->numer_row(first_row + r) + swinrh;
+			denom[i] = lbuf_yuv[lbuf_yuv[i]->denominator ? i : 0]->denom_row(first_row + r) + swinrh;
 		}
-		clean += (orig_w * orig_h);
+		region->output_row(rows, in, numer, denom, 3, out_row + r, (1 << bit_depth) - 1, shift);
 	}
 
-	// remove the fisrt pstep rows of the numerator and denominator buffers
-	// and insert pstep new rows to the end of the buffers
+	// discard the fisrt pstep rows of the numerator and denominator buffers
+	// and recycle them as pstep new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
 	for (int i = 0; i < 3; i++)
 	{
-		numerator = numerator_yuv[i];
-		denominator = denominator_yuv[i];
+		lbuf = lbuf_yuv[i];
 		shift_numer_denom();
 	}
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
 
 	row_cnt += pstep;
 	return output_rows;
-}
\ No newline at end of file
+}
+
+template class CBM3D_T<uint8_t>;
+template class CBM3D_T<uint16_t>;
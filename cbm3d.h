@@ -2,6 +2,7 @@
 #define __CBM3D_H__
 
 #include "bm3d.h"
+#include "packed_frame.h"
 
 /* Implementation of the first step, i.e. Hard-thresholding, of the BM3D denoising method for YUV 4:4:4 images.
  * Note that the implementation only supports YUV 4:4:4 format, that the U/V component has the same size as Y.
@@ -13,10 +14,13 @@
  * However, it's not a big difference between sigmaY and sigmaU or sigmaV for the BT.601 or BT.709,
  * and we can approximately compute sigmaY/U/V = 0.6 * sigmaR/G/B. 
  */
-class CBM3D : public BM3D
+template <typename ImageType>
+class CBM3D_T : public BM3D_T<ImageType>
 {
+	typedef BM3D_T<ImageType> Base;
+
 public:
-	CBM3D(
+	CBM3D_T(
 		int w_,						// width
 		int h_,						// height
 		int max_sim = 16,			// maximum similar patches
@@ -25,9 +29,15 @@ public:
 		int swinrh_ = 16,			// horizontal search window radius
 		int ssteph_ = 1,			// horizontal search step
 		int swinrv_ = 16,			// vertical search window radius
-		int sstepv_ = 1				// vertical search step
+		int sstepv_ = 1,			// vertical search step
+		int bit_depth_ = SampleTraits<ImageType>::max_depth	// bit depth of the samples
 	);
-	~CBM3D();
+	~CBM3D_T();
+
+	using Base::grouping;
+	using Base::filtering;
+	using Base::aggregation;
+	using Base::shift_numer_denom;
 
 	/* Load a new noisy yuv444 frame and reset the buffers. */
 	void load(
@@ -38,25 +48,139 @@ public:
 		int sigmav = -1				// sigma of the V component, same as Y if <0
 	);
 
+	/* Load the Y/U/V planes of a new noisy yuv444 frame in place and reset the buffers. */
+	void load_planes(
+		const ImageType *const *planes,	// pointers of the input noisy Y/U/V planes
+		const int *strides,			// strides of the planes
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load a new noisy yuv444 frame from a row source and reset the buffers.
+	 * Only the (psize + 2 * swinrv) rows needed by the current line of reference patches are kept in rings, 
+	 * and the following rows are pulled from the source as the lines advance, i.e. rows[0/1/2] are the Y/U/V rows.
+	 */
+	void load_source(
+		RowSource<ImageType> *source,	// source of the input noisy rows, kept valid until the whole frame is processed
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load a new noisy packed RGB/BGR frame in place and reset the buffers.
+	 * The rows are converted to YCbCr just before they are needed, so the sigmas are those of the Y/Cb/Cr components.
+	 * The frame must be denoised by next_line_packed() then.
+	 */
+	void load_packed(
+		const ImageType *const *planes,	// pointer of the input noisy packed frame, i.e. planes[0]
+		const int *strides,			// stride (in samples) of the packed frame
+		int format,					// FRAME_FORMAT_RGB or FRAME_FORMAT_BGR
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the Cb component, same as Y if <0
+		int sigmav = -1				// sigma of the Cr component, same as Y if <0
+	);
+
 	/* reset the buffers and redirect the processing reference patch to the first one of the noisy image */
 	void reset();
 
+	/* Select the cost of the U/V processing, i.e. CHROMA_MODE_FULL (default) or CHROMA_MODE_REDUCED.
+	 * In the reduced mode, the U/V bands of a line of reference patches which vary as the noise only, e.g. the neutral chroma 
+	 * of grayscale content, are replaced by the means of the groups rather than filtered, and the detailed ones 
+	 * are filtered only at every other reference patch, which still covers all the pixels as the patches overlap by half at least.
+	 * The U/V channels keep their own denominators in the reduced mode, so the mode should be selected before the load.
+	 */
+	void set_chroma_mode(int mode);
+
 	/* Denoise just a line of reference patches and write out the completed rows. */
 	int next_line(
 		ImageType *clean_yuv		// pointer of output denoised yuv444 (planar) frame
 	);
 
+	/* Denoise just a line of reference patches and write out the completed rows to the Y/U/V planes. */
+	int next_line_planes(
+		const PlaneOut<ImageType> *out	// output denoised Y/U/V planes
+	);
+
+	/* Denoise just a line of reference patches and pass the completed rows to the sink, i.e. rows[0/1/2] are the Y/U/V rows. */
+	int next_line_sink(
+		RowSink<ImageType> *sink	// sink of the output denoised rows
+	);
+
+	/* Denoise just a line of reference patches and write out the completed rows to the packed frame in the loaded format. */
+	int next_line_packed(
+		ImageType *const *planes,	// pointer of the output denoised packed frame, i.e. planes[0]
+		const int *strides			// stride (in samples) of the packed frame
+	);
+
+	/* Denoise only the tile [x, x + tw) x [y, y + th) of the frame loaded by load() or load_planes(), and write it to the Y/U/V planes of the tile,
+	 * exactly the same as denoising the whole frame, see BM3D_T::run_tile().
+	 */
+	int run_tile(
+		int x, int y,				// top-left pixel of the tile
+		int tw, int th,				// width and height of the tile
+		ImageType *const *planes,	// pointers of the output Y/U/V planes, beginning at the top-left pixel of the tile
+		const int *strides			// strides of the output planes
+	);
+
 protected:
+	using Base::noisy;
+	using Base::g3d;
+	using Base::orig_w;
+	using Base::orig_h;
+	using Base::w;
+	using Base::h;
+	using Base::zeros;
+	using Base::stream_in;
+	using Base::sink_out;
+	using Base::psize;
+	using Base::pstep;
+	using Base::swinrh;
+	using Base::ssteph;
+	using Base::swinrv;
+	using Base::sstepv;
+	using Base::matcher;
+	using Base::bit_depth;
+	using Base::shift;
+	using Base::row_cnt;
+	using Base::lbuf;
+	using Base::refx;
+	using Base::gtime;
+	using Base::ftime;
+	using Base::atime;
+	using Base::perf;
+	using Base::region;
+
+	PlaneView<ImageType> noisy_yuv[3];
+	LineBuffer *lbuf_yuv[3];
+	Group3D *g3d_yuv[3];		// groups of each channel, which share the matches of the Y group, i.e. g3d_yuv[0]
+	int chan_threads;			// threads to filter the Y/U/V groups concurrently, 1 for the serial processing
+	int chroma_mode;			// CHROMA_MODE_FULL or CHROMA_MODE_REDUCED
 
-	ImageType *noisy_yuv[3];
-	PatchType *numerator_yuv[3];
-	PatchType *denominator_yuv[3];
+	/* whether the in-plane samples of the search windows of the current line of the channel (i) vary as the noise only,
+	 * i.e. the variance of the band exceeds that of the noise by (FLAT_BAND_RATIO) of it at most,
+	 * where the sums of the band are slid down with the line rather than rescanned
+	 */
+	bool flat_band(int i);
 
-	ImageType *refer_yuv[3];
-	PatchType *numer_yuv[3];
-	PatchType *denom_yuv[3];
+	PatchType thres_yuv[3];
+	double sigma2_yuv[3];		// squared sigma of each channel
+	int band_y0[3];				// rows [band_y0, band_y1) of the U/V planes summed in the band sums
+	int band_y1[3];
+	int64_t band_sum[3];		// sum of the samples of the U/V bands
+	int64_t band_sqr[3];		// sum of the squared samples of the U/V bands
+	int64_t band_dif[3];		// sum of the squared differences of the horizontal neighbours of the U/V bands
+	int64_t *row_sums[3];		// sums of each row of the U/V bands by the row modulo (psize + 2 * swinrv), 
+								// i.e. the samples, the squared samples and the squared differences, size: 3 * (psize + 2 * swinrv)
 
-	PatchType hard_thres[3];
+	PackedFrame<ImageType> *packed_in;	// rows of the input packed frame, NULL for the planar input
+	PackedFrame<ImageType> *packed_out;	// rows of the output packed frame
 };
 
+typedef CBM3D_T<uint8_t>  CBM3D;		// 8-bit samples
+typedef CBM3D_T<uint16_t> CBM3D16;	// 9 to 16-bit samples
+
 #endif
@@ -0,0 +1,280 @@
+#include <iostream>
+#include "cbm3d_sub.h"
+#include "kernels.h"
+#include "trace.h"
+
+template <typename ImageType>
+CBM3D_SUB_T<ImageType>::CBM3D_SUB_T(
+	int w_,					// width
+	int h_,					// height
+	int format,				// CHROMA_FORMAT_420 or CHROMA_FORMAT_422
+	int max_sim,			// maximum similar patches
+	int psize_,				// reference patch size
+	int pstep_,				// reference patch step
+	int swinrh_,			// horizontal search window radius
+	int ssteph_,			// horizontal search step
+	int swinrv_,			// vertical search window radius
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
+) : Base(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_, bit_depth_)
+{
+	chroma = new ChromaLines(format, orig_w, orig_h, psize, w, swinrh, swinrv);
+	g3d_uv = new Group3D(chroma->psize, chroma->psize, max_sim);
+	g3d_uv->shift = shift;
+
+	packed_in  = NULL;
+	packed_out = NULL;
+}
+
+template <typename ImageType>
+CBM3D_SUB_T<ImageType>::~CBM3D_SUB_T()
+{
+	delete chroma;
+	delete g3d_uv;
+	delete packed_in;
+	delete packed_out;
+}
+
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::reset()
+{
+	Base::reset();
+	chroma->reset();
+}
+
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::load(ImageType *org_noisy_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	const ImageType *planes[3];
+	const int strides[3] = {orig_w, chroma->w, chroma->w};
+	planes[0] = org_noisy_yuv;
+	planes[1] = planes[0] + orig_w * orig_h;
+	planes[2] = planes[1] + chroma->w * chroma->h;
+	load_planes(planes, strides, sigmay, max_mdist, sigmau, sigmav);
+}
+
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::load_planes(const ImageType *const *planes, const int *strides, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	// the U/V planes of an odd width (height for 4:2:0) have a column (row) of no luma patch, so the frame isn't loaded
+	if ((orig_w & 1) || (orig_h & chroma->sub_y))
+	{
+		noisy = PlaneView<ImageType>();
+		return;
+	}
+	Base::load_planes(planes, strides, sigmay, max_mdist);
+
+	// the replicated columns/rows of the U/V planes are the subsampled ones of the Y plane
+	int w_ext = (noisy.w_ext + 1) >> 1;
+	int h_ext = (noisy.h_ext + chroma->sub_y) >> chroma->sub_y;
+	for (int i = 0; i < 2; i++)
+	{
+		noisy_uv[i] = PlaneView<ImageType>(planes[i + 1], strides[i + 1], chroma->w, chroma->h, w_ext, h_ext, zeros);
+	}
+	chroma->reset();
+
+	thres_yuv[0] = hard_thres(sigmay, shift);
+	thres_yuv[1] = sigmau < 0 ? thres_yuv[0] : hard_thres(sigmau, shift);
+	thres_yuv[2] = sigmav < 0 ? thres_yuv[0] : hard_thres(sigmav, shift);
+}
+
+/* The rings of the U/V rows are as high as the chroma line buffers, which cover the search windows of a line of reference patches. */
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::load_packed(const ImageType *const *planes, const int *strides, int format, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (packed_in == NULL || packed_in->format != format)
+	{
+		delete packed_in;
+		delete packed_out;
+		packed_in  = NULL;
+		packed_out = NULL;
+
+		// the NV12/NV21 frames are always YUV 4:2:0
+		if (!chroma->sub_y) return;
+		packed_in  = new PackedFrame<ImageType>(format, orig_w, orig_h, 0, chroma->lbuf[0]->rows, bit_depth);
+		packed_out = new PackedFrame<ImageType>(format, orig_w, orig_h, 0, chroma->lbuf[0]->rows, bit_depth);
+	}
+	packed_in->set_input(planes, strides);
+	packed_in->reset();
+	packed_out->reset();
+
+	const ImageType *yuv[3];
+	int yuv_strides[3];
+	int rings[3];
+	packed_in->in_planes(yuv, yuv_strides, rings);
+	load_planes(yuv, yuv_strides, sigmay, max_mdist, sigmau, sigmav);
+	for (int i = 0; i < 2; i++)
+	{
+		noisy_uv[i].ring = rings[i + 1];
+	}
+}
+
+template <typename ImageType>
+int CBM3D_SUB_T<ImageType>::next_line_packed(ImageType *const *planes, const int *strides)
+{
+	if (packed_in == NULL || noisy.data == NULL) return -1;
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+
+	// deinterleave the U/V rows needed by the search windows of the line
+	int y1 = row_cnt + psize + swinrv;
+	packed_in->fill(y1, (y1 + 1) >> 1);
+
+	PlaneOut<ImageType> out[3];
+	packed_out->set_output(planes, strides);
+	packed_out->out_planes(out);
+
+	int output_rows = next_line_planes(out);
+	packed_out->store(orig_h, chroma->done);
+	return output_rows;
+}
+
+template <typename ImageType>
+int CBM3D_SUB_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out[3];
+	out[0] = PlaneOut<ImageType>(clean, orig_w);
+	out[1] = PlaneOut<ImageType>(clean + orig_w * orig_h, chroma->w);
+	out[2] = PlaneOut<ImageType>(clean + orig_w * orig_h + chroma->w * chroma->h, chroma->w);
+	return next_line_planes(out);
+}
+
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::load_source(RowSource<ImageType> *source, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	noisy = PlaneView<ImageType>();
+}
+
+template <typename ImageType>
+int CBM3D_SUB_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
+{
+	if (noisy.data == NULL) return -1;	// no frame is loaded
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
+
+	refx = swinrh;
+	matcher->start_line(noisy, 0, row_cnt);
+
+	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
+	// proceesing the line
+	for (int x = 0; x < orig_w + pstep - psize; x += pstep)
+	{
+		g3d->thres = thres_yuv[0];
+
+		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
+		grouping();
+		matched += g3d->num;
+		nrefs++;
+		perf.end(PERF_STAGE_GROUPING);
+		gtime += clock() - t;
+
+		t = clock();
+		perf.begin(PERF_STAGE_FILTERING);
+		filtering();
+		perf.end(PERF_STAGE_FILTERING);
+		ftime += clock() - t;
+
+		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
+		aggregation();
+		perf.end(PERF_STAGE_AGGREGATION);
+		atime += clock() - t;
+
+		chroma_filtering();
+
+		refx += pstep;
+	}
+
+	// the U/V rows are written out as soon as they are completed, which may be not aligned with the Y rows
+	int next_row = row_cnt + pstep < orig_h + pstep - psize ? row_cnt + pstep : orig_h;
+	chroma->output(out + 1, next_row, (1 << bit_depth) - 1, shift);
+
+	// output the completed rows
+	int first_row = 0;
+	int output_rows;
+	int out_row = 0;	// image row of the first output row
+	if (row_cnt < swinrv) 
+	{
+		if (row_cnt + pstep <= swinrv) {
+			// no row is completed in the begining
+			output_rows = 0;
+		}
+		else {
+			output_rows = row_cnt + pstep - swinrv;
+			first_row = pstep - output_rows;
+		}
+	} 
+	else 
+	{
+		if (row_cnt >= orig_h - psize)
+			output_rows = orig_h - row_cnt + swinrv;	// the last line of reference patches
+		else
+			output_rows = pstep;
+		out_row = row_cnt - swinrv;
+	}
+
+	for (int r = 0; r < output_rows; r++)
+	{
+		ImageType *row = out[0].row(out_row + r);
+		const PatchType *numer = lbuf->numer_row(first_row + r) + swinrh;
+		const PatchType *denom = lbuf->denom_row(first_row + r) + swinrh;
+		normalize_row(&row, &numer, &denom, 1, orig_w, (1 << bit_depth) - 1, shift);
+	}
+
+	// discard the fisrt (pstep) rows of the numerator and denominator buffers
+	// and recycle them as (pstep) new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
+	shift_numer_denom();
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
+
+	row_cnt += pstep;
+	return output_rows;
+}
+
+/* The chroma group shares the offsets of the luma group, and the U/V planes are filtered one by one.
+ * The chroma groups are small enough to be aggregated by a single thread.
+ */
+template <typename ImageType>
+void CBM3D_SUB_T<ImageType>::chroma_filtering()
+{
+	int rx = refx - swinrh;
+	chroma->map_patches(g3d, g3d_uv, rx, row_cnt);
+
+	clock_t t;
+	for (int i = 0; i < 2; i++)
+	{
+		g3d_uv->thres = thres_yuv[i + 1];
+		for (int k = 0; k < chroma->parts(); k++)
+		{
+			t = clock();
+			perf.begin(PERF_STAGE_GROUPING);
+			g3d_uv->fill_patches_values(noisy_uv[i], chroma->ref_x(rx), chroma->ref_y(row_cnt, k));
+			perf.end(PERF_STAGE_GROUPING);
+			gtime += clock() - t;
+
+			t = clock();
+			perf.begin(PERF_STAGE_FILTERING);
+			g3d_uv->transform_3d();
+			g3d_uv->hard_thresholding();
+			g3d_uv->inv_transform_3d();
+			perf.end(PERF_STAGE_FILTERING);
+			ftime += clock() - t;
+
+			t = clock();
+			perf.begin(PERF_STAGE_AGGREGATION);
+			g3d_uv->set_aggregation_weight(Kaiser4x4, g3d_uv->get_weight());
+			chroma->aggregate(g3d_uv, i, rx, row_cnt, k);
+			perf.end(PERF_STAGE_AGGREGATION);
+			atime += clock() - t;
+		}
+	}
+}
+
+template class CBM3D_SUB_T<uint8_t>;
+template class CBM3D_SUB_T<uint16_t>;
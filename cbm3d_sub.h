@@ -0,0 +1,147 @@
+#ifndef __CBM3D_SUB_H__
+#define __CBM3D_SUB_H__
+
+#include "bm3d.h"
+#include "chroma_lines.h"
+#include "packed_frame.h"
+
+/* Implementation of the first step, i.e. Hard-thresholding, of the BM3D denoising method for YUV 4:2:0 or 4:2:2 images.
+ * The memory of the YUV frame is in a planar format, i.e. [(w*h) Y | (w/2*h/2) U | (w/2*h/2) V] for 4:2:0, 
+ * or [(w*h) Y | (w/2*h) U | (w/2*h) V] for 4:2:2, and the width (and height for 4:2:0) must be even,
+ * otherwise the frame isn't loaded, i.e. next_line() returns -1, as the last U/V column (row) would never be written.
+ * The grouping runs on the Y plane only, and the matched luma patches are mapped onto the 4x4 chroma patches, 
+ * which are filtered with the 4x4 Haar wavelet and aggregated with the 4x4 Kaiser window, 
+ * so that there is no need to upsample the U/V planes to 4:4:4.
+ */
+template <typename ImageType>
+class CBM3D_SUB_T : public BM3D_T<ImageType>
+{
+	typedef BM3D_T<ImageType> Base;
+
+public:
+	CBM3D_SUB_T(
+		int w_,						// width
+		int h_,						// height
+		int format = CHROMA_FORMAT_420,	// CHROMA_FORMAT_420 or CHROMA_FORMAT_422
+		int max_sim = 16,			// maximum similar patches
+		int psize_ = 8,				// reference patch size
+		int pstep_ = 3,				// reference patch step
+		int swinrh_ = 16,			// horizontal search window radius
+		int ssteph_ = 1,			// horizontal search step
+		int swinrv_ = 16,			// vertical search window radius
+		int sstepv_ = 1,			// vertical search step
+		int bit_depth_ = SampleTraits<ImageType>::max_depth	// bit depth of the samples
+	);
+	~CBM3D_SUB_T();
+
+	using Base::grouping;
+	using Base::filtering;
+	using Base::aggregation;
+	using Base::shift_numer_denom;
+
+	/* Load a new noisy yuv420/yuv422 frame and reset the buffers. */
+	void load(
+		ImageType *org_noisy_yuv,	// pointer of the input noisy yuv420/yuv422 (planar) frame
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load the Y/U/V planes of a new noisy yuv420/yuv422 frame in place and reset the buffers. */
+	void load_planes(
+		const ImageType *const *planes,	// pointers of the input noisy Y/U/V planes
+		const int *strides,			// strides of the planes
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load a new noisy NV12/NV21 frame in place and reset the buffers, which is YUV 4:2:0 with the U/V planes interleaved.
+	 * The Y plane is read in place, and the U/V rows are deinterleaved just before they are needed.
+	 * Only the CHROMA_FORMAT_420 engines accept the frame, otherwise next_line_packed() returns -1.
+	 */
+	void load_packed(
+		const ImageType *const *planes,	// pointers of the input noisy Y and U/V planes
+		const int *strides,			// strides of the planes
+		int format,					// FRAME_FORMAT_NV12 or FRAME_FORMAT_NV21
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* reset the buffers and redirect the processing reference patch to the first one of the noisy image */
+	void reset();
+
+	/* Denoise just a line of reference patches and write out the completed rows. */
+	int next_line(
+		ImageType *clean_yuv		// pointer of output denoised yuv420/yuv422 (planar) frame
+	);
+
+	/* Denoise just a line of reference patches and write out the completed rows to the Y/U/V planes. */
+	int next_line_planes(
+		const PlaneOut<ImageType> *out	// output denoised Y/U/V planes
+	);
+
+	/* Denoise just a line of reference patches and write out the completed rows to the NV12/NV21 frame in the loaded format. */
+	int next_line_packed(
+		ImageType *const *planes,	// pointers of the output denoised Y and U/V planes
+		const int *strides			// strides of the planes
+	);
+
+	/* The rows of the subsampled U/V planes can't be streamed with the Y ones, so a streamed frame is rejected,
+	 * i.e. no frame is loaded and next_line() returns -1, and so is a row sink.
+	 */
+	void load_source(RowSource<ImageType> *source, int sigmay, DistType max_mdist = 2500, int sigmau = -1, int sigmav = -1);
+	int next_line_sink(RowSink<ImageType> *sink) { return -1; }
+
+	/* The U/V patches are mapped from the Y group within the search window, so the search mode is ignored. */
+	void set_search_mode(int mode) {}
+
+	/* The subsampled U/V lines are not processed by the region of the Y ones, so the region is ignored and a tile is rejected. */
+	void set_mask(const uint8_t *mask, int stride, int halo = 0) {}
+	void set_roi(int x, int y, int rw, int rh, int halo = 0) {}
+	int run_tile(int x, int y, int tw, int th, ImageType *const *planes, const int *strides) { return -1; }
+
+	/* filtering and aggregation steps of the chroma patches mapped from the luma group */
+	void chroma_filtering();
+
+protected:
+	using Base::orig_w;
+	using Base::orig_h;
+	using Base::w;
+	using Base::h;
+	using Base::noisy;
+	using Base::zeros;
+	using Base::psize;
+	using Base::pstep;
+	using Base::swinrh;
+	using Base::swinrv;
+	using Base::g3d;
+	using Base::matcher;
+	using Base::bit_depth;
+	using Base::shift;
+	using Base::row_cnt;
+	using Base::lbuf;
+	using Base::refx;
+	using Base::gtime;
+	using Base::ftime;
+	using Base::atime;
+	using Base::perf;
+
+	ChromaLines *chroma;		// line buffers and patch mapping of the U/V planes
+	Group3D *g3d_uv;			// 3d group of the 4x4 chroma patches
+	PlaneView<ImageType> noisy_uv[2];
+
+	PatchType thres_yuv[3];
+
+	PackedFrame<ImageType> *packed_in;	// rows of the input NV12/NV21 frame, NULL for the planar input
+	PackedFrame<ImageType> *packed_out;	// rows of the output NV12/NV21 frame
+};
+
+typedef CBM3D_SUB_T<uint8_t>  CBM3D_SUB;		// 8-bit samples
+typedef CBM3D_SUB_T<uint16_t> CBM3D_SUB16;	// 9 to 16-bit samples
+
+#endif
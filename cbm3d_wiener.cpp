@@ -1,17 +1,10 @@
 #include <iostream>
 #include "cbm3d_wiener.h"
+#include "kernels.h"
+#include "trace.h"
 
-static inline DistType get_dist(ImageType a, ImageType b)
-{
-	int diff = (int)a - b;
-#if USE_L2_DIST
-	return diff * diff;
-#else
-	return diff >= 0 ? diff : -diff;
-#endif
-}
-
-CBM3D_WIE::CBM3D_WIE(
+template <typename ImageType>
+CBM3D_WIE_T<ImageType>::CBM3D_WIE_T(
 	int w_,					// width
 	int h_,					// height
 	int max_sim,			// maximum similar patches
@@ -20,166 +13,298 @@ CBM3D_WIE::CBM3D_WIE(
 	int swinrh_,			// horizontal search window radius
 	int ssteph_,			// horizontal search step
 	int swinrv_,			// vertical search window radius
-	int sstepv_				// vertical search step
-) : BM3D_WIE(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_)
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
+) : Base(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_, bit_depth_)
 {
-	noisy_yuv[0]       = noisy;
-	basic_yuv[0]	   = basic;
-	numerator_yuv[0]   = numerator;
-	denominator_yuv[0] = denominator;
-
+	// the Wiener weights of the Y/U/V groups differ in the floating-point version, 
+	// otherwise the U/V share the denominator of Y as they are aggregated at the same patches with the same weights
+	lbuf_yuv[0] = lbuf;
+	g3d_noisy_yuv[0] = g3d_noisy;
+	g3d_basic_yuv[0] = g3d_basic;
 	for (int i = 1; i < 3; i++)
 	{
-		noisy_yuv[i]       = new ImageType[w * h]();
-		basic_yuv[i]	   = new ImageType[w * h]();
-		numerator_yuv[i]   = new PatchType[w * (psize + swinrv * 2)];
-		denominator_yuv[i] = new PatchType[w * (psize + swinrv * 2)];
+		lbuf_yuv[i] = new LineBuffer(w, psize + swinrv * 2, USE_INTEGER == 0);
+		g3d_noisy_yuv[i] = new Group3D(psize, psize, max_sim);
+		g3d_basic_yuv[i] = new Group3D(psize, psize, max_sim);
+		g3d_noisy_yuv[i]->shift = shift;
+		g3d_basic_yuv[i]->shift = shift;
 	}
+
+	packed_noisy = NULL;
+	packed_basic = NULL;
+	packed_out   = NULL;
+
+	// the threads only pay off with more than one core
+	chan_threads = (CHANNEL_PARALLEL && omp_get_num_procs() > 1) ? 3 : 1;
 }
 
-CBM3D_WIE::~CBM3D_WIE()
+template <typename ImageType>
+CBM3D_WIE_T<ImageType>::~CBM3D_WIE_T()
 {
 	for (int i = 1; i < 3; i++)
 	{
-		delete[] noisy_yuv[i];
-		delete[] basic_yuv[i];
-		delete[] numerator_yuv[i];
-		delete[] denominator_yuv[i];
+		delete lbuf_yuv[i];
+		delete g3d_noisy_yuv[i];
+		delete g3d_basic_yuv[i];
 	}
+	delete packed_noisy;
+	delete packed_basic;
+	delete packed_out;
 
 	// the ~BM3D is called after the ~CBM3D
-	noisy       = noisy_yuv[0];
-	basic	    = basic_yuv[0];
-	numerator   = numerator_yuv[0];
-	denominator = denominator_yuv[0];
+	lbuf = lbuf_yuv[0];
 }
 
-void CBM3D_WIE::reset()
+template <typename ImageType>
+int CBM3D_WIE_T<ImageType>::run_tile(int x, int y, int tw, int th, ImageType *const *planes, const int *strides)
+{
+	if (x < 0 || y < 0 || tw <= 0 || th <= 0 || x + tw > orig_w || y + th > orig_h) return -1;	// the tile must be within the image
+
+	region->set_tile(x, y, tw, th, swinrh > swinrv ? swinrh : swinrv);
+	reset();
+	row_cnt = region->first_line();
+
+	PlaneOut<ImageType> out[3];	// the first rows of the tile are the row (y)
+	for (int i = 0; i < 3; i++)
+	{
+		out[i] = PlaneOut<ImageType>(planes[i], strides[i], 0, y);
+	}
+	while (row_cnt - swinrv < y + th && next_line_planes(out) >= 0);
+	region->set_mask(NULL, 0, 0);
+	return th;
+}
+
+template <typename ImageType>
+void CBM3D_WIE_T<ImageType>::reset()
 {
 	row_cnt = 0;
 	for (int i = 0; i < 3; i++)
 	{
-		memset(numerator_yuv[i],   0, (psize + swinrv * 2) * w * sizeof(PatchType));
-		memset(denominator_yuv[i], 0, (psize + swinrv * 2) * w * sizeof(PatchType));
+		lbuf_yuv[i]->reset();
 	}
+	if (stream_in) stream_in->restart();
 }
 
-void CBM3D_WIE::load(ImageType *org_noisy_yuv, ImageType* org_basic_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+template <typename ImageType>
+void CBM3D_WIE_T<ImageType>::load(ImageType *org_noisy_yuv, ImageType *org_basic_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
 {
+	const ImageType *noisy_planes[3];
+	const ImageType *basic_planes[3];
+	const int strides[3] = {orig_w, orig_w, orig_w};
 	for (int i = 0; i < 3; i++)
 	{
-		noisy       = noisy_yuv[i];
-		basic		= basic_yuv[i];
-		numerator   = numerator_yuv[i];
-		denominator = denominator_yuv[i];
+		noisy_planes[i] = org_noisy_yuv + i * (orig_w * orig_h);
+		basic_planes[i] = org_basic_yuv + i * (orig_w * orig_h);
+	}
+	load_planes(noisy_planes, strides, basic_planes, strides, sigmay, max_mdist, sigmau, sigmav);
+}
 
-		BM3D_WIE::load(org_noisy_yuv, org_basic_yuv, sigmay, max_mdist);
-		org_noisy_yuv += (orig_w * orig_h);
-		org_basic_yuv += (orig_w * orig_h);
+template <typename ImageType>
+void CBM3D_WIE_T<ImageType>::load_planes(const ImageType *const *noisy_planes, const int *noisy_strides, 
+	const ImageType *const *basic_planes, const int *basic_strides, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		lbuf = lbuf_yuv[i];
+		Base::load_planes(noisy_planes + i, noisy_strides + i, basic_planes + i, basic_strides + i, sigmay, max_mdist);
+		noisy_yuv[i] = noisy;
+		basic_yuv[i] = basic;
 	}
 
-	wie_thres[0] = sigmay * sigmay * (1 << (COEFF_DICI_BITS * 2));
-	wie_thres[1] = sigmau < 0 ? wie_thres[0] : sigmau * sigmau * (1 << (COEFF_DICI_BITS * 2));
-	wie_thres[2] = sigmav < 0 ? wie_thres[0] : sigmav * sigmav * (1 << (COEFF_DICI_BITS * 2));
+	wie_thres[0] = wiener_thres(sigmay, shift);
+	wie_thres[1] = sigmau < 0 ? wie_thres[0] : wiener_thres(sigmau, shift);
+	wie_thres[2] = sigmav < 0 ? wie_thres[0] : wiener_thres(sigmav, shift);
+	for (int i = 0; i < 3; i++)
+	{
+		g3d_basic_yuv[i]->thres = wie_thres[i];
+	}
 }
 
-int CBM3D_WIE::next_line(ImageType *clean)
+template <typename ImageType>
+void CBM3D_WIE_T<ImageType>::load_source(RowSource<ImageType> *source, int sigmay, DistType max_mdist, int sigmau, int sigmav)
 {
-	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	if (stream_in == NULL || stream_in->nplanes != 6)
+	{
+		delete stream_in;
+		stream_in = new RowRing<ImageType>(6, orig_w, orig_h, psize + swinrv * 2);
+	}
 
+	const ImageType *noisy_planes[3];
+	const ImageType *basic_planes[3];
+	const int strides[3] = {orig_w, orig_w, orig_w};
 	for (int i = 0; i < 3; i++)
 	{
-		refer_noisy_yuv[i] = noisy_yuv[i] + swinrh + (row_cnt + swinrv) * w;
-		refer_basic_yuv[i] = basic_yuv[i] + swinrh + (row_cnt + swinrv) * w;
-		numer_yuv[i] = numerator_yuv[i]   + swinrh + swinrv * w;
-		denom_yuv[i] = denominator_yuv[i] + swinrh + swinrv * w;
+		noisy_planes[i] = stream_in->ring(i);
+		basic_planes[i] = stream_in->ring(i + 3);
 	}
+	load_planes(noisy_planes, strides, basic_planes, strides, sigmay, max_mdist, sigmau, sigmav);
+	for (int i = 0; i < 3; i++)
+	{
+		noisy_yuv[i].ring = stream_in->rows;
+		basic_yuv[i].ring = stream_in->rows;
+	}
+	stream_in->set_source(source);
+}
 
-	memset(dist_buf, 0, nsh * nsv * nbuf * sizeof(DistType));
-	memset(dist_sum, 0, nsh * nsv * sizeof(DistType));
+template <typename ImageType>
+void CBM3D_WIE_T<ImageType>::load_packed(const ImageType *const *noisy_planes, const int *noisy_strides, 
+	const ImageType *const *basic_planes, const int *basic_strides, int format, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (packed_noisy == NULL || packed_noisy->format != format)
+	{
+		delete packed_noisy;
+		delete packed_basic;
+		delete packed_out;
+		packed_noisy = new PackedFrame<ImageType>(format, orig_w, orig_h, psize + swinrv * 2, psize + swinrv * 2, bit_depth);
+		packed_basic = new PackedFrame<ImageType>(format, orig_w, orig_h, psize + swinrv * 2, psize + swinrv * 2, bit_depth);
+		packed_out   = new PackedFrame<ImageType>(format, orig_w, orig_h, psize + swinrv * 2, psize + swinrv * 2, bit_depth);
+	}
+	packed_noisy->set_input(noisy_planes, noisy_strides);
+	packed_basic->set_input(basic_planes, basic_strides);
+	packed_noisy->reset();
+	packed_basic->reset();
+	packed_out->reset();
 
-	// initialize the distance buffer
-#pragma omp parallel for num_threads(USE_THREADS_NUM)
-	for (int sy = -swinrv; sy <= swinrv; sy += sstepv)
+	const ImageType *noisy_ycc[3], *basic_ycc[3];
+	int noisy_ycc_strides[3], basic_ycc_strides[3];
+	int noisy_rings[3], basic_rings[3];
+	packed_noisy->in_planes(noisy_ycc, noisy_ycc_strides, noisy_rings);
+	packed_basic->in_planes(basic_ycc, basic_ycc_strides, basic_rings);
+	load_planes(noisy_ycc, noisy_ycc_strides, basic_ycc, basic_ycc_strides, sigmay, max_mdist, sigmau, sigmav);
+	for (int i = 0; i < 3; i++)
 	{
-		for (int sx = -swinrh; sx <= swinrh; sx += ssteph)
-		{
-			int idx = (sy + swinrv) / sstepv * nsh + (sx + swinrh) / ssteph;
-			for (int y = 0; y < psize; y++) {
-				for (int x = 0; x < psize - pstep; x++) {
-					dist_buf[nbuf * idx + x / pstep] += get_dist(refer_basic_yuv[0][y * w + x], refer_basic_yuv[0][(y + sy) * w + x + sx]);
-				}
-			}
-			for (int i = 0; i < nbuf - 2; i++) {
-				dist_sum[idx] += dist_buf[nbuf * idx + i];
-			}
-		}
+		noisy_yuv[i].ring = noisy_rings[i];
+		basic_yuv[i].ring = basic_rings[i];
 	}
-	ncnt = nbuf;
+}
 
-	clock_t t;
-	// proceesing the line
-	for (int x = 0; x < orig_w + pstep - psize; x += pstep, ncnt++)
+template <typename ImageType>
+int CBM3D_WIE_T<ImageType>::next_line_packed(ImageType *const *planes, const int *strides)
+{
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+
+	// convert the rows needed by the search windows of the line
+	packed_noisy->fill(row_cnt + psize + swinrv, row_cnt + psize + swinrv);
+	packed_basic->fill(row_cnt + psize + swinrv, row_cnt + psize + swinrv);
+
+	PlaneOut<ImageType> out[3];
+	packed_out->set_output(planes, strides);
+	packed_out->out_planes(out);
+
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	int output_rows = next_line_planes(out);
+	packed_out->store(out_row + output_rows, out_row + output_rows);
+	return output_rows;
+}
+
+template <typename ImageType>
+int CBM3D_WIE_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out[3];
+	for (int i = 0; i < 3; i++)
 	{
-		refer_noisy = refer_noisy_yuv[0];
-		refer_basic = refer_basic_yuv[0];
-		numer = numer_yuv[0];
-		denom = denom_yuv[0];
+		out[i] = PlaneOut<ImageType>(clean + i * (orig_w * orig_h), orig_w);
+	}
+	return next_line_planes(out);
+}
 
-		g3d_basic->thres = wie_thres[0];
+template <typename ImageType>
+int CBM3D_WIE_T<ImageType>::next_line_sink(RowSink<ImageType> *sink)
+{
+	if (sink_out == NULL || sink_out->nplanes != 3)
+	{
+		delete sink_out;
+		sink_out = new SinkRows<ImageType>(3, orig_w, psize + swinrv * 2);
+	}
 
-		t = clock();
-		grouping();
-		gtime += clock() - t;
+	PlaneOut<ImageType> out[3];
+	int out_row = row_cnt < swinrv ? 0 : row_cnt - swinrv;
+	sink_out->out_planes(out, out_row);
 
-		t = clock();
-		filtering();
-		ftime += clock() - t;
+	int output_rows = next_line_planes(out);
+	sink_out->flush(sink, out_row, output_rows);
+	return output_rows;
+}
 
-		t = clock();
-		aggregation();
-		atime += clock() - t;
+template <typename ImageType>
+int CBM3D_WIE_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
+{
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
 
-		for (int i = 1; i < 3; i++)
-		{
-			refer_noisy = refer_noisy_yuv[i];
-			refer_basic = refer_basic_yuv[i];
-			numer = numer_yuv[i];
-			denom = denom_yuv[i];
+	// pull the rows needed by the search windows of the line
+	if (stream_in) stream_in->fill(row_cnt + psize + swinrv);
 
-			g3d_basic->thres = wie_thres[i];
+	refx = swinrh;
+	noisy = noisy_yuv[0];
+	basic = basic_yuv[0];
+	int nactive = region->start_line(row_cnt);	// reference patches of the line touching the region
+	if (nactive > 0) matcher->start_line(basic_yuv[0], 0, row_cnt);
 
-			t = clock();
-			g3d_noisy->fill_patches_values(refer_noisy, w);
-			g3d_basic->fill_patches_values(refer_basic, w);
-			gtime += clock() - t;
+	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
+	// proceesing the line
+	for (int x = 0; nactive > 0 && x < orig_w + pstep - psize; x += pstep)
+	{
+		if (!region->active(x / pstep))
+		{
+			refx += pstep;
+			continue;
+		}
 
-			t = clock();
-			filtering();
-			ftime += clock() - t;
+		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
+		grouping();
+		matched += g3d_basic->num;
+		nrefs++;
+		for (int i = 1; i < 3; i++)
+		{
+			g3d_noisy_yuv[i]->copy_matches(g3d_basic);
+			g3d_basic_yuv[i]->copy_matches(g3d_basic);
+		}
+		perf.end(PERF_STAGE_GROUPING);
+		gtime += clock() - t;
 
-			t = clock();
-			aggregation();
-			atime += clock() - t;
+		// each channel has its own groups and line buffers, so the channels are filtered concurrently,
+		// and then aggregated concurrently, so that each stage is timed on its own
+		t = clock();
+		perf.begin(PERF_STAGE_FILTERING);
+#pragma omp parallel for num_threads(chan_threads) if (chan_threads > 1)
+		for (int i = 0; i < 3; i++)
+		{
+			double t0 = trace_begin();
+			if (i > 0)
+			{
+				g3d_noisy_yuv[i]->fill_patches_values(noisy_yuv[i], refx - swinrh, row_cnt);
+				g3d_basic_yuv[i]->fill_patches_values(basic_yuv[i], refx - swinrh, row_cnt);
+			}
+			filtering(g3d_noisy_yuv[i], g3d_basic_yuv[i]);
+			trace_span("filter channel", t0, i);
 		}
+		perf.end(PERF_STAGE_FILTERING);
+		ftime += clock() - t;
 
+		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
+#pragma omp parallel for num_threads(chan_threads) if (chan_threads > 1)
 		for (int i = 0; i < 3; i++)
 		{
-			refer_noisy_yuv[i] += pstep;
-			refer_basic_yuv[i] += pstep;
-			numer_yuv[i] += pstep;
-			denom_yuv[i] += pstep;
+			double t0 = trace_begin();
+			aggregation(g3d_noisy_yuv[i], lbuf_yuv[i]);
+			trace_span("aggregate channel", t0, i);
 		}
-	}
+		perf.end(PERF_STAGE_AGGREGATION);
+		atime += clock() - t;
 
-	// output the completed rows
-	for (int i = 0; i < 3; i++)
-	{
-		numer_yuv[i] = numerator_yuv[i] + swinrh;
-		denom_yuv[i] = denominator_yuv[i] + swinrh;
+		refx += pstep;
 	}
 
+	// output the completed rows
+	int first_row = 0;
 	int output_rows;
+	int out_row = 0;	// image row of the first output row
 	if (row_cnt < swinrv)
 	{
 		if (row_cnt + pstep <= swinrv) {
@@ -188,10 +313,7 @@ int CBM3D_WIE::next_line(ImageType *clean)
 		}
 		else {
 			output_rows = row_cnt + pstep - swinrv;
-			for (int i = 0; i < 3; i++) {
-				numer_yuv[i] += (pstep - output_rows) * w;
-				denom_yuv[i] += (pstep - output_rows) * w;
-			}
+			first_row = pstep - output_rows;
 		}
 	}
 	else
@@ -200,34 +322,44 @@ int CBM3D_WIE::next_line(ImageType *clean)
 			output_rows = orig_h - row_cnt + swinrv;
 		else
 			output_rows = pstep;
-		clean += orig_w * (row_cnt - swinrv);
+		out_row = row_cnt - swinrv;
 	}
 
-	for (int i = 0; i < 3; i++)
+	// all the Y/U/V rows are written out at once
+	for (int r = 0; r < output_rows; r++)
 	{
-		numer = numer_yuv[i];
-		denom = denom_yuv[i];
-		for (int idx = 0, r = 0; r < output_rows; r++)
+		if (!region->writes(out_row + r)) continue;
+		ImageType *rows[3];
+		const ImageType *in[3];
+		const PatchType *numer[3];
+		const PatchType *denom[3];
+		for (int i = 0; i < 3; i++)
 		{
-			for (int c = 0; c < orig_w; c++, idx++)
-			{
-				clean[idx] = (ImageType)(numer[c] / denom[c]);
-			}
-			numer += w;
-			denom += w;
+			rows[i]  = out[i].row(out_row + r);
+			in[i]    = noisy_yuv[i].row(out_row + r);
+			numer[i] = lbuf_yuv[i]->numer_row(first_row + r) + swinrh;
+			denom[i] = lbuf_yuv[lbuf_yuv[i]->denominator ? i : 0]->denom_row(first_row + r) + swinrh;
 		}
-		clean += (orig_w * orig_h);
+		region->output_row(rows, in, numer, denom, 3, out_row + r, (1 << bit_depth) - 1, shift);
 	}
 
-	// remove the fisrt pstep rows of the numerator and denominator buffers
-	// and insert pstep new rows to the end of the buffers
+	// discard the fisrt pstep rows of the numerator and denominator buffers
+	// and recycle them as pstep new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
 	for (int i = 0; i < 3; i++)
 	{
-		numerator = numerator_yuv[i];
-		denominator = denominator_yuv[i];
+		lbuf = lbuf_yuv[i];
 		shift_numer_denom();
 	}
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
 
 	row_cnt += pstep;
 	return output_rows;
-}
\ No newline at end of file
+}
+
+template class CBM3D_WIE_T<uint8_t>;
+template class CBM3D_WIE_T<uint16_t>;
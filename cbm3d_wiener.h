@@ -2,6 +2,7 @@
 #define __CBM3D_WIENER_H__
 
 #include "bm3d_wiener.h"
+#include "packed_frame.h"
 
 /* Implementation of the second step, i.e. Wiener-filtering, of the BM3D denoising method for YUV 4:4:4 images.
  * Note that the implementation only supports YUV 4:4:4 format, that the U/V component has the same size as Y.
@@ -13,10 +14,13 @@
  * However, it's not a big difference between sigmaY and sigmaU or sigmaV for the BT.601 or BT.709,
  * and we can approximately compute sigmaY/U/V = 0.6 * sigmaR/G/B.
  */
-class CBM3D_WIE : public BM3D_WIE
+template <typename ImageType>
+class CBM3D_WIE_T : public BM3D_WIE_T<ImageType>
 {
+	typedef BM3D_WIE_T<ImageType> Base;
+
 public:
-	CBM3D_WIE(
+	CBM3D_WIE_T(
 		int w_,						// width
 		int h_,						// height
 		int max_sim = 16,			// maximum similar patches
@@ -25,42 +29,142 @@ public:
 		int swinrh_ = 16,			// horizontal search window radius
 		int ssteph_ = 1,			// horizontal search step
 		int swinrv_ = 16,			// vertical search window radius
-		int sstepv_ = 1				// vertical search step
+		int sstepv_ = 1,			// vertical search step
+		int bit_depth_ = SampleTraits<ImageType>::max_depth	// bit depth of the samples
 	);
-	~CBM3D_WIE();
+	~CBM3D_WIE_T();
+
+	using Base::grouping;
+	using Base::filtering;
+	using Base::aggregation;
+	using Base::shift_numer_denom;
 
 	/* Load a new noisy yuv444 frame and reset the buffers. */
 	void load(
-		ImageType* org_noisy_yuv,	// pointer of the input noisy yuv444 (planar) frame
-		ImageType* org_basic_yuv,	// pointer of the input noisy yuv444 (planar) frame
+		ImageType *org_noisy_yuv,	// pointer of the input noisy yuv444 (planar) frame
+		ImageType *org_basic_yuv,	// pointer of the input noisy yuv444 (planar) frame
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load the Y/U/V planes of a new noisy/basic yuv444 frame in place and reset the buffers. */
+	void load_planes(
+		const ImageType *const *noisy_planes,	// pointers of the input noisy Y/U/V planes
+		const int *noisy_strides,	// strides of the noisy planes
+		const ImageType *const *basic_planes,	// pointers of the input basic (step1 denoised) Y/U/V planes
+		const int *basic_strides,	// strides of the basic planes
 		int sigmay,					// sigma of the Y component
 		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
 		int sigmau = -1,			// sigma of the U component, same as Y if <0
 		int sigmav = -1				// sigma of the V component, same as Y if <0
 	);
 
+	/* Load a new noisy/basic yuv444 frame from a row source and reset the buffers, see CBM3D_T::load_source().
+	 * The rows[0/1/2] are the noisy Y/U/V rows, and rows[3/4/5] are the basic ones.
+	 */
+	void load_source(
+		RowSource<ImageType> *source,	// source of the input noisy/basic rows, kept valid until the whole frame is processed
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the U component, same as Y if <0
+		int sigmav = -1				// sigma of the V component, same as Y if <0
+	);
+
+	/* Load a new noisy/basic packed RGB/BGR frame in place and reset the buffers, see CBM3D_T::load_packed(). */
+	void load_packed(
+		const ImageType *const *noisy_planes,	// pointer of the input noisy packed frame, i.e. noisy_planes[0]
+		const int *noisy_strides,	// stride (in samples) of the noisy packed frame
+		const ImageType *const *basic_planes,	// pointer of the input basic (step1 denoised) packed frame
+		const int *basic_strides,	// stride (in samples) of the basic packed frame
+		int format,					// FRAME_FORMAT_RGB or FRAME_FORMAT_BGR
+		int sigmay,					// sigma of the Y component
+		DistType max_mdist = 2500,	// maximum mean distance (L2/L1) between the reference and the candidate
+		int sigmau = -1,			// sigma of the Cb component, same as Y if <0
+		int sigmav = -1				// sigma of the Cr component, same as Y if <0
+	);
+
 	/* reset the buffers and redirect the processing reference patch to the first one of the noisy image */
 	void reset();
 
 	/* Denoise just a line of reference patches and write out the completed rows. */
 	int next_line(
-		ImageType* clean_yuv		// pointer of output denoised yuv444 (planar) frame
+		ImageType *clean_yuv		// pointer of output denoised yuv444 (planar) frame
 	);
 
-protected:
+	/* Denoise just a line of reference patches and write out the completed rows to the Y/U/V planes. */
+	int next_line_planes(
+		const PlaneOut<ImageType> *out	// output denoised Y/U/V planes
+	);
+
+	/* Denoise just a line of reference patches and pass the completed rows to the sink, i.e. rows[0/1/2] are the Y/U/V rows. */
+	int next_line_sink(
+		RowSink<ImageType> *sink	// sink of the output denoised rows
+	);
 
-	ImageType* noisy_yuv[3];
-	ImageType* basic_yuv[3];
-	PatchType* numerator_yuv[3];
-	PatchType* denominator_yuv[3];
+	/* Denoise just a line of reference patches and write out the completed rows to the packed frame in the loaded format. */
+	int next_line_packed(
+		ImageType *const *planes,	// pointer of the output denoised packed frame, i.e. planes[0]
+		const int *strides			// stride (in samples) of the packed frame
+	);
+
+	/* Denoise only the tile [x, x + tw) x [y, y + th) of the frame loaded by load() or load_planes(), and write it to the Y/U/V planes of the tile,
+	 * exactly the same as denoising the whole frame, see BM3D_WIE_T::run_tile().
+	 */
+	int run_tile(
+		int x, int y,				// top-left pixel of the tile
+		int tw, int th,				// width and height of the tile
+		ImageType *const *planes,	// pointers of the output Y/U/V planes, beginning at the top-left pixel of the tile
+		const int *strides			// strides of the output planes
+	);
 
-	ImageType* refer_noisy_yuv[3];
-	ImageType* refer_basic_yuv[3];
-	PatchType* numer_yuv[3];
-	PatchType* denom_yuv[3];
+protected:
+	using Base::noisy;
+	using Base::basic;
+	using Base::g3d_noisy;
+	using Base::g3d_basic;
+	using Base::orig_w;
+	using Base::orig_h;
+	using Base::w;
+	using Base::h;
+	using Base::zeros;
+	using Base::stream_in;
+	using Base::sink_out;
+	using Base::psize;
+	using Base::pstep;
+	using Base::swinrh;
+	using Base::ssteph;
+	using Base::swinrv;
+	using Base::sstepv;
+	using Base::matcher;
+	using Base::bit_depth;
+	using Base::shift;
+	using Base::row_cnt;
+	using Base::lbuf;
+	using Base::refx;
+	using Base::gtime;
+	using Base::ftime;
+	using Base::atime;
+	using Base::perf;
+	using Base::region;
+
+	PlaneView<ImageType> noisy_yuv[3];
+	PlaneView<ImageType> basic_yuv[3];
+	LineBuffer* lbuf_yuv[3];
+	Group3D *g3d_noisy_yuv[3];	// noisy groups of each channel, which share the matches of the Y basic group
+	Group3D *g3d_basic_yuv[3];	// basic groups of each channel
+	int chan_threads;			// threads to filter the Y/U/V groups concurrently, 1 for the serial processing
 
 	PatchType wie_thres[3];
+
+	PackedFrame<ImageType> *packed_noisy;	// rows of the input noisy packed frame, NULL for the planar input
+	PackedFrame<ImageType> *packed_basic;	// rows of the input basic packed frame
+	PackedFrame<ImageType> *packed_out;		// rows of the output packed frame
 };
 
+typedef CBM3D_WIE_T<uint8_t>  CBM3D_WIE;		// 8-bit samples
+typedef CBM3D_WIE_T<uint16_t> CBM3D_WIE16;	// 9 to 16-bit samples
+
 #endif
 
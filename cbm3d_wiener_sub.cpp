@@ -0,0 +1,303 @@
+#include <iostream>
+#include "cbm3d_wiener_sub.h"
+#include "kernels.h"
+#include "trace.h"
+
+template <typename ImageType>
+CBM3D_WIE_SUB_T<ImageType>::CBM3D_WIE_SUB_T(
+	int w_,					// width
+	int h_,					// height
+	int format,				// CHROMA_FORMAT_420 or CHROMA_FORMAT_422
+	int max_sim,			// maximum similar patches
+	int psize_,				// reference patch size
+	int pstep_,				// reference patch step
+	int swinrh_,			// horizontal search window radius
+	int ssteph_,			// horizontal search step
+	int swinrv_,			// vertical search window radius
+	int sstepv_,			// vertical search step
+	int bit_depth_			// bit depth of the samples
+) : Base(w_, h_, max_sim, psize_, pstep_, swinrh_, ssteph_, swinrv_, sstepv_, bit_depth_)
+{
+	chroma = new ChromaLines(format, orig_w, orig_h, psize, w, swinrh, swinrv);
+	g3d_uv_noisy = new Group3D(chroma->psize, chroma->psize, max_sim);
+	g3d_uv_basic = new Group3D(chroma->psize, chroma->psize, max_sim);
+	g3d_uv_noisy->shift = shift;
+	g3d_uv_basic->shift = shift;
+
+	packed_noisy = NULL;
+	packed_basic = NULL;
+	packed_out   = NULL;
+}
+
+template <typename ImageType>
+CBM3D_WIE_SUB_T<ImageType>::~CBM3D_WIE_SUB_T()
+{
+	delete chroma;
+	delete g3d_uv_noisy;
+	delete g3d_uv_basic;
+	delete packed_noisy;
+	delete packed_basic;
+	delete packed_out;
+}
+
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::reset()
+{
+	Base::reset();
+	chroma->reset();
+}
+
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::load(ImageType *org_noisy_yuv, ImageType *org_basic_yuv, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	const ImageType *noisy_planes[3];
+	const ImageType *basic_planes[3];
+	const int strides[3] = {orig_w, chroma->w, chroma->w};
+	noisy_planes[0] = org_noisy_yuv;
+	basic_planes[0] = org_basic_yuv;
+	for (int i = 1; i < 3; i++)
+	{
+		int offset = orig_w * orig_h + (i - 1) * chroma->w * chroma->h;
+		noisy_planes[i] = org_noisy_yuv + offset;
+		basic_planes[i] = org_basic_yuv + offset;
+	}
+	load_planes(noisy_planes, strides, basic_planes, strides, sigmay, max_mdist, sigmau, sigmav);
+}
+
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::load_planes(const ImageType *const *noisy_planes, const int *noisy_strides, 
+	const ImageType *const *basic_planes, const int *basic_strides, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	// the U/V planes of an odd width (height for 4:2:0) have a column (row) of no luma patch, so the frame isn't loaded
+	if ((orig_w & 1) || (orig_h & chroma->sub_y))
+	{
+		noisy = PlaneView<ImageType>();
+		basic = PlaneView<ImageType>();
+		return;
+	}
+	Base::load_planes(noisy_planes, noisy_strides, basic_planes, basic_strides, sigmay, max_mdist);
+
+	// the replicated columns/rows of the U/V planes are the subsampled ones of the Y plane
+	int w_ext = (noisy.w_ext + 1) >> 1;
+	int h_ext = (noisy.h_ext + chroma->sub_y) >> chroma->sub_y;
+	for (int i = 0; i < 2; i++)
+	{
+		noisy_uv[i] = PlaneView<ImageType>(noisy_planes[i + 1], noisy_strides[i + 1], chroma->w, chroma->h, w_ext, h_ext, zeros);
+		basic_uv[i] = PlaneView<ImageType>(basic_planes[i + 1], basic_strides[i + 1], chroma->w, chroma->h, w_ext, h_ext, zeros);
+	}
+	chroma->reset();
+
+	wie_thres[0] = wiener_thres(sigmay, shift);
+	wie_thres[1] = sigmau < 0 ? wie_thres[0] : wiener_thres(sigmau, shift);
+	wie_thres[2] = sigmav < 0 ? wie_thres[0] : wiener_thres(sigmav, shift);
+}
+
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::load_packed(const ImageType *const *noisy_planes, const int *noisy_strides, 
+	const ImageType *const *basic_planes, const int *basic_strides, int format, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	if (packed_noisy == NULL || packed_noisy->format != format)
+	{
+		delete packed_noisy;
+		delete packed_basic;
+		delete packed_out;
+		packed_noisy = NULL;
+		packed_basic = NULL;
+		packed_out   = NULL;
+
+		// the NV12/NV21 frames are always YUV 4:2:0
+		if (!chroma->sub_y) return;
+		packed_noisy = new PackedFrame<ImageType>(format, orig_w, orig_h, 0, chroma->lbuf[0]->rows, bit_depth);
+		packed_basic = new PackedFrame<ImageType>(format, orig_w, orig_h, 0, chroma->lbuf[0]->rows, bit_depth);
+		packed_out   = new PackedFrame<ImageType>(format, orig_w, orig_h, 0, chroma->lbuf[0]->rows, bit_depth);
+	}
+	packed_noisy->set_input(noisy_planes, noisy_strides);
+	packed_basic->set_input(basic_planes, basic_strides);
+	packed_noisy->reset();
+	packed_basic->reset();
+	packed_out->reset();
+
+	const ImageType *noisy_yuv[3], *basic_yuv[3];
+	int noisy_yuv_strides[3], basic_yuv_strides[3];
+	int noisy_rings[3], basic_rings[3];
+	packed_noisy->in_planes(noisy_yuv, noisy_yuv_strides, noisy_rings);
+	packed_basic->in_planes(basic_yuv, basic_yuv_strides, basic_rings);
+	load_planes(noisy_yuv, noisy_yuv_strides, basic_yuv, basic_yuv_strides, sigmay, max_mdist, sigmau, sigmav);
+	for (int i = 0; i < 2; i++)
+	{
+		noisy_uv[i].ring = noisy_rings[i + 1];
+		basic_uv[i].ring = basic_rings[i + 1];
+	}
+}
+
+template <typename ImageType>
+int CBM3D_WIE_SUB_T<ImageType>::next_line_packed(ImageType *const *planes, const int *strides)
+{
+	if (packed_noisy == NULL || basic.data == NULL) return -1;
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+
+	// deinterleave the U/V rows needed by the search windows of the line
+	int y1 = row_cnt + psize + swinrv;
+	packed_noisy->fill(y1, (y1 + 1) >> 1);
+	packed_basic->fill(y1, (y1 + 1) >> 1);
+
+	PlaneOut<ImageType> out[3];
+	packed_out->set_output(planes, strides);
+	packed_out->out_planes(out);
+
+	int output_rows = next_line_planes(out);
+	packed_out->store(orig_h, chroma->done);
+	return output_rows;
+}
+
+template <typename ImageType>
+int CBM3D_WIE_SUB_T<ImageType>::next_line(ImageType *clean)
+{
+	PlaneOut<ImageType> out[3];
+	out[0] = PlaneOut<ImageType>(clean, orig_w);
+	out[1] = PlaneOut<ImageType>(clean + orig_w * orig_h, chroma->w);
+	out[2] = PlaneOut<ImageType>(clean + orig_w * orig_h + chroma->w * chroma->h, chroma->w);
+	return next_line_planes(out);
+}
+
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::load_source(RowSource<ImageType> *source, int sigmay, DistType max_mdist, int sigmau, int sigmav)
+{
+	noisy = PlaneView<ImageType>();
+	basic = PlaneView<ImageType>();
+}
+
+template <typename ImageType>
+int CBM3D_WIE_SUB_T<ImageType>::next_line_planes(const PlaneOut<ImageType> *out)
+{
+	if (basic.data == NULL) return -1;	// no frame is loaded
+	if (row_cnt >= orig_h + pstep - psize) return -1;	// beyond the last line of reference patches
+	double tline = trace_begin();
+
+	refx = swinrh;
+	matcher->start_line(basic, 0, row_cnt);
+
+	clock_t t;
+	int matched = 0;	// patches of the groups of the line
+	int nrefs = 0;		// reference patches of the line
+	// proceesing the line
+	for (int x = 0; x < orig_w + pstep - psize; x += pstep)
+	{
+		g3d_basic->thres = wie_thres[0];
+
+		t = clock();
+		perf.begin(PERF_STAGE_GROUPING);
+		grouping();
+		matched += g3d_basic->num;
+		nrefs++;
+		perf.end(PERF_STAGE_GROUPING);
+		gtime += clock() - t;
+
+		t = clock();
+		perf.begin(PERF_STAGE_FILTERING);
+		filtering();
+		perf.end(PERF_STAGE_FILTERING);
+		ftime += clock() - t;
+
+		t = clock();
+		perf.begin(PERF_STAGE_AGGREGATION);
+		aggregation();
+		perf.end(PERF_STAGE_AGGREGATION);
+		atime += clock() - t;
+
+		chroma_filtering();
+
+		refx += pstep;
+	}
+
+	// the U/V rows are written out as soon as they are completed, which may be not aligned with the Y rows
+	int next_row = row_cnt + pstep < orig_h + pstep - psize ? row_cnt + pstep : orig_h;
+	chroma->output(out + 1, next_row, (1 << bit_depth) - 1, shift);
+
+	// output the completed rows
+	int first_row = 0;
+	int output_rows;
+	int out_row = 0;	// image row of the first output row
+	if (row_cnt < swinrv) 
+	{
+		if (row_cnt + pstep <= swinrv) {
+			// no row is completed in the begining
+			output_rows = 0;
+		}
+		else {
+			output_rows = row_cnt + pstep - swinrv;
+			first_row = pstep - output_rows;
+		}
+	} 
+	else 
+	{
+		if (row_cnt >= orig_h - psize)
+			output_rows = orig_h - row_cnt + swinrv;	// the last line of reference patches
+		else
+			output_rows = pstep;
+		out_row = row_cnt - swinrv;
+	}
+
+	for (int r = 0; r < output_rows; r++)
+	{
+		ImageType *row = out[0].row(out_row + r);
+		const PatchType *numer = lbuf->numer_row(first_row + r) + swinrh;
+		const PatchType *denom = lbuf->denom_row(first_row + r) + swinrh;
+		normalize_row(&row, &numer, &denom, 1, orig_w, (1 << bit_depth) - 1, shift);
+	}
+
+	// discard the fisrt (pstep) rows of the numerator and denominator buffers
+	// and recycle them as (pstep) new rows at the end of the buffers
+	perf.begin(PERF_STAGE_SHIFT);
+	shift_numer_denom();
+	perf.end(PERF_STAGE_SHIFT);
+
+	trace_counter("group size", nrefs ? (double)matched / nrefs : 0);
+	trace_counter("output rows", output_rows);
+	trace_span("line", tline, row_cnt);
+
+	row_cnt += pstep;
+	return output_rows;
+}
+
+/* The chroma groups share the offsets of the luma group, and the U/V planes are filtered one by one.
+ * The chroma groups are small enough to be aggregated by a single thread.
+ */
+template <typename ImageType>
+void CBM3D_WIE_SUB_T<ImageType>::chroma_filtering()
+{
+	int rx = refx - swinrh;
+	chroma->map_patches(g3d_basic, g3d_uv_noisy, rx, row_cnt);
+	chroma->map_patches(g3d_basic, g3d_uv_basic, rx, row_cnt);
+
+	clock_t t;
+	for (int i = 0; i < 2; i++)
+	{
+		g3d_uv_basic->thres = wie_thres[i + 1];
+		for (int k = 0; k < chroma->parts(); k++)
+		{
+			t = clock();
+			perf.begin(PERF_STAGE_GROUPING);
+			g3d_uv_noisy->fill_patches_values(noisy_uv[i], chroma->ref_x(rx), chroma->ref_y(row_cnt, k));
+			g3d_uv_basic->fill_patches_values(basic_uv[i], chroma->ref_x(rx), chroma->ref_y(row_cnt, k));
+			perf.end(PERF_STAGE_GROUPING);
+			gtime += clock() - t;
+
+			t = clock();
+			perf.begin(PERF_STAGE_FILTERING);
+			filtering(g3d_uv_noisy, g3d_uv_basic);
+			perf.end(PERF_STAGE_FILTERING);
+			ftime += clock() - t;
+
+			t = clock();
+			perf.begin(PERF_STAGE_AGGREGATION);
+			g3d_uv_noisy->set_aggregation_weight(Kaiser4x4, get_weight(g3d_uv_noisy));
+			chroma->aggregate(g3d_uv_noisy, i, rx, row_cnt, k);
+			perf.end(PERF_STAGE_AGGREGATION);
+			atime += clock() - t;
+		}
+	}
+}
+
+template class CBM3D_WIE_SUB_T<uint8_t>;
+template class CBM3D_WIE_SUB_T<uint16_t>;
@@ -0,0 +1,95 @@
+#include <iostream>
+#include "chroma_lines.h"
+#include "kernels.h"
+
+ChromaLines::ChromaLines(int format, int luma_w, int luma_h_, int luma_psize, int lbuf_w, int swinrh, int swinrv_)
+	: luma_h(luma_h_), swinrv(swinrv_)
+{
+	sub_y = format == CHROMA_FORMAT_420 ? 1 : 0;
+	w = luma_w >> 1;
+	h = luma_h >> sub_y;
+	psize = luma_psize >> 1;
+
+	// the chroma patches mapped from the search window of the luma reference patch
+	pad = (swinrh + 1) >> 1;
+	int rows = ((2 * swinrv + luma_psize) >> sub_y) + sub_y;
+	for (int i = 0; i < 2; i++)
+	{
+		lbuf[i] = new LineBuffer((lbuf_w + 1) / 2 + 1, rows);
+	}
+	reset();
+}
+
+ChromaLines::~ChromaLines()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		delete lbuf[i];
+	}
+}
+
+void ChromaLines::reset()
+{
+	top = (0 - swinrv) >> sub_y;
+	done = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		lbuf[i]->reset();
+	}
+}
+
+/* The luma offsets are mapped with the absolute positions rather than halved directly, 
+ * so that a luma patch at an odd column (or row for 4:2:0) is mapped to the same chroma patch 
+ * whichever the reference patch is.
+ */
+void ChromaLines::map_patches(const Group3D *luma, Group3D *chroma, int rx, int ry)
+{
+	chroma->num = luma->num;
+	for (int p = 0; p < luma->num; p++)
+	{
+		const Patch2D *lp = luma->patch[p];
+		chroma->patch[p]->update(((rx + lp->x) >> 1) - (rx >> 1), ((ry + lp->y) >> sub_y) - (ry >> sub_y), lp->dist);
+	}
+}
+
+void ChromaLines::aggregate(Group3D *chroma, int i, int rx, int ry, int k)
+{
+	chroma->aggregate(lbuf[i], ref_x(rx) + pad, ref_y(ry, k) - top);
+}
+
+template <typename ImageType>
+int ChromaLines::output(const PlaneOut<ImageType> *out, int next_row, int vmax, int shift)
+{
+	int next_top = next_row < luma_h ? (next_row - swinrv) >> sub_y : h;
+	int first = top > 0 ? top : 0;
+	int last  = next_top < h ? next_top : h;
+
+	for (int y = first; y < last; y++)
+	{
+		ImageType *rows[2];
+		const PatchType *numer[2];
+		const PatchType *denom[2];
+		for (int i = 0; i < 2; i++)
+		{
+			rows[i]  = out[i].row(y);
+			numer[i] = lbuf[i]->numer_row(y - top) + pad;
+			denom[i] = lbuf[i]->denom_row(y - top) + pad;
+		}
+		normalize_row(rows, numer, denom, 2, w, vmax, shift);
+	}
+
+	// no more rows are needed after the last line
+	if (next_row < luma_h)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			lbuf[i]->shift(next_top - top);
+		}
+		top = next_top;
+	}
+	if (last > first) done = last;
+	return last > first ? last - first : 0;
+}
+
+template int ChromaLines::output(const PlaneOut<uint8_t>  *, int, int, int);
+template int ChromaLines::output(const PlaneOut<uint16_t> *, int, int, int);
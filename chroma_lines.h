@@ -0,0 +1,72 @@
+#ifndef __CHROMA_LINES_H__
+#define __CHROMA_LINES_H__
+
+#include <iostream>
+#include "global_define.h"
+#include "group_3d.h"
+#include "line_buffer.h"
+#include "plane_view.h"
+
+/* Line buffers and patch mapping of the subsampled U/V planes, i.e. YUV 4:2:0 or 4:2:2.
+ * The block-matching runs on the Y plane only, and each matched 8x8 luma patch at (x, y) is mapped
+ * to the 4x4 chroma patch at (x >> 1, y >> 1) for 4:2:0, or the 4x8 one at (x >> 1, y) for 4:2:2, 
+ * which is filtered as two stacked 4x4 patches.
+ * The filtered chroma patches are aggregated into the line buffers of the U/V planes, which are half the size of the luma ones.
+ * As a luma step of the reference lines is not always a whole chroma step for 4:2:0, 
+ * the rows of the U/V planes are written out once they are no longer touched by the next line of reference patches.
+ * Note that the width (and height for 4:2:0) of the Y plane must be even.
+ */
+struct ChromaLines
+{
+	int sub_y;				// vertical subsampling, 1 for YUV 4:2:0 and 0 for 4:2:2
+	int w;					// width of the U/V planes
+	int h;					// height of the U/V planes
+	int psize;				// chroma patch size, half of the luma one
+	int luma_h;				// height of the Y plane
+	int swinrv;				// vertical search window radius of the luma plane
+
+	int pad;				// columns of the line buffers left to the U/V planes
+	int top;				// row of the U/V planes of the first row of the line buffers
+	int done;				// rows of the U/V planes written out
+	LineBuffer *lbuf[2];	// numerator and denominator line buffers of the U/V planes
+
+	ChromaLines(
+		int format,			// CHROMA_FORMAT_420 or CHROMA_FORMAT_422
+		int luma_w,			// width of the Y plane
+		int luma_h,			// height of the Y plane
+		int luma_psize,		// luma patch size
+		int lbuf_w,			// width of the luma line buffers
+		int swinrh,			// horizontal search window radius of the luma plane
+		int swinrv_			// vertical search window radius of the luma plane
+	);
+	~ChromaLines();
+
+	// clear the buffers for a new image
+	void reset();
+
+	// number of the stacked 4x4 patches of a chroma patch, 1 for 4:2:0 and 2 for 4:2:2
+	int parts() const { return 1 << (1 - sub_y); }
+
+	// map the offsets of the luma group, whose reference patch is at (rx, ry) of the Y plane, onto the chroma group
+	void map_patches(const Group3D *luma, Group3D *chroma, int rx, int ry);
+
+	// column and row of the (k)th stacked part of the chroma reference patch, mapped from the luma one at (rx, ry)
+	int ref_x(int rx) const { return rx >> 1; }
+	int ref_y(int ry, int k) const { return (ry >> sub_y) + k * psize; }
+
+	// aggregate the filtered chroma group into the line buffers of the plane (i)
+	void aggregate(Group3D *chroma, int i, int rx, int ry, int k);
+
+	/* Write out the rows of the U/V planes which are no longer touched by the reference patches from the luma row (next_row),
+	 * and recycle them as the new rows at the end of the buffers. Returns the number of the rows written out.
+	 */
+	template <typename ImageType>
+	int output(
+		const PlaneOut<ImageType> *out,	// output U/V planes
+		int next_row,			// first row of the next line of luma reference patches, luma_h if no more lines
+		int vmax,				// maximum output value
+		int shift				// left shift of the output values
+	);
+};
+
+#endif
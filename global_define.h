@@ -7,28 +7,116 @@
 #include <string.h>
 #include <stdlib.h>
 
-typedef uint8_t ImageType;				// data-type of the input/ouput image (up to 12 bits for integer version)
-typedef uint32_t DistType;				// data-type of the distance between two patches
+typedef uint64_t DistType;				// data-type of the distance between two patches, enough for any bit depth
+
+/* Data-types relative to the sample type (ImageType) of the input/output image, i.e. uint8_t or uint16_t.
+ * The engines are templates of the sample type, and both the 8-bit and 16-bit ones are instantiated.
+ * The bit depth of the 16-bit engines is selected at runtime (9 to 16 bits).
+ * AccType is used to accumulate the distances in the block-matching, which is relative to the bit depth 
+ * to avoid overflow, e.g. at most 64 * 65535^2 for an 8x8 patch of 16-bit samples with the L2 distance.
+ */
+template <typename ImageType> struct SampleTraits;
+
+template <> struct SampleTraits<uint8_t>
+{
+	typedef uint32_t AccType;
+	static const int max_depth = 8;
+};
+
+template <> struct SampleTraits<uint16_t>
+{
+	typedef uint64_t AccType;
+	static const int max_depth = 16;
+};
+
+#define MAX_MDIST_DEPTH			8		// bit depth of the given maximum mean distance, scaled to the image bit depth
+
+#define CHROMA_FORMAT_420		0		// U/V planes of half width and half height
+#define CHROMA_FORMAT_422		1		// U/V planes of half width and full height
+
+#define FRAME_FORMAT_NV12		0		// Y plane and an interleaved U/V plane (YUV 4:2:0)
+#define FRAME_FORMAT_NV21		1		// Y plane and an interleaved V/U plane (YUV 4:2:0)
+#define FRAME_FORMAT_RGB		2		// packed R/G/B pixels, denoised as YCbCr 4:4:4
+#define FRAME_FORMAT_BGR		3		// packed B/G/R pixels, denoised as YCbCr 4:4:4
+
+#define CHROMA_MODE_FULL		0		// the U/V groups are filtered as the Y ones
+#define CHROMA_MODE_REDUCED		1		// flat U/V bands are replaced by the group means, and the others are filtered sparsely
 
 #define USE_INTEGER				1		// use integer or floating-point version
 #define USE_L2_DIST				1		// use L2 (square) or L1 (absolute) distance
+#define MATCH_TILE_BYTES		(16 * 1024)	// the search windows whose distance buffers exceed it, including the default one, are matched by tiles of rows fitting in it
+#define MATCH_TILE_REFS			64		// reference patches of a line matched by a tile at once
+
+#define SEARCH_MODE_WINDOW		0		// exhaustive block-matching in the search window
+#define SEARCH_MODE_INDEX		1		// approximate nearest neighbours of the whole width of the band (patch_index.h)
+#define INDEX_BLOCK_ROWS		8		// candidate rows indexed by a k-d tree
+#define INDEX_LEAF_SIZE			8		// maximum candidates of a leaf of the k-d trees
+#define INDEX_MAX_LEAVES		16		// leaves of a k-d tree visited by a query
+#define INDEX_CANDIDATES_MUL	2		// candidates ranked by the exact distances, a multiple of the maximum similar patches
 
 #define HARD_THRES_MULTIPLIER	2.7f	// multiply by the sigma is the threshold of the hard filtering 
+#define WIENER_WEIGHT_BITS		16		// decimal bits of the fixed-point sum of the Wiener weights of a group
+#define FLAT_VAR_RATIO			-0.2f	// a noisy reference patch whose variance exceeds that of its noise by less than this ratio is flat, -1 to disable
+#define FLAT_VAR_RATIO_WIE		0.01f	// a basic reference patch of the step2 whose variance is below this ratio of sigma^2 is flat, 0 to disable
+#define FLAT_BAND_RATIO			0.05f	// a U/V band whose variance exceeds that of its noise by less than this ratio is flat (CHROMA_MODE_REDUCED)
+
+/* The AVX2/AVX-512 kernels are compiled besides the baseline ones (SSE2 on x86-64) by the target attributes,
+ * and selected at runtime by the CPU features probed once at startup, so that a single binary runs the best kernels of each host.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define USE_CPU_DISPATCH		1
+#define TARGET_AVX2				__attribute__((target("avx2")))
+#define TARGET_AVX512			__attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define USE_CPU_DISPATCH		0
+#endif
+
+#define CPU_LEVEL_BASE			0		// baseline kernels of the build
+#define CPU_LEVEL_AVX2			1		// AVX2 kernels
+#define CPU_LEVEL_AVX512		2		// AVX-512 (F and BW) kernels
 
 #define USE_THREADS_NUM			4		// number of CPU threads can be used in the grouping step
+#define CHANNEL_PARALLEL		1		// filter and aggregate the Y/U/V groups of the CBM3D/CBM3D_WIE concurrently
+#define USE_PERF_COUNTERS		0		// count the hardware events of each stage by perf_event_open (Linux only), reported by run()
+#define USE_TRACE				0		// record the timeline of the lines, the stages and the thread tasks (trace.h)
 
 #if USE_INTEGER
 
 #define COEFF_DICI_BITS			1		// decimal bits of the interger coefficients (according to the transform implementation)
-typedef int32_t PatchType;				// int32_t is enough for the intermediate results
+#define PATCH_MAX_DEPTH			12		// higher bit depth is shifted to 12 bits in the transform domain
+typedef int32_t PatchType;				// int32_t is enough for the intermediate results of 12-bit samples
 
 #else
 
 #define COEFF_DICI_BITS			0
+#define PATCH_MAX_DEPTH			16
 typedef float PatchType;
 
 #endif
 
+/* Thresholds relative to the sigma (in the unit of the input samples) for the shifted samples */
+static inline PatchType hard_thres(int sigma, int shift)
+{
+	return (PatchType)(HARD_THRES_MULTIPLIER * sigma / (1 << shift)) * (1 << COEFF_DICI_BITS);
+}
+
+static inline PatchType wiener_thres(int sigma, int shift)
+{
+	float s = (float)sigma / (1 << shift);
+	return (PatchType)(s * s * (1 << (COEFF_DICI_BITS * 2)));
+}
+
+/* The maximum mean distance is given for 8-bit samples, and scaled to the bit depth of the image */
+static inline DistType scale_mdist(DistType max_mdist, int bit_depth)
+{
+#if USE_L2_DIST
+	int bits = 2 * (bit_depth - MAX_MDIST_DEPTH);
+#else
+	int bits = bit_depth - MAX_MDIST_DEPTH;
+#endif
+	return bits >= 0 ? max_mdist << bits : max_mdist >> -bits;
+}
+
 
 #endif
 
@@ -1,10 +1,11 @@
 #include <iostream>
 #include "group_3d.h"
+#include "kernels.h"
 
 const PatchType Group3D::sqrt_powN_x32[8] = {32, 45, 64, 90, 128, 180, 256, 360};
 
 Group3D::Group3D(int w_, int h_, int maxp)
-	: w(w_), h(h_), max_patches(maxp)
+	: w(w_), h(h_), max_patches(maxp), shift(0), wie_wgt_sum(0)
 {
 	patch = new Patch2D *[max_patches];
 	buf   = new Patch2D *[max_patches];
@@ -12,6 +13,7 @@ Group3D::Group3D(int w_, int h_, int maxp)
 	{
 		patch[i] = new Patch2D(w, h);
 	}
+	kw = new PatchType[w * h];
 }
 
 Group3D::~Group3D()
@@ -22,14 +24,16 @@ Group3D::~Group3D()
 	}
 	delete[] patch;
 	delete[] buf;
+	delete[] kw;
 }
 
 void Group3D::set_thresholds(int sigma, DistType maxd)
 {
 	max_dist = maxd;
-	thres = (PatchType)(HARD_THRES_MULTIPLIER * sigma) * (1 << COEFF_DICI_BITS);
+	thres = hard_thres(sigma, shift);
 }
 
+template <typename ImageType>
 void Group3D::set_reference(ImageType *refer, int stride)
 {
 	patch[0]->update(refer, 0, 0, 0, stride);
@@ -76,7 +80,17 @@ void Group3D::insert_patch(int x, int y, DistType d)
 	num++;
 }
 
-void Group3D::fill_patches_values(ImageType *refer, int stride)
+void Group3D::copy_matches(const Group3D *src)
+{
+	num = src->num;
+	for (int p = 0; p < num; p++)
+	{
+		patch[p]->update(src->patch[p]->x, src->patch[p]->y, src->patch[p]->dist);
+	}
+}
+
+template <typename ImageType>
+void Group3D::fill_patches_values(const PlaneView<ImageType> &image, int rx, int ry)
 {
 	// truncate the number of patches to power of 2
 	log_num = 0;
@@ -88,10 +102,15 @@ void Group3D::fill_patches_values(ImageType *refer, int stride)
 
 	for (int p = 0; p < num; p++)
 	{
-		patch[p]->update(refer, stride);
+		patch[p]->update(image, rx, ry, shift);
 	}
 }
 
+template void Group3D::set_reference(uint8_t  *, int);
+template void Group3D::set_reference(uint16_t *, int);
+template void Group3D::fill_patches_values(const PlaneView<uint8_t>  &, int, int);
+template void Group3D::fill_patches_values(const PlaneView<uint16_t> &, int, int);
+
 void Group3D::transform_3d()
 {
 	for (int p = 0; p < num; p++) 
@@ -131,14 +150,36 @@ void Group3D::hard_thresholding()
 	PatchType tmp_thres = thres * sqrt_powN_x32[log_num] / 32;
 	for (int p = 0; p < num; p++)
 	{
-		for (int i = 0; i < w*h; i++)
-		{
-			if (patch[p]->values[i] >= tmp_thres || patch[p]->values[i] <= -tmp_thres)
-				nonzeros++;
-			else
-				patch[p]->values[i] = 0;
-		}
+		nonzeros += threshold_row(patch[p]->values, w*h, tmp_thres);
+	}
+}
+
+/* The fast path of the flat groups, whose coefficients except the DC one would be all thresholded, 
+ * so that the 3D transform and its inverse are skipped.
+ */
+void Group3D::mean_filtering()
+{
+	int n = w * h;
+#if USE_INTEGER
+	int64_t sum = 0;
+	for (int p = 0; p < num; p++)
+	{
+		for (int i = 0; i < n; i++) sum += patch[p]->values[i];
 	}
+	PatchType mean = (PatchType)((sum + n * num / 2) / (n * num));
+#else
+	double sum = 0;
+	for (int p = 0; p < num; p++)
+	{
+		for (int i = 0; i < n; i++) sum += patch[p]->values[i];
+	}
+	PatchType mean = (PatchType)(sum / (n * num));
+#endif
+	for (int p = 0; p < num; p++)
+	{
+		for (int i = 0; i < n; i++) patch[p]->values[i] = mean;
+	}
+	nonzeros = 1;
 }
 
 /* Get the weight of the 3D group.
@@ -156,6 +197,50 @@ PatchType Group3D::get_weight()
 #endif
 }
 
+void Group3D::set_aggregation_weight(const PatchType *kaiser, PatchType weight)
+{
+	for (int i = 0; i < w*h; i++)
+	{
+		kw[i] = kaiser[i] * weight;
+	}
+}
+
+/* Aggregate the filtered patches into the numerator/denominator line buffers, 
+ * where the (refx, refy) is the top-left of the reference patch in the line buffers.
+ */
+void Group3D::aggregate(LineBuffer *lbuf, int refx, int refy)
+{
+	if (lbuf->denominator == NULL)
+	{
+		aggregate_numer(lbuf, refx, refy);
+		return;
+	}
+
+	for (int p = 0; p < num; p++)
+	{
+		int x = refx + patch[p]->x;
+		for (int i = 0, r = 0; r < h; r++, i += w)
+		{
+			int row = refy + patch[p]->y + r;
+			aggregate_row(lbuf->numer_row(row) + x, lbuf->denom_row(row) + x, patch[p]->values + i, kw + i, w);
+		}
+	}
+}
+
+// the denominator is shared with the line buffer of another channel
+void Group3D::aggregate_numer(LineBuffer *lbuf, int refx, int refy)
+{
+	for (int p = 0; p < num; p++)
+	{
+		int x = refx + patch[p]->x;
+		for (int i = 0, r = 0; r < h; r++, i += w)
+		{
+			int row = refy + patch[p]->y + r;
+			aggregate_numer_row(lbuf->numer_row(row) + x, patch[p]->values + i, kw + i, w);
+		}
+	}
+}
+
 /* Inplace implementation of 1D Hadamard transform for the 3D group.
  * The length of the 1D transform is (this->num), 
  * and there are totally (w * h) transforms that one for each pixel location independently.
@@ -169,7 +254,6 @@ PatchType Group3D::get_weight()
  */
 void Group3D::hadamard_1d()
 {
-	PatchType tmp;
 	for (int n = 0; n < log_num; n++)
 	{
 		for (int p = 0; p < num / 2; p++)
@@ -179,12 +263,7 @@ void Group3D::hadamard_1d()
 		}
 		for (int p = 0; p < num; p += 2)
 		{
-			for (int i = 0; i < w*h; i++)
-			{
-				tmp = patch[p]->values[i] - patch[p + 1]->values[i];
-				patch[p]->values[i] = patch[p]->values[i] + patch[p + 1]->values[i];
-				patch[p + 1]->values[i] = tmp;
-			}
+			butterfly_row(patch[p]->values, patch[p + 1]->values, w*h);
 		}
 		for (int p = 0; p < num; p++)
 		{
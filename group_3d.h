@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include "patch_2d.h"
+#include "line_buffer.h"
 
 struct Group3D
 {
@@ -16,18 +17,24 @@ struct Group3D
 	DistType max_dist;	// maximum sum of distances (L2/L1) between two patches
 
 	PatchType thres;	// hard threshold of the filtering
+	int shift;			// right shift of the samples to fit the precision of the PatchType
 	int nonzeros;		// number of nonzero coefficients
+	int wie_wgt_sum;	// sum of the Wiener weights of the last filtering, in fixed-point (WIENER_WEIGHT_BITS)
 
 	Patch2D **patch;	// array of pointers of 2D patches
 	Patch2D **buf;		// array of pointers used as buffer (in Hadamard transform)
 
+	PatchType *kw;		// Kaiser window multiplied by the weight of the group
+
 	static const PatchType sqrt_powN_x32[8];	// integer of (sqrt(1<<n) * 32)
 
 	Group3D(int w_, int h_, int maxp);
 	~Group3D();
 
+	// the sigma is relative to the bit depth of the samples
 	void set_thresholds(int sigma, DistType maxd);
 
+	template <typename ImageType>
 	void set_reference(ImageType *refer, int stride);
 	void set_reference();
 
@@ -35,7 +42,12 @@ struct Group3D
 	int find_idx(DistType d);
 
 	void insert_patch(int x, int y, DistType d);
-	void fill_patches_values(ImageType *refer, int stride);
+
+	// share the matched patches of another group, e.g. the Y group for the U/V ones
+	void copy_matches(const Group3D *src);
+
+	template <typename ImageType>
+	void fill_patches_values(const PlaneView<ImageType> &image, int rx, int ry);
 
 	// forward and backward are the same except the scaling
 	void hadamard_1d();
@@ -45,7 +57,17 @@ struct Group3D
 
 	void hard_thresholding();
 
+	// replace the patches by the mean of the group, i.e. only the DC coefficient of the 3D transform is kept
+	void mean_filtering();
+
 	PatchType get_weight();
+
+	// multiply the Kaiser window by the group weight, once per group
+	void set_aggregation_weight(const PatchType *kaiser, PatchType weight);
+
+	// aggregate all the patches into the line buffers
+	void aggregate(LineBuffer *lbuf, int refx, int refy);
+	void aggregate_numer(LineBuffer *lbuf, int refx, int refy);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,959 @@
+#include <iostream>
+#include "kernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2_KERNELS		1
+#else
+#define USE_SSE2_KERNELS		0
+#endif
+
+#if USE_SSE2_KERNELS && USE_INTEGER
+/* low 32 bits of the products of packed 32-bit integers, i.e. _mm_mullo_epi32 of SSE4.1 */
+static inline __m128i mullo_epi32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+							  _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+#if USE_CPU_DISPATCH
+#include <immintrin.h>
+
+// half (h) of a 512-bit vector, by the zero-masked extract rather than the cast and the extract,
+// as the unmasked intrinsics are built on the undefined vectors and warn with -Wmaybe-uninitialized (GCC 12),
+// so are the unmasked widenings, which are zero-masked by the lanes of the candidates below
+#define HALF_256(v, h)			_mm512_maskz_extracti64x4_epi64(0xF, v, h)
+
+static int detect_cpu_level()
+{
+	__builtin_cpu_init();
+	int level = CPU_LEVEL_BASE;
+	if (__builtin_cpu_supports("avx2"))
+	{
+		level = CPU_LEVEL_AVX2;
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+			level = CPU_LEVEL_AVX512;
+	}
+
+	const char *env = getenv("BM3D_CPU_LEVEL");
+	if (env != NULL && atoi(env) < level)
+		level = atoi(env) > CPU_LEVEL_BASE ? atoi(env) : CPU_LEVEL_BASE;
+	return level;
+}
+#else
+static int detect_cpu_level()
+{
+	return CPU_LEVEL_BASE;
+}
+#endif
+
+// the kernels called by the static constructors (before the probing) run the baseline ones, as CPU_LEVEL_BASE is zero
+static const int host_cpu_level = detect_cpu_level();
+
+int cpu_level()
+{
+	return host_cpu_level;
+}
+
+#if USE_CPU_DISPATCH
+TARGET_AVX2 static void aggregate_row_avx2(PatchType *numer, PatchType *denom, const PatchType *values, const PatchType *kw, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+#if USE_INTEGER
+		__m256i k = _mm256_loadu_si256((const __m256i *)(kw + i));
+		__m256i v = _mm256_mullo_epi32(k, _mm256_loadu_si256((const __m256i *)(values + i)));
+		_mm256_storeu_si256((__m256i *)(numer + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(numer + i)), v));
+		_mm256_storeu_si256((__m256i *)(denom + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(denom + i)), k));
+#else
+		__m256 k = _mm256_loadu_ps(kw + i);
+		__m256 v = _mm256_mul_ps(k, _mm256_loadu_ps(values + i));
+		_mm256_storeu_ps(numer + i, _mm256_add_ps(_mm256_loadu_ps(numer + i), v));
+		_mm256_storeu_ps(denom + i, _mm256_add_ps(_mm256_loadu_ps(denom + i), k));
+#endif
+	}
+	// the rows of the 4x4 chroma patches
+	for (; i + 4 <= n; i += 4)
+	{
+#if USE_INTEGER
+		__m128i k = _mm_loadu_si128((const __m128i *)(kw + i));
+		__m128i v = _mm_mullo_epi32(k, _mm_loadu_si128((const __m128i *)(values + i)));
+		_mm_storeu_si128((__m128i *)(numer + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(numer + i)), v));
+		_mm_storeu_si128((__m128i *)(denom + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(denom + i)), k));
+#else
+		__m128 k = _mm_loadu_ps(kw + i);
+		__m128 v = _mm_mul_ps(k, _mm_loadu_ps(values + i));
+		_mm_storeu_ps(numer + i, _mm_add_ps(_mm_loadu_ps(numer + i), v));
+		_mm_storeu_ps(denom + i, _mm_add_ps(_mm_loadu_ps(denom + i), k));
+#endif
+	}
+	for (; i < n; i++)
+	{
+		numer[i] += kw[i] * values[i];
+		denom[i] += kw[i];
+	}
+}
+
+TARGET_AVX2 static void aggregate_numer_row_avx2(PatchType *numer, const PatchType *values, const PatchType *kw, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+#if USE_INTEGER
+		__m256i v = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(kw + i)), _mm256_loadu_si256((const __m256i *)(values + i)));
+		_mm256_storeu_si256((__m256i *)(numer + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(numer + i)), v));
+#else
+		__m256 v = _mm256_mul_ps(_mm256_loadu_ps(kw + i), _mm256_loadu_ps(values + i));
+		_mm256_storeu_ps(numer + i, _mm256_add_ps(_mm256_loadu_ps(numer + i), v));
+#endif
+	}
+	for (; i < n; i++)
+	{
+		numer[i] += kw[i] * values[i];
+	}
+}
+#endif
+
+void aggregate_row(PatchType *numer, PatchType *denom, const PatchType *values, const PatchType *kw, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		aggregate_row_avx2(numer, denom, values, kw, n);
+		return;
+	}
+#endif
+
+	int i = 0;
+#if USE_SSE2_KERNELS
+	for (; i + 4 <= n; i += 4)
+	{
+#if USE_INTEGER
+		__m128i k = _mm_loadu_si128((const __m128i *)(kw + i));
+		__m128i v = mullo_epi32(k, _mm_loadu_si128((const __m128i *)(values + i)));
+		_mm_storeu_si128((__m128i *)(numer + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(numer + i)), v));
+		_mm_storeu_si128((__m128i *)(denom + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(denom + i)), k));
+#else
+		__m128 k = _mm_loadu_ps(kw + i);
+		__m128 v = _mm_mul_ps(k, _mm_loadu_ps(values + i));
+		_mm_storeu_ps(numer + i, _mm_add_ps(_mm_loadu_ps(numer + i), v));
+		_mm_storeu_ps(denom + i, _mm_add_ps(_mm_loadu_ps(denom + i), k));
+#endif
+	}
+#endif
+	for (; i < n; i++)
+	{
+		numer[i] += kw[i] * values[i];
+		denom[i] += kw[i];
+	}
+}
+
+void aggregate_numer_row(PatchType *numer, const PatchType *values, const PatchType *kw, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		aggregate_numer_row_avx2(numer, values, kw, n);
+		return;
+	}
+#endif
+
+	int i = 0;
+#if USE_SSE2_KERNELS
+	for (; i + 4 <= n; i += 4)
+	{
+#if USE_INTEGER
+		__m128i v = mullo_epi32(_mm_loadu_si128((const __m128i *)(kw + i)), _mm_loadu_si128((const __m128i *)(values + i)));
+		_mm_storeu_si128((__m128i *)(numer + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(numer + i)), v));
+#else
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(kw + i), _mm_loadu_ps(values + i));
+		_mm_storeu_ps(numer + i, _mm_add_ps(_mm_loadu_ps(numer + i), v));
+#endif
+	}
+#endif
+	for (; i < n; i++)
+	{
+		numer[i] += kw[i] * values[i];
+	}
+}
+
+template <typename AccType>
+static inline AccType get_dist(int a, int b)
+{
+	int diff = a - b;
+#if USE_L2_DIST
+	return (AccType)diff * diff;
+#else
+	return diff >= 0 ? diff : -diff;
+#endif
+}
+
+#if USE_CPU_DISPATCH
+TARGET_AVX2 static void accumulate_dist_row_avx2(uint32_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+	int i = 0;
+#if USE_L2_DIST
+	const __m256i r = _mm256_set1_epi16(ref);
+#else
+	const __m128i r = _mm_set1_epi8((char)ref);
+#endif
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *)(cand + i));
+#if USE_L2_DIST
+		// the square of a 8-bit difference fits the unsigned 16-bit lane
+		__m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(c), r);
+		d = _mm256_mullo_epi16(d, d);
+		__m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d));
+		__m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1));
+#else
+		__m128i d  = _mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c));
+		__m256i lo = _mm256_cvtepu8_epi32(d);
+		__m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(d, 8));
+#endif
+		__m256i *a = (__m256i *)(acc + i);
+		_mm256_storeu_si256(a + 0, _mm256_add_epi32(_mm256_loadu_si256(a + 0), lo));
+		_mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), hi));
+	}
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint32_t>(ref, cand[i]);
+	}
+}
+
+/* The last candidates are masked, so that there is no scalar loop, e.g. 33 candidates of a 16-pixel search radius. */
+TARGET_AVX512 static void accumulate_dist_row_avx512(uint32_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+	const __m512i r = _mm512_set1_epi16(ref);
+	for (int i = 0; i < n; i += 32)
+	{
+		int m = n - i < 32 ? n - i : 32;
+		__mmask64 k = ((__mmask64)1 << m) - 1;
+		__mmask16 klo = (__mmask16)k;
+		__mmask16 khi = (__mmask16)(k >> 16);
+		__m512i d = _mm512_sub_epi16(_mm512_cvtepu8_epi16(HALF_256(_mm512_maskz_loadu_epi8(k, cand + i), 0)), r);
+#if USE_L2_DIST
+		d = _mm512_mullo_epi16(d, d);
+#else
+		d = _mm512_abs_epi16(d);
+#endif
+		__m512i lo = _mm512_maskz_cvtepu16_epi32(klo, HALF_256(d, 0));
+		__m512i hi = _mm512_maskz_cvtepu16_epi32(khi, HALF_256(d, 1));
+		_mm512_mask_storeu_epi32(acc + i,      klo, _mm512_add_epi32(_mm512_maskz_loadu_epi32(klo, acc + i), lo));
+		_mm512_mask_storeu_epi32(acc + i + 16, khi, _mm512_add_epi32(_mm512_maskz_loadu_epi32(khi, acc + i + 16), hi));
+	}
+}
+#endif
+
+void accumulate_dist_row(uint32_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX512)
+	{
+		accumulate_dist_row_avx512(acc, cand, ref, n);
+		return;
+	}
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		accumulate_dist_row_avx2(acc, cand, ref, n);
+		return;
+	}
+#endif
+
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128i zero = _mm_setzero_si128();
+#if USE_L2_DIST
+	const __m128i r = _mm_set1_epi16(ref);
+#else
+	const __m128i r = _mm_set1_epi8((char)ref);
+#endif
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *)(cand + i));
+#if USE_L2_DIST
+		// the square of a 8-bit difference fits the unsigned 16-bit lane
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), r);
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(c, zero), r);
+		lo = _mm_mullo_epi16(lo, lo);
+		hi = _mm_mullo_epi16(hi, hi);
+#else
+		__m128i d  = _mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c));
+		__m128i lo = _mm_unpacklo_epi8(d, zero);
+		__m128i hi = _mm_unpackhi_epi8(d, zero);
+#endif
+		__m128i *a = (__m128i *)(acc + i);
+		_mm_storeu_si128(a + 0, _mm_add_epi32(_mm_loadu_si128(a + 0), _mm_unpacklo_epi16(lo, zero)));
+		_mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, zero)));
+		_mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_unpacklo_epi16(hi, zero)));
+		_mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_unpackhi_epi16(hi, zero)));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint32_t>(ref, cand[i]);
+	}
+}
+
+#if USE_CPU_DISPATCH
+TARGET_AVX2 static void accumulate_dist_row_avx2(uint16_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+	int i = 0;
+#if USE_L2_DIST
+	const __m256i r = _mm256_set1_epi16(ref);
+#else
+	const __m128i r = _mm_set1_epi8((char)ref);
+#endif
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *)(cand + i));
+#if USE_L2_DIST
+		__m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(c), r);
+		d = _mm256_mullo_epi16(d, d);
+#else
+		__m256i d = _mm256_cvtepu8_epi16(_mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c)));
+#endif
+		__m256i *a = (__m256i *)(acc + i);
+		_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), d));
+	}
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint16_t>(ref, cand[i]);
+	}
+}
+#endif
+
+void accumulate_dist_row(uint16_t *acc, const uint8_t *cand, uint8_t ref, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		accumulate_dist_row_avx2(acc, cand, ref, n);
+		return;
+	}
+#endif
+
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128i zero = _mm_setzero_si128();
+#if USE_L2_DIST
+	const __m128i r = _mm_set1_epi16(ref);
+#else
+	const __m128i r = _mm_set1_epi8((char)ref);
+#endif
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i *)(cand + i));
+#if USE_L2_DIST
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), r);
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(c, zero), r);
+		lo = _mm_mullo_epi16(lo, lo);
+		hi = _mm_mullo_epi16(hi, hi);
+#else
+		__m128i d  = _mm_or_si128(_mm_subs_epu8(c, r), _mm_subs_epu8(r, c));
+		__m128i lo = _mm_unpacklo_epi8(d, zero);
+		__m128i hi = _mm_unpackhi_epi8(d, zero);
+#endif
+		__m128i *a = (__m128i *)(acc + i);
+		_mm_storeu_si128(a + 0, _mm_add_epi16(_mm_loadu_si128(a + 0), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), hi));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint16_t>(ref, cand[i]);
+	}
+}
+
+#if USE_CPU_DISPATCH
+TARGET_AVX2 static void accumulate_dist_row_avx2(uint64_t *acc, const uint16_t *cand, uint16_t ref, int n)
+{
+	int i = 0;
+	const __m256i r = _mm256_set1_epi32(ref);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i d = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(cand + i))), r);
+		d = _mm256_abs_epi32(d);	// absolute differences, up to 16 bits
+		__m256i lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(d));
+		__m256i hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(d, 1));
+#if USE_L2_DIST
+		lo = _mm256_mul_epu32(lo, lo);
+		hi = _mm256_mul_epu32(hi, hi);
+#endif
+		__m256i *a = (__m256i *)(acc + i);
+		_mm256_storeu_si256(a + 0, _mm256_add_epi64(_mm256_loadu_si256(a + 0), lo));
+		_mm256_storeu_si256(a + 1, _mm256_add_epi64(_mm256_loadu_si256(a + 1), hi));
+	}
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint64_t>(ref, cand[i]);
+	}
+}
+
+TARGET_AVX512 static void accumulate_dist_row_avx512(uint64_t *acc, const uint16_t *cand, uint16_t ref, int n)
+{
+	const __m512i r = _mm512_set1_epi32(ref);
+	for (int i = 0; i < n; i += 16)
+	{
+		int m = n - i < 16 ? n - i : 16;
+		__mmask32 k = ((__mmask32)1 << m) - 1;
+		__mmask8 klo = (__mmask8)k;
+		__mmask8 khi = (__mmask8)(k >> 8);
+		__m512i d = _mm512_sub_epi32(_mm512_maskz_cvtepu16_epi32((__mmask16)k, HALF_256(_mm512_maskz_loadu_epi16(k, cand + i), 0)), r);
+		d = _mm512_maskz_abs_epi32((__mmask16)k, d);
+		__m512i lo = _mm512_maskz_cvtepu32_epi64(klo, HALF_256(d, 0));
+		__m512i hi = _mm512_maskz_cvtepu32_epi64(khi, HALF_256(d, 1));
+#if USE_L2_DIST
+		lo = _mm512_maskz_mul_epu32(klo, lo, lo);
+		hi = _mm512_maskz_mul_epu32(khi, hi, hi);
+#endif
+		_mm512_mask_storeu_epi64(acc + i,     klo, _mm512_add_epi64(_mm512_maskz_loadu_epi64(klo, acc + i), lo));
+		_mm512_mask_storeu_epi64(acc + i + 8, khi, _mm512_add_epi64(_mm512_maskz_loadu_epi64(khi, acc + i + 8), hi));
+	}
+}
+#endif
+
+void accumulate_dist_row(uint64_t *acc, const uint16_t *cand, uint16_t ref, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX512)
+	{
+		accumulate_dist_row_avx512(acc, cand, ref, n);
+		return;
+	}
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		accumulate_dist_row_avx2(acc, cand, ref, n);
+		return;
+	}
+#endif
+
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i r = _mm_set1_epi32(ref);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i d = _mm_sub_epi32(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(cand + i)), zero), r);
+		__m128i m = _mm_srai_epi32(d, 31);
+		d = _mm_sub_epi32(_mm_xor_si128(d, m), m);	// absolute differences, up to 16 bits
+#if USE_L2_DIST
+		// the square of a 16-bit difference needs a 64-bit lane
+		__m128i even = _mm_mul_epu32(d, d);
+		__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(d, 32), _mm_srli_epi64(d, 32));
+		__m128i lo = _mm_unpacklo_epi64(even, odd);
+		__m128i hi = _mm_unpackhi_epi64(even, odd);
+#else
+		__m128i lo = _mm_unpacklo_epi32(d, zero);
+		__m128i hi = _mm_unpackhi_epi32(d, zero);
+#endif
+		__m128i *a = (__m128i *)(acc + i);
+		_mm_storeu_si128(a + 0, _mm_add_epi64(_mm_loadu_si128(a + 0), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi64(_mm_loadu_si128(a + 1), hi));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		acc[i] += get_dist<uint64_t>(ref, cand[i]);
+	}
+}
+
+#if USE_CPU_DISPATCH
+TARGET_AVX2 static void butterfly_row_avx2(PatchType *a, PatchType *b, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+#if USE_INTEGER
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(a + i), _mm256_add_epi32(x, y));
+		_mm256_storeu_si256((__m256i *)(b + i), _mm256_sub_epi32(x, y));
+#else
+		__m256 x = _mm256_loadu_ps(a + i);
+		__m256 y = _mm256_loadu_ps(b + i);
+		_mm256_storeu_ps(a + i, _mm256_add_ps(x, y));
+		_mm256_storeu_ps(b + i, _mm256_sub_ps(x, y));
+#endif
+	}
+	for (; i < n; i++)
+	{
+		PatchType tmp = a[i] - b[i];
+		a[i] = a[i] + b[i];
+		b[i] = tmp;
+	}
+}
+
+TARGET_AVX512 static void butterfly_row_avx512(PatchType *a, PatchType *b, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+#if USE_INTEGER
+		__m512i x = _mm512_loadu_si512(a + i);
+		__m512i y = _mm512_loadu_si512(b + i);
+		_mm512_storeu_si512(a + i, _mm512_add_epi32(x, y));
+		_mm512_storeu_si512(b + i, _mm512_sub_epi32(x, y));
+#else
+		__m512 x = _mm512_loadu_ps(a + i);
+		__m512 y = _mm512_loadu_ps(b + i);
+		_mm512_storeu_ps(a + i, _mm512_add_ps(x, y));
+		_mm512_storeu_ps(b + i, _mm512_sub_ps(x, y));
+#endif
+	}
+	for (; i < n; i++)
+	{
+		PatchType tmp = a[i] - b[i];
+		a[i] = a[i] + b[i];
+		b[i] = tmp;
+	}
+}
+#endif
+
+void butterfly_row(PatchType *a, PatchType *b, int n)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX512)
+	{
+		butterfly_row_avx512(a, b, n);
+		return;
+	}
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+	{
+		butterfly_row_avx2(a, b, n);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < n; i++)
+	{
+		PatchType tmp = a[i] - b[i];
+		a[i] = a[i] + b[i];
+		b[i] = tmp;
+	}
+}
+
+#if USE_CPU_DISPATCH
+/* The coefficients in (-thres, thres) are masked, and the others are counted by the popcount of the mask. */
+TARGET_AVX2 static int threshold_row_avx2(PatchType *values, int n, PatchType thres)
+{
+	int nonzeros = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+#if USE_INTEGER
+		__m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+		__m256i small = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(thres), v), 
+										 _mm256_cmpgt_epi32(v, _mm256_set1_epi32(-thres)));
+		_mm256_storeu_si256((__m256i *)(values + i), _mm256_andnot_si256(small, v));
+		nonzeros += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(small)));
+#else
+		__m256 v = _mm256_loadu_ps(values + i);
+		__m256 small = _mm256_and_ps(_mm256_cmp_ps(v, _mm256_set1_ps(thres), _CMP_LT_OQ), 
+									 _mm256_cmp_ps(v, _mm256_set1_ps(-thres), _CMP_GT_OQ));
+		_mm256_storeu_ps(values + i, _mm256_andnot_ps(small, v));
+		nonzeros += 8 - __builtin_popcount(_mm256_movemask_ps(small));
+#endif
+	}
+	for (; i < n; i++)
+	{
+		if (values[i] >= thres || values[i] <= -thres)
+			nonzeros++;
+		else
+			values[i] = 0;
+	}
+	return nonzeros;
+}
+
+TARGET_AVX512 static int threshold_row_avx512(PatchType *values, int n, PatchType thres)
+{
+	int nonzeros = 0;
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+#if USE_INTEGER
+		__m512i v = _mm512_loadu_si512(values + i);
+		__mmask16 small = _mm512_cmplt_epi32_mask(v, _mm512_set1_epi32(thres)) & _mm512_cmpgt_epi32_mask(v, _mm512_set1_epi32(-thres));
+		_mm512_storeu_si512(values + i, _mm512_maskz_mov_epi32((__mmask16)~small, v));
+#else
+		__m512 v = _mm512_loadu_ps(values + i);
+		__mmask16 small = _mm512_cmp_ps_mask(v, _mm512_set1_ps(thres), _CMP_LT_OQ) & _mm512_cmp_ps_mask(v, _mm512_set1_ps(-thres), _CMP_GT_OQ);
+		_mm512_storeu_ps(values + i, _mm512_maskz_mov_ps((__mmask16)~small, v));
+#endif
+		nonzeros += 16 - __builtin_popcount(small);
+	}
+	for (; i < n; i++)
+	{
+		if (values[i] >= thres || values[i] <= -thres)
+			nonzeros++;
+		else
+			values[i] = 0;
+	}
+	return nonzeros;
+}
+#endif
+
+int threshold_row(PatchType *values, int n, PatchType thres)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX512)
+		return threshold_row_avx512(values, n, thres);
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+		return threshold_row_avx2(values, n, thres);
+#endif
+
+	int nonzeros = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (values[i] >= thres || values[i] <= -thres)
+			nonzeros++;
+		else
+			values[i] = 0;
+	}
+	return nonzeros;
+}
+
+/* The weight is computed in the same order by all the versions, and there is no FMA, so that the results are exactly the same. */
+static inline float wiener_weight(PatchType basic, float variance)
+{
+	float bb = (float)basic * (float)basic;
+	return bb / (bb + variance);
+}
+
+#if USE_CPU_DISPATCH
+/* There is no AVX-512 version, since the FMA implied by AVX-512 would be contracted from the multiplication and addition. */
+TARGET_AVX2 static int wiener_row_avx2(PatchType *noisy, const PatchType *basic, int n, float variance)
+{
+	const __m256 v = _mm256_set1_ps(variance);
+	const __m256 one = _mm256_set1_ps((float)(1 << WIENER_WEIGHT_BITS));
+	const __m256 half = _mm256_set1_ps(0.5f);
+	__m256i sum = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+#if USE_INTEGER
+		__m256 b = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(basic + i)));
+		__m256 x = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(noisy + i)));
+#else
+		__m256 b = _mm256_loadu_ps(basic + i);
+		__m256 x = _mm256_loadu_ps(noisy + i);
+#endif
+		__m256 bb = _mm256_mul_ps(b, b);
+		__m256 w = _mm256_div_ps(bb, _mm256_add_ps(bb, v));
+#if USE_INTEGER
+		_mm256_storeu_si256((__m256i *)(noisy + i), _mm256_cvttps_epi32(_mm256_mul_ps(x, w)));
+#else
+		_mm256_storeu_ps(noisy + i, _mm256_mul_ps(x, w));
+#endif
+		sum = _mm256_add_epi32(sum, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(w, one), half)));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	int wsum = _mm_cvtsi128_si32(s);
+	for (; i < n; i++)
+	{
+		float w = wiener_weight(basic[i], variance);
+		noisy[i] = (PatchType)((float)noisy[i] * w);
+		wsum += (int)(w * (float)(1 << WIENER_WEIGHT_BITS) + 0.5f);
+	}
+	return wsum;
+}
+#endif
+
+int wiener_row(PatchType *noisy, const PatchType *basic, int n, float variance)
+{
+#if USE_CPU_DISPATCH
+	if (host_cpu_level >= CPU_LEVEL_AVX2)
+		return wiener_row_avx2(noisy, basic, n, variance);
+#endif
+
+	int wsum = 0;
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128 v = _mm_set1_ps(variance);
+	const __m128 one = _mm_set1_ps((float)(1 << WIENER_WEIGHT_BITS));
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128i sum = _mm_setzero_si128();
+	for (; i + 4 <= n; i += 4)
+	{
+#if USE_INTEGER
+		__m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(basic + i)));
+		__m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(noisy + i)));
+#else
+		__m128 b = _mm_loadu_ps(basic + i);
+		__m128 x = _mm_loadu_ps(noisy + i);
+#endif
+		__m128 bb = _mm_mul_ps(b, b);
+		__m128 w = _mm_div_ps(bb, _mm_add_ps(bb, v));
+#if USE_INTEGER
+		_mm_storeu_si128((__m128i *)(noisy + i), _mm_cvttps_epi32(_mm_mul_ps(x, w)));
+#else
+		_mm_storeu_ps(noisy + i, _mm_mul_ps(x, w));
+#endif
+		sum = _mm_add_epi32(sum, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(w, one), half)));
+	}
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	wsum = _mm_cvtsi128_si32(sum);
+#endif
+	for (; i < n; i++)
+	{
+		float w = wiener_weight(basic[i], variance);
+		noisy[i] = (PatchType)((float)noisy[i] * w);
+		wsum += (int)(w * (float)(1 << WIENER_WEIGHT_BITS) + 0.5f);
+	}
+	return wsum;
+}
+
+#if USE_SSE2_KERNELS
+/* load 4 samples as floating-point values */
+template <typename ImageType>
+static inline __m128 load4(const ImageType *src)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v;
+	if (sizeof(ImageType) == 1)
+	{
+		int packed;
+		memcpy(&packed, src, 4);
+		v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+	}
+	else
+	{
+		v = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)src), zero);
+	}
+	return _mm_cvtepi32_ps(v);
+}
+
+/* store 4 floating-point values (already rounded and clamped) as samples */
+template <typename ImageType>
+static inline void store4(ImageType *dst, __m128 q)
+{
+	__m128i v = _mm_cvttps_epi32(q);
+	if (sizeof(ImageType) == 1)
+	{
+		v = _mm_packs_epi32(v, v);
+		v = _mm_packus_epi16(v, v);
+		int packed = _mm_cvtsi128_si32(v);
+		memcpy(dst, &packed, 4);
+	}
+	else
+	{
+		// unsigned saturation of SSE2 is only for 8-bit, so the values are biased to be signed
+		const __m128i bias32 = _mm_set1_epi32(32768);
+		const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+		v = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(v, bias32), _mm_sub_epi32(v, bias32)), bias16);
+		_mm_storel_epi64((__m128i *)dst, v);
+	}
+}
+#endif
+
+template <typename ImageType>
+static inline ImageType normalize(PatchType numer, float recip, float vmax)
+{
+	float q = (float)numer * recip + 0.5f;
+	q = q > 0.f ? q : 0.f;
+	q = q < vmax ? q : vmax;
+	return (ImageType)q;
+}
+
+/* The reciprocal is multiplied by 2^shift, so that the shift costs nothing. */
+template <typename ImageType>
+void normalize_row(ImageType *const *out, const PatchType *const *numer, const PatchType *const *denom, int nch, int n, int vmax, int shift)
+{
+	const float scale = (float)(1 << shift);
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 vmin = _mm_setzero_ps();
+	const __m128 vtop = _mm_set1_ps((float)vmax);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 recip = _mm_setzero_ps();
+		for (int ch = 0; ch < nch; ch++)
+		{
+			if (ch == 0 || denom[ch] != denom[ch - 1])
+			{
+#if USE_INTEGER
+				recip = _mm_div_ps(vscale, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(denom[ch] + i))));
+#else
+				recip = _mm_div_ps(vscale, _mm_loadu_ps(denom[ch] + i));
+#endif
+			}
+#if USE_INTEGER
+			__m128 q = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(numer[ch] + i)));
+#else
+			__m128 q = _mm_loadu_ps(numer[ch] + i);
+#endif
+			q = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(q, recip), half), vmin), vtop);
+			store4(out[ch] + i, q);
+		}
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float recip = 0.f;
+		for (int ch = 0; ch < nch; ch++)
+		{
+			if (ch == 0 || denom[ch] != denom[ch - 1])
+				recip = scale / (float)denom[ch][i];
+			out[ch][i] = normalize<ImageType>(numer[ch][i], recip, (float)vmax);
+		}
+	}
+}
+
+template void normalize_row(uint8_t  *const *, const PatchType *const *, const PatchType *const *, int, int, int, int);
+template void normalize_row(uint16_t *const *, const PatchType *const *, const PatchType *const *, int, int, int, int);
+
+template <typename ImageType>
+static inline ImageType round_clamp(float v, float vmax)
+{
+	v += 0.5f;
+	v = v > 0.f ? v : 0.f;
+	v = v < vmax ? v : vmax;
+	return (ImageType)v;
+}
+
+/* Full-range BT.601, i.e. the YCbCr of JPEG, which is the same as the cv2.COLOR_BGR2YCrCb used in the README. */
+#define YCC_KR		0.299f
+#define YCC_KG		0.587f
+#define YCC_KB		0.114f
+#define YCC_CB		0.564f		// Cb = (B - Y) * YCC_CB
+#define YCC_CR		0.713f		// Cr = (R - Y) * YCC_CR
+#define YCC_R_CR	1.403f		// R = Y + (Cr) * YCC_R_CR
+#define YCC_G_CB	0.344f		// G = Y - (Cb) * YCC_G_CB - (Cr) * YCC_G_CR
+#define YCC_G_CR	0.714f
+#define YCC_B_CB	1.773f		// B = Y + (Cb) * YCC_B_CB
+
+template <typename ImageType>
+void rgb_to_ycbcr_row(ImageType *r_y, ImageType *g_cb, ImageType *b_cr, int n, int vmax)
+{
+	const float half = (float)((vmax + 1) >> 1);
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128 vhalf = _mm_set1_ps(half + 0.5f);
+	const __m128 vmin = _mm_setzero_ps();
+	const __m128 vtop = _mm_set1_ps((float)vmax);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 r = load4(r_y + i);
+		__m128 g = load4(g_cb + i);
+		__m128 b = load4(b_cr + i);
+		__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(YCC_KR)), _mm_mul_ps(g, _mm_set1_ps(YCC_KG))), 
+							  _mm_mul_ps(b, _mm_set1_ps(YCC_KB)));
+		__m128 cb = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, y), _mm_set1_ps(YCC_CB)), vhalf);
+		__m128 cr = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(r, y), _mm_set1_ps(YCC_CR)), vhalf);
+		y = _mm_add_ps(y, _mm_set1_ps(0.5f));
+		store4(r_y  + i, _mm_min_ps(_mm_max_ps(y,  vmin), vtop));
+		store4(g_cb + i, _mm_min_ps(_mm_max_ps(cb, vmin), vtop));
+		store4(b_cr + i, _mm_min_ps(_mm_max_ps(cr, vmin), vtop));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float r = r_y[i], g = g_cb[i], b = b_cr[i];
+		float y = YCC_KR * r + YCC_KG * g + YCC_KB * b;
+		r_y[i]  = round_clamp<ImageType>(y, (float)vmax);
+		g_cb[i] = round_clamp<ImageType>((b - y) * YCC_CB + half, (float)vmax);
+		b_cr[i] = round_clamp<ImageType>((r - y) * YCC_CR + half, (float)vmax);
+	}
+}
+
+template <typename ImageType>
+void ycbcr_to_rgb_row(ImageType *y_r, ImageType *cb_g, ImageType *cr_b, int n, int vmax)
+{
+	const float half = (float)((vmax + 1) >> 1);
+	int i = 0;
+#if USE_SSE2_KERNELS
+	const __m128 vhalf = _mm_set1_ps(half);
+	const __m128 round = _mm_set1_ps(0.5f);
+	const __m128 vmin = _mm_setzero_ps();
+	const __m128 vtop = _mm_set1_ps((float)vmax);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 y  = _mm_add_ps(load4(y_r + i), round);
+		__m128 cb = _mm_sub_ps(load4(cb_g + i), vhalf);
+		__m128 cr = _mm_sub_ps(load4(cr_b + i), vhalf);
+		__m128 r = _mm_add_ps(y, _mm_mul_ps(cr, _mm_set1_ps(YCC_R_CR)));
+		__m128 g = _mm_sub_ps(_mm_sub_ps(y, _mm_mul_ps(cb, _mm_set1_ps(YCC_G_CB))), _mm_mul_ps(cr, _mm_set1_ps(YCC_G_CR)));
+		__m128 b = _mm_add_ps(y, _mm_mul_ps(cb, _mm_set1_ps(YCC_B_CB)));
+		store4(y_r  + i, _mm_min_ps(_mm_max_ps(r, vmin), vtop));
+		store4(cb_g + i, _mm_min_ps(_mm_max_ps(g, vmin), vtop));
+		store4(cr_b + i, _mm_min_ps(_mm_max_ps(b, vmin), vtop));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float y = y_r[i], cb = cb_g[i] - half, cr = cr_b[i] - half;
+		y_r[i]  = round_clamp<ImageType>(y + cr * YCC_R_CR, (float)vmax);
+		cb_g[i] = round_clamp<ImageType>(y - cb * YCC_G_CB - cr * YCC_G_CR, (float)vmax);
+		cr_b[i] = round_clamp<ImageType>(y + cb * YCC_B_CB, (float)vmax);
+	}
+}
+
+template <typename ImageType>
+void deinterleave_row(const ImageType *src, ImageType *const *dst, int nch, int n)
+{
+	int i = 0;
+#if USE_SSE2_KERNELS
+	if (sizeof(ImageType) == 1 && nch == 2)
+	{
+		// the even bytes are masked and the odd ones are shifted, then both are packed back to bytes
+		const __m128i mask = _mm_set1_epi16(0x00ff);
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+			_mm_storeu_si128((__m128i *)(dst[0] + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+			_mm_storeu_si128((__m128i *)(dst[1] + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+		}
+	}
+#endif
+	for (; i < n; i++)
+	{
+		for (int ch = 0; ch < nch; ch++)
+		{
+			dst[ch][i] = src[nch * i + ch];
+		}
+	}
+}
+
+template <typename ImageType>
+void interleave_row(const ImageType *const *src, ImageType *dst, int nch, int n)
+{
+	int i = 0;
+#if USE_SSE2_KERNELS
+	if (sizeof(ImageType) == 1 && nch == 2)
+	{
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(src[0] + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(src[1] + i));
+			_mm_storeu_si128((__m128i *)(dst + 2 * i),      _mm_unpacklo_epi8(a, b));
+			_mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+		}
+	}
+#endif
+	for (; i < n; i++)
+	{
+		for (int ch = 0; ch < nch; ch++)
+		{
+			dst[nch * i + ch] = src[ch][i];
+		}
+	}
+}
+
+template void rgb_to_ycbcr_row(uint8_t  *, uint8_t  *, uint8_t  *, int, int);
+template void rgb_to_ycbcr_row(uint16_t *, uint16_t *, uint16_t *, int, int);
+template void ycbcr_to_rgb_row(uint8_t  *, uint8_t  *, uint8_t  *, int, int);
+template void ycbcr_to_rgb_row(uint16_t *, uint16_t *, uint16_t *, int, int);
+template void deinterleave_row(const uint8_t  *, uint8_t  *const *, int, int);
+template void deinterleave_row(const uint16_t *, uint16_t *const *, int, int);
+template void interleave_row(const uint8_t  *const *, uint8_t  *, int, int);
+template void interleave_row(const uint16_t *const *, uint16_t *, int, int);
@@ -0,0 +1,146 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include "global_define.h"
+
+/* Instruction set level of the kernels selected for the host, i.e. CPU_LEVEL_BASE, CPU_LEVEL_AVX2 or CPU_LEVEL_AVX512.
+ * The CPU features are probed once at startup, and the level can be lowered by the environment variable BM3D_CPU_LEVEL,
+ * e.g. BM3D_CPU_LEVEL=0 runs the baseline kernels only, which is useful to compare the results of the kernels.
+ */
+int cpu_level();
+
+/* Accumulate a row of a filtered patch into the numerator/denominator line buffers,
+ * i.e. numer[i] += kw[i] * values[i] and denom[i] += kw[i] for i in [0, n).
+ * The (kw) is the Kaiser window multiplied by the group weight, which is computed once per group.
+ */
+void aggregate_row(
+	PatchType *numer,			// row of the numerator buffer
+	PatchType *denom,			// row of the denominator buffer
+	const PatchType *values,	// row of the filtered patch
+	const PatchType *kw,		// row of the weighted Kaiser window
+	int n						// number of pixels
+);
+
+/* The same as aggregate_row() but only the numerator is accumulated, 
+ * for the channels which share the denominator of another one, e.g. the U/V channels share that of the Y channel.
+ */
+void aggregate_numer_row(
+	PatchType *numer,			// row of the numerator buffer
+	const PatchType *values,	// row of the filtered patch
+	const PatchType *kw,		// row of the weighted Kaiser window
+	int n						// number of pixels
+);
+
+/* Accumulate the distances between a reference pixel and a row of candidate pixels,
+ * i.e. acc[i] += dist(ref, cand[i]) for i in [0, n), where dist is the L2 or L1 distance.
+ * There is a tuned version for each sample type, as the 16-bit lanes halve the throughput of the 8-bit ones,
+ * and the 16-bit distances have to be accumulated with 64-bit lanes to avoid overflow.
+ */
+void accumulate_dist_row(
+	uint32_t *acc,				// distances of the candidates
+	const uint8_t *cand,		// row of the candidate pixels
+	uint8_t ref,				// reference pixel
+	int n						// number of candidates
+);
+
+/* The same with 16-bit accumulators, which wrap around, for the distances known to fit, e.g. the L1 distances of 8-bit patches. */
+void accumulate_dist_row(
+	uint16_t *acc,				// distances of the candidates
+	const uint8_t *cand,		// row of the candidate pixels
+	uint8_t ref,				// reference pixel
+	int n						// number of candidates
+);
+
+void accumulate_dist_row(
+	uint64_t *acc,				// distances of the candidates
+	const uint16_t *cand,		// row of the candidate pixels
+	uint16_t ref,				// reference pixel
+	int n						// number of candidates
+);
+
+/* Butterfly of the 1D Hadamard transform on two rows of coefficients, i.e. (a[i], b[i]) = (a[i] + b[i], a[i] - b[i]) for i in [0, n). */
+void butterfly_row(
+	PatchType *a,				// row of the first coefficients
+	PatchType *b,				// row of the second coefficients
+	int n						// number of coefficients
+);
+
+/* Hard thresholding of a row of coefficients, i.e. the coefficients in (-thres, thres) are set to zeros.
+ * Returns the number of the nonzero coefficients remained.
+ */
+int threshold_row(
+	PatchType *values,			// row of the coefficients
+	int n,						// number of coefficients
+	PatchType thres				// threshold
+);
+
+/* Wiener shrinkage of a row of noisy coefficients with the basic ones as the oracle,
+ * i.e. noisy[i] *= w[i] for i in [0, n), where w[i] = basic[i]^2 / (basic[i]^2 + variance).
+ * The weights are computed with single-precision lanes, and the shrunk coefficients are truncated in the integer version.
+ * Returns the sum of the weights in fixed-point (WIENER_WEIGHT_BITS), which doesn't depend on the order of the lanes,
+ * so that all the instruction set levels give the same results.
+ */
+int wiener_row(
+	PatchType *noisy,			// row of the noisy coefficients
+	const PatchType *basic,		// row of the basic coefficients
+	int n,						// number of coefficients
+	float variance				// variance of the noise in the transform domain
+);
+
+/* Normalize a row of the aggregation of (nch) channels at once and write out the denoised pixels,
+ * i.e. out[ch][i] = clamp(round(numer[ch][i] * 2^shift / denom[ch][i]), 0, vmax) for i in [0, n),
+ * where the (shift) restores the samples shifted to fit the precision of the PatchType.
+ * The quotient is computed by the reciprocal of the denominator, 
+ * which is computed only once if the channels share the same denominator row.
+ */
+template <typename ImageType>
+void normalize_row(
+	ImageType *const *out,			// rows of the output image of each channel
+	const PatchType *const *numer,	// rows of the numerator buffer of each channel
+	const PatchType *const *denom,	// rows of the denominator buffer of each channel
+	int nch,						// number of channels
+	int n,							// number of pixels
+	int vmax,						// maximum output value
+	int shift						// left shift of the output values
+);
+
+/* Convert rows of R/G/B samples to Y/Cb/Cr samples in place, or vice versa, 
+ * with the full-range BT.601 matrix, i.e. the YCbCr of JPEG, and the Cb/Cr are offset by half of the range.
+ * The results are rounded and clamped to [0, vmax].
+ */
+template <typename ImageType>
+void rgb_to_ycbcr_row(
+	ImageType *r_y,				// row of R samples, replaced by the Y ones
+	ImageType *g_cb,			// row of G samples, replaced by the Cb ones
+	ImageType *b_cr,			// row of B samples, replaced by the Cr ones
+	int n,						// number of pixels
+	int vmax					// maximum sample value
+);
+
+template <typename ImageType>
+void ycbcr_to_rgb_row(
+	ImageType *y_r,				// row of Y samples, replaced by the R ones
+	ImageType *cb_g,			// row of Cb samples, replaced by the G ones
+	ImageType *cr_b,			// row of Cr samples, replaced by the B ones
+	int n,						// number of pixels
+	int vmax					// maximum sample value
+);
+
+/* Split a row of (nch) interleaved channels into planar rows, i.e. dst[ch][i] = src[nch * i + ch], or vice versa. */
+template <typename ImageType>
+void deinterleave_row(
+	const ImageType *src,		// row of the interleaved samples
+	ImageType *const *dst,		// rows of each channel
+	int nch,					// number of channels
+	int n						// number of pixels
+);
+
+template <typename ImageType>
+void interleave_row(
+	const ImageType *const *src,	// rows of each channel
+	ImageType *dst,				// row of the interleaved samples
+	int nch,					// number of channels
+	int n						// number of pixels
+);
+
+#endif
@@ -0,0 +1,34 @@
+#include <iostream>
+#include "line_buffer.h"
+
+LineBuffer::LineBuffer(int w_, int rows_, bool has_denom)
+	: w(w_), rows(rows_), top(0)
+{
+	numerator   = new PatchType[w * rows]();
+	denominator = has_denom ? new PatchType[w * rows]() : NULL;
+}
+
+LineBuffer::~LineBuffer()
+{
+	delete[] numerator;
+	delete[] denominator;
+}
+
+void LineBuffer::reset()
+{
+	top = 0;
+	memset(numerator, 0, w * rows * sizeof(PatchType));
+	if (denominator)
+		memset(denominator, 0, w * rows * sizeof(PatchType));
+}
+
+void LineBuffer::shift(int n)
+{
+	for (int r = 0; r < n; r++)
+	{
+		memset(numer_row(r), 0, w * sizeof(PatchType));
+		if (denominator)
+			memset(denom_row(r), 0, w * sizeof(PatchType));
+	}
+	top = (top + n) % rows;
+}
@@ -0,0 +1,37 @@
+#ifndef __LINE_BUFFER_H__
+#define __LINE_BUFFER_H__
+
+#include <iostream>
+#include "global_define.h"
+
+/* Line buffers of the numerator and denominator used in the aggregation step.
+ * The buffers are circular that the row (r) relative to the top is stored in the row ((top + r) % rows) of the memory,
+ * so that stepping downward only has to clear the discarded top rows and recycle them as the new bottom rows,
+ * rather than shifting the whole buffers.
+ * The channels aggregated with the same weights at the same patches, e.g. the Y/U/V of the CBM3D, 
+ * have the same denominators, so that only the buffer of the first channel needs to keep the denominator.
+ */
+struct LineBuffer
+{
+	int w;					// width of the buffers (padded image width)
+	int rows;				// number of rows, usually (2 * swinrv + psize)
+	int top;				// memory row of the first (top) row of the buffers
+
+	PatchType *numerator;	// size: w * rows
+	PatchType *denominator;	// size: w * rows, NULL if the denominator is shared with another line buffer
+
+	LineBuffer(int w_, int rows_, bool has_denom = true);
+	~LineBuffer();
+
+	// clear the buffers and restart from the memory row 0
+	void reset();
+
+	// discard the first (n) rows, which are cleared and recycled as the last (n) rows
+	void shift(int n);
+
+	// pointers of the row (r) relative to the top, r in [0, rows)
+	PatchType *numer_row(int r) { return numerator   + (top + r) % rows * w; }
+	PatchType *denom_row(int r) { return denominator + (top + r) % rows * w; }
+};
+
+#endif
@@ -5,7 +5,8 @@
 #include "cbm3d_wiener.h"
 using namespace std;
 
-double get_psnr(ImageType *img1, ImageType *img2, int pixels, ImageType vmax)
+template <typename ImageType>
+double get_psnr(ImageType *img1, ImageType *img2, int pixels, int vmax)
 {
 	double mse = 0;
 	double diff;
@@ -29,52 +30,44 @@ FILE *openfile(const char *fname, const char *mode)
 	return f;
 }
 
-int main()
+/* Denoise the frames of the noisy file with the samples of (ImageType), i.e. 8-bit or 9 to 16-bit. */
+template <typename ImageType>
+void process(int w, int h, int chnl, int bit_depth, int en_bm3d_step2, int sigma_step1, int sigma_step2, int frames,
+	FILE *gtf, FILE *inf, FILE *ouf)
 {
-	int w = 512, h = 512;
-	int chnl = 3;			// YUV 4:0:0 or 4:4:4
-
-	int en_bm3d_step2 = 1;	// enable step2 of bm3d
-	int sigma_step1 = 36;	// here same for Y/U/V, can be different
-	int sigma_step2 = 25;	// bigger for smoother, usually a little smaller than step1
-
-	int frames = 1;		// frames to process
+	int vmax = (1 << bit_depth) - 1;
 
 	// ground truth
-	FILE *gtf = openfile("test/yuv444_512x512_lena_gt.yuv", "rb");
 	ImageType *gt = new ImageType[w * h * chnl];
 	fread(gt, sizeof(ImageType), w * h * chnl, gtf);
 
 	// noisy input and denoised output
-	FILE *inf = openfile("test/yuv444_512x512_lena.yuv", "rb");
-	FILE *ouf = openfile("test/yuv444_512x512_lena_deno.yuv", "wb");
-	
 	ImageType *noisy = new ImageType[w * h * chnl];
 	ImageType *clean = new ImageType[w * h * chnl];
 
 	/* hard-thresholding denoiser
 	 */ 
-	BM3D *denoiser = NULL;
+	BM3D_T<ImageType> *denoiser = NULL;
 	if (chnl == 1) {
 		// used for YUV 4:0:0
-		denoiser = new BM3D(w, h, 16, 8, 3, 16, 1, 16, 1); // at present the psize must be 8
+		denoiser = new BM3D_T<ImageType>(w, h, 16, 8, 3, 16, 1, 16, 1, bit_depth); // at present the psize must be 8
 	} else {
 		// used for YUV 4;4:4
-		denoiser = new CBM3D(w, h, 16, 8, 3, 16, 1, 16, 1);
+		denoiser = new CBM3D_T<ImageType>(w, h, 16, 8, 3, 16, 1, 16, 1, bit_depth);
 	}
 
 	/* wiener-filtering denoiser
 	 * Note that Step2 is independent of Step1, except the basic denoised image.
 	 * So you can even just process the Y component in Step2, and reuse the U/V result from Step1.
 	 */
-	BM3D_WIE* denoiser_wie = NULL;
+	BM3D_WIE_T<ImageType> *denoiser_wie = NULL;
 	if (chnl == 1) {
 		// used for YUV 4:0:0
-		denoiser_wie = new BM3D_WIE(w, h, 32, 8, 3, 16, 1, 16, 1); // at present the psize must be 8
+		denoiser_wie = new BM3D_WIE_T<ImageType>(w, h, 32, 8, 3, 16, 1, 16, 1, bit_depth); // at present the psize must be 8
 	}
 	else {
 		// used for YUV 4;4:4
-		denoiser_wie = new CBM3D_WIE(w, h, 32, 8, 3, 16, 1, 16, 1);
+		denoiser_wie = new CBM3D_WIE_T<ImageType>(w, h, 32, 8, 3, 16, 1, 16, 1, bit_depth);
 	}
 
 	int frame = 0;
@@ -87,8 +80,8 @@ int main()
 		denoiser->load(noisy, sigma_step1);
 		denoiser->run(clean);
 
-		cout << "noisy PSNR: "    << get_psnr(noisy, gt, w*h*chnl, 255) << "    "
-			 << "denoised PSNR: " << get_psnr(clean, gt, w*h*chnl, 255) << endl;
+		cout << "noisy PSNR: "    << get_psnr(noisy, gt, w*h*chnl, vmax) << "    "
+			 << "denoised PSNR: " << get_psnr(clean, gt, w*h*chnl, vmax) << endl;
 
 		fwrite(clean, sizeof(ImageType), w * h * chnl, ouf);
 
@@ -98,8 +91,8 @@ int main()
 			denoiser_wie->load(noisy, clean, sigma_step2);
 			denoiser_wie->run(clean);
 
-			cout << "noisy PSNR: " << get_psnr(noisy, gt, w * h * chnl, 255) << "    "
-				<< "wiener denoised PSNR: " << get_psnr(clean, gt, w * h * chnl, 255) << endl;
+			cout << "noisy PSNR: " << get_psnr(noisy, gt, w * h * chnl, vmax) << "    "
+				<< "wiener denoised PSNR: " << get_psnr(clean, gt, w * h * chnl, vmax) << endl;
 
 			fwrite(clean, sizeof(ImageType), w * h * chnl, ouf);
 		}
@@ -111,13 +104,35 @@ int main()
 	delete denoiser;
 	delete denoiser_wie;
 
-	fclose(gtf);
 	delete[] gt;
+	delete[] noisy;
+	delete[] clean;
+}
 
+int main()
+{
+	int w = 512, h = 512;
+	int chnl = 3;			// YUV 4:0:0 or 4:4:4
+	int bit_depth = 8;		// 8-bit, or 9 to 16-bit samples stored in 16 bits (little-endian)
+
+	int en_bm3d_step2 = 1;	// enable step2 of bm3d
+	int sigma_step1 = 36;	// here same for Y/U/V, can be different, in the unit of the samples
+	int sigma_step2 = 25;	// bigger for smoother, usually a little smaller than step1
+
+	int frames = 1;		// frames to process
+
+	FILE *gtf = openfile("test/yuv444_512x512_lena_gt.yuv", "rb");
+	FILE *inf = openfile("test/yuv444_512x512_lena.yuv", "rb");
+	FILE *ouf = openfile("test/yuv444_512x512_lena_deno.yuv", "wb");
+
+	if (bit_depth > 8)
+		process<uint16_t>(w, h, chnl, bit_depth, en_bm3d_step2, sigma_step1, sigma_step2, frames, gtf, inf, ouf);
+	else
+		process<uint8_t>(w, h, chnl, bit_depth, en_bm3d_step2, sigma_step1, sigma_step2, frames, gtf, inf, ouf);
+
+	fclose(gtf);
 	fclose(inf);
 	fclose(ouf);
-	delete[] noisy;
-	delete[] clean;
 
 	return 0;
 }
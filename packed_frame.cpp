@@ -0,0 +1,139 @@
+#include <iostream>
+#include "packed_frame.h"
+#include "kernels.h"
+
+template <typename ImageType>
+PackedFrame<ImageType>::PackedFrame(int format_, int w_, int h_, int rows_, int crows_, int bit_depth)
+	: format(format_), w(w_), h(h_), rows(rows_), crows(crows_)
+{
+	vmax = (1 << bit_depth) - 1;
+	cw = subsampled() ? w / 2 : w;
+	ch = subsampled() ? h / 2 : h;
+
+	// the Y plane of NV12/NV21 needs no conversion
+	ring[0] = subsampled() ? NULL : new ImageType[w * rows];
+	ring[1] = new ImageType[cw * crows];
+	ring[2] = new ImageType[cw * crows];
+
+	src[0] = src[1] = NULL;
+	dst[0] = dst[1] = NULL;
+	stride[0] = stride[1] = 0;
+	done = cdone = 0;
+}
+
+template <typename ImageType>
+PackedFrame<ImageType>::~PackedFrame()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		delete[] ring[i];
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::set_input(const ImageType *const *planes, const int *strides)
+{
+	for (int i = 0; i < (subsampled() ? 2 : 1); i++)
+	{
+		src[i] = planes[i];
+		stride[i] = strides[i];
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::set_output(ImageType *const *planes, const int *strides)
+{
+	for (int i = 0; i < (subsampled() ? 2 : 1); i++)
+	{
+		dst[i] = planes[i];
+		stride[i] = strides[i];
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::fill(int y1, int cy1)
+{
+	y1  = y1  < h  ? y1  : h;
+	cy1 = cy1 < ch ? cy1 : ch;
+
+	if (subsampled())
+	{
+		// the U/V samples of NV21 are swapped
+		int u = format == FRAME_FORMAT_NV12 ? 1 : 2;
+		for (; cdone < cy1; cdone++)
+		{
+			ImageType *uv[2] = {ring[u] + cdone % crows * cw, ring[3 - u] + cdone % crows * cw};
+			deinterleave_row(src[1] + cdone * stride[1], uv, 2, cw);
+		}
+		done = y1;
+	}
+	else
+	{
+		// the R/B samples of BGR are swapped
+		int r = format == FRAME_FORMAT_RGB ? 0 : 2;
+		for (; done < y1; done++)
+		{
+			ImageType *rgb[3] = {ring[r] + done % rows * w, ring[1] + done % rows * w, ring[2 - r] + done % rows * w};
+			deinterleave_row(src[0] + done * stride[0], rgb, 3, w);
+			rgb_to_ycbcr_row(ring[0] + done % rows * w, ring[1] + done % rows * w, ring[2] + done % rows * w, w, vmax);
+		}
+		cdone = done;
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::store(int y1, int cy1)
+{
+	y1  = y1  < h  ? y1  : h;
+	cy1 = cy1 < ch ? cy1 : ch;
+
+	if (subsampled())
+	{
+		int u = format == FRAME_FORMAT_NV12 ? 1 : 2;
+		for (; cdone < cy1; cdone++)
+		{
+			const ImageType *uv[2] = {ring[u] + cdone % crows * cw, ring[3 - u] + cdone % crows * cw};
+			interleave_row(uv, dst[1] + cdone * stride[1], 2, cw);
+		}
+		done = y1;
+	}
+	else
+	{
+		int r = format == FRAME_FORMAT_RGB ? 0 : 2;
+		for (; done < y1; done++)
+		{
+			// the completed rows of the rings are never read again, so they are converted in place
+			ycbcr_to_rgb_row(ring[0] + done % rows * w, ring[1] + done % rows * w, ring[2] + done % rows * w, w, vmax);
+			const ImageType *rgb[3] = {ring[r] + done % rows * w, ring[1] + done % rows * w, ring[2 - r] + done % rows * w};
+			interleave_row(rgb, dst[0] + done * stride[0], 3, w);
+		}
+		cdone = done;
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::in_planes(const ImageType **planes, int *strides, int *rings) const
+{
+	planes[0]  = subsampled() ? src[0] : ring[0];
+	strides[0] = subsampled() ? stride[0] : w;
+	rings[0]   = subsampled() ? 0 : rows;
+	for (int i = 1; i < 3; i++)
+	{
+		planes[i]  = ring[i];
+		strides[i] = cw;
+		rings[i]   = crows;
+	}
+}
+
+template <typename ImageType>
+void PackedFrame<ImageType>::out_planes(PlaneOut<ImageType> *out) const
+{
+	out[0] = subsampled() ? PlaneOut<ImageType>(dst[0], stride[0]) : PlaneOut<ImageType>(ring[0], w, rows);
+	for (int i = 1; i < 3; i++)
+	{
+		out[i] = PlaneOut<ImageType>(ring[i], cw, crows);
+	}
+}
+
+template struct PackedFrame<uint8_t>;
+template struct PackedFrame<uint16_t>;
@@ -0,0 +1,70 @@
+#ifndef __PACKED_FRAME_H__
+#define __PACKED_FRAME_H__
+
+#include <iostream>
+#include "global_define.h"
+#include "plane_view.h"
+
+/* Ring buffers of the planar Y/U/V rows of a packed or semi-planar frame, i.e. NV12/NV21 or packed RGB/BGR.
+ * The engines read and write planar rows only, so the rows of the packed frame are converted into the rings 
+ * just before they are needed by the reference patches, and the denoised rows are converted back 
+ * as soon as they are completed, which saves a whole-frame conversion before and after the denoising.
+ * The packed RGB/BGR pixels are converted to YCbCr (4:4:4), and the NV12/NV21 ones are deinterleaved (4:2:0).
+ * The rows (y) of the Y plane and (cy) of the U/V planes are stored in the ring rows (y % rows) and (cy % crows).
+ */
+template <typename ImageType>
+struct PackedFrame
+{
+	int format;				// FRAME_FORMAT_NV12, FRAME_FORMAT_NV21, FRAME_FORMAT_RGB or FRAME_FORMAT_BGR
+	int w;					// width of the Y plane
+	int h;					// height of the Y plane
+	int cw;					// width of the U/V planes
+	int ch;					// height of the U/V planes
+	int vmax;				// maximum sample value
+
+	int rows;				// rows of the ring of the Y plane
+	int crows;				// rows of the rings of the U/V planes
+	ImageType *ring[3];		// rings of the Y/U/V rows
+
+	const ImageType *src[2];	// input planes, i.e. the Y and U/V planes, or the packed plane
+	ImageType *dst[2];		// output planes
+	int stride[2];			// strides of the input or output planes
+	int done;				// rows of the Y plane converted
+	int cdone;				// rows of the U/V planes converted
+
+	PackedFrame(
+		int format_,		// format of the frame
+		int w_,				// width
+		int h_,				// height
+		int rows_,			// rows of the ring of the Y plane
+		int crows_,			// rows of the rings of the U/V planes, the same as (rows_) for RGB/BGR
+		int bit_depth		// bit depth of the samples
+	);
+	~PackedFrame();
+
+	// whether the frame is subsampled (YUV 4:2:0)
+	bool subsampled() const { return format == FRAME_FORMAT_NV12 || format == FRAME_FORMAT_NV21; }
+
+	// restart from the first row of a new frame
+	void reset() { done = cdone = 0; }
+
+	// read the rows from the input planes, the packed one is planes[0], otherwise the Y and U/V planes
+	void set_input(const ImageType *const *planes, const int *strides);
+
+	// write the rows to the output planes, the packed one is planes[0], otherwise the Y and U/V planes
+	void set_output(ImageType *const *planes, const int *strides);
+
+	// convert the input rows before the row (y1) of the Y plane and (cy1) of the U/V planes into the rings
+	void fill(int y1, int cy1);
+
+	// convert the completed rows before the row (y1) of the Y plane and (cy1) of the U/V planes to the output
+	void store(int y1, int cy1);
+
+	// planar Y/U/V input planes of the engines, i.e. the rings, except the Y plane of NV12/NV21 which is read in place
+	void in_planes(const ImageType **planes, int *strides, int *rings) const;
+
+	// planar Y/U/V output planes of the engines, i.e. the rings, except the Y plane of NV12/NV21 which is written in place
+	void out_planes(PlaneOut<ImageType> *out) const;
+};
+
+#endif
@@ -7,6 +7,7 @@ Patch2D::Patch2D(int w_, int h_)
 	values = new PatchType[w * h];
 }
 
+template <typename ImageType>
 Patch2D::Patch2D(ImageType *image, int x_, int y_, DistType d, int w_, int h_, int stride)
 	: w(w_), h(h_), x(x_), y(y_), dist(d)
 {
@@ -25,6 +26,7 @@ Patch2D::~Patch2D()
 	delete[] values;
 }
 
+template <typename ImageType>
 void Patch2D::update(ImageType *image, int x_, int y_, DistType d, int stride)
 {
 	x = x_, y = y_, dist = d;
@@ -37,31 +39,63 @@ void Patch2D::update(ImageType *image, int x_, int y_, DistType d, int stride)
 	}
 }
 
-void Patch2D::update(ImageType *image, int stride)
+/* Update the values with the patch of the image, which is offset by (x, y) to the reference patch at (rx, ry).
+ * The samples are shifted right by (shift) bits to fit the precision of the PatchType.
+ */
+template <typename ImageType>
+void Patch2D::update(const PlaneView<ImageType> &image, int rx, int ry, int shift)
 {
-	for (int i = 0, r = 0; r < h; r++)
+	if (image.inside(rx + x, rx + x + w))
 	{
-		for (int c = 0; c < w; c++, i++)
+		for (int i = 0, r = 0; r < h; r++)
 		{
-			values[i] = (PatchType)image[(r + y) * stride + c + x];
+			const ImageType *row = image.row(ry + y + r) + rx + x;
+			for (int c = 0; c < w; c++, i++)
+			{
+				values[i] = (PatchType)(row[c] >> shift);
+			}
+		}
+	}
+	else
+	{
+		for (int i = 0, r = 0; r < h; r++)
+		{
+			for (int c = 0; c < w; c++, i++)
+			{
+				values[i] = (PatchType)(image.at(rx + x + c, ry + y + r) >> shift);
+			}
 		}
 	}
 }
 
+template Patch2D::Patch2D(uint8_t  *, int, int, DistType, int, int, int);
+template Patch2D::Patch2D(uint16_t *, int, int, DistType, int, int, int);
+template void Patch2D::update(uint8_t  *, int, int, DistType, int);
+template void Patch2D::update(uint16_t *, int, int, DistType, int);
+template void Patch2D::update(const PlaneView<uint8_t>  &, int, int, int);
+template void Patch2D::update(const PlaneView<uint16_t> &, int, int, int);
+
 void Patch2D::update(int x_, int y_, DistType d)
 {
 	x = x_, y = y_;
 	dist = d;
 }
 
+// the 4x4 patches are the subsampled chroma ones
 void Patch2D::transform_2d()
 {
-	inplace_forward_bior15_2d_8x8(values);
+	if (w == 4)
+		inplace_forward_haar_2d_4x4(values);
+	else
+		inplace_forward_bior15_2d_8x8(values);
 }
 
 void Patch2D::inv_transform_2d()
 {
-	inplace_backward_bior15_2d_8x8(values);
+	if (w == 4)
+		inplace_backward_haar_2d_4x4(values);
+	else
+		inplace_backward_bior15_2d_8x8(values);
 }
 
 
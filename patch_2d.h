@@ -4,6 +4,7 @@
 #include <iostream>
 #include "global_define.h"
 #include "transform.h"
+#include "plane_view.h"
 
 struct Patch2D
 {
@@ -15,11 +16,14 @@ struct Patch2D
 	DistType dist;		// L2/L1 distance between the patch and its reference one
 
 	Patch2D(int w_, int h_);
+	template <typename ImageType>
 	Patch2D(ImageType *image, int x_, int y_, DistType d, int w_, int h_, int stride);
 	~Patch2D();
 
+	template <typename ImageType>
 	void update(ImageType *image, int x_, int y_, DistType d, int stride);
-	void update(ImageType *image, int stride);
+	template <typename ImageType>
+	void update(const PlaneView<ImageType> &image, int rx, int ry, int shift);
 	void update(int x_, int y_, DistType d);
 
 	void transform_2d();
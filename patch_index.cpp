@@ -0,0 +1,354 @@
+#include <iostream>
+#include <algorithm>
+#include "patch_index.h"
+
+// orders the candidates by a dimension of their descriptors
+struct DescLess
+{
+	const int32_t *desc;
+	int dim;
+
+	DescLess(const int32_t *desc_, int dim_) : desc(desc_), dim(dim_) {}
+	bool operator()(int a, int b) const { return desc[a * INDEX_DIMS + dim] < desc[b * INDEX_DIMS + dim]; }
+};
+
+/* The blocks are aligned to (brows) rows, and the ones kept overlap the band of (2 * swinrv + 1) rows. */
+template <typename ImageType>
+PatchIndex<ImageType>::PatchIndex(int psize_, int ssteph_, int swinrv_, int max_sim)
+	: psize(psize_), ssteph(ssteph_), swinrv(swinrv_)
+{
+	ncand = max_sim * INDEX_CANDIDATES_MUL;
+	cell  = psize / 4 > 0 ? psize / 4 : 1;
+	brows = INDEX_BLOCK_ROWS < 2 * swinrv + 1 ? INDEX_BLOCK_ROWS : 2 * swinrv + 1;
+
+	nblocks = (2 * swinrv + 1) / brows + 2;
+	blocks  = new Block[nblocks];
+	for (int k = 0; k < nblocks; k++)
+	{
+		Block *b = blocks + k;
+		b->n = b->cap = b->nodes = 0;
+		b->desc = NULL;
+		b->pos = NULL;
+		b->order = NULL;
+		b->split_dim = NULL;
+		b->split_val = NULL;
+	}
+	first = count = 0;
+	next_row = 0;
+	last_ry = -1;
+
+	hsum = NULL;
+	hsum_cap = 0;
+
+	best_d   = new int64_t[ncand];
+	best_pos = new int[ncand * 2];
+	nbest = 0;
+}
+
+template <typename ImageType>
+PatchIndex<ImageType>::~PatchIndex()
+{
+	for (int k = 0; k < nblocks; k++)
+	{
+		delete[] blocks[k].desc;
+		delete[] blocks[k].pos;
+		delete[] blocks[k].order;
+		delete[] blocks[k].split_dim;
+		delete[] blocks[k].split_val;
+	}
+	delete[] blocks;
+	delete[] hsum;
+	delete[] best_d;
+	delete[] best_pos;
+}
+
+/* The candidates are the patches inside the image, i.e. the columns [0, w - psize] by (ssteph) and the rows [0, h - psize].
+ * Only the rows up to the bottom of the band are indexed, as a streamed image has no more rows yet,
+ * so a whole image and a streamed one are matched the same.
+ * The last block is rebuilt while its rows arrive, so that the trees don't depend on the steps of the lines.
+ */
+template <typename ImageType>
+void PatchIndex<ImageType>::start_line(const PlaneView<ImageType> &image, int ry)
+{
+	if (ry <= last_ry)
+	{
+		first = count = 0;
+		next_row = 0;
+	}
+	last_ry = ry;
+
+	// drop the blocks above the band
+	while (count > 0 && blocks[first].y1 <= ry - swinrv)
+	{
+		first = (first + 1) % nblocks;
+		count--;
+	}
+	// the lines above were skipped, e.g. out of a RegionMask or above a tile, so the blocks start from the band
+	if (count == 0 && next_row < ry - swinrv)
+		next_row = (ry - swinrv) / brows * brows;
+
+	int ylimit = ry + swinrv < image.h - psize ? ry + swinrv : image.h - psize;
+	if (count > 0)
+	{
+		Block *b = blocks + (first + count - 1) % nblocks;
+		if (b->y1 - b->y0 < brows && b->y1 <= ylimit)
+		{
+			next_row = b->y0;
+			count--;
+		}
+	}
+	while (next_row <= ylimit)
+	{
+		int y1 = (next_row / brows + 1) * brows;
+		y1 = y1 < ylimit + 1 ? y1 : ylimit + 1;
+		build(image, blocks + (first + count) % nblocks, next_row, y1);
+		count++;
+		next_row = y1;
+	}
+}
+
+/* The descriptors are the sums of the cells, by the horizontal sums of a cell of each row, summed vertically. */
+template <typename ImageType>
+void PatchIndex<ImageType>::build(const PlaneView<ImageType> &image, Block *b, int y0, int y1)
+{
+	int nx = image.w >= psize ? (image.w - psize) / ssteph + 1 : 0;
+	int n = nx * (y1 - y0);
+	b->y0 = y0;
+	b->y1 = y1;
+	b->n = n;
+	if (n == 0) return;
+	if (n > b->cap)
+	{
+		delete[] b->desc;
+		delete[] b->pos;
+		delete[] b->order;
+		delete[] b->split_dim;
+		delete[] b->split_val;
+		int leaves = 1;
+		while (leaves * INDEX_LEAF_SIZE < n) leaves *= 2;
+		b->cap = n;
+		b->nodes = 2 * leaves;
+		b->desc  = new int32_t[n * INDEX_DIMS];
+		b->pos   = new int[n * 2];
+		b->order = new int[n];
+		b->split_dim = new int[b->nodes];
+		b->split_val = new int32_t[b->nodes];
+	}
+
+	int rows = y1 - y0 + psize - 1;
+	int width = image.w - cell + 1;
+	if (rows * image.w > hsum_cap)
+	{
+		delete[] hsum;
+		hsum_cap = rows * image.w;
+		hsum = new int32_t[hsum_cap];
+	}
+	for (int r = 0; r < rows; r++)
+	{
+		const ImageType *src = image.row(y0 + r);
+		int32_t *hs = hsum + r * image.w;
+		int32_t s = 0;
+		for (int x = 0; x < cell; x++) {
+			s += src[x];
+		}
+		for (int x = 0; x < width; x++)
+		{
+			hs[x] = s;
+			if (x + cell < image.w) s += src[x + cell] - src[x];
+		}
+	}
+
+	for (int y = y0, idx = 0; y < y1; y++)
+	{
+		for (int k = 0; k < nx; k++, idx++)
+		{
+			int x = k * ssteph;
+			int32_t *d = b->desc + idx * INDEX_DIMS;
+			for (int i = 0; i < 4; i++)
+			{
+				for (int j = 0; j < 4; j++)
+				{
+					const int32_t *hs = hsum + (y - y0 + i * cell) * image.w + x + j * cell;
+					int32_t s = 0;
+					for (int r = 0; r < cell; r++, hs += image.w) {
+						s += *hs;
+					}
+					d[i * 4 + j] = s;
+				}
+			}
+			b->pos[idx * 2] = x;
+			b->pos[idx * 2 + 1] = y;
+			b->order[idx] = idx;
+		}
+	}
+
+	build_node(b, 1, 0, n);
+}
+
+/* The candidates are split at the median of the dimension of the largest spread, so the tree is balanced,
+ * and the node (k) has the children (2k) and (2k + 1).
+ */
+template <typename ImageType>
+void PatchIndex<ImageType>::build_node(Block *b, int node, int lo, int hi)
+{
+	if (hi - lo <= INDEX_LEAF_SIZE)
+	{
+		b->split_dim[node] = -1;
+		return;
+	}
+
+	int32_t vmin[INDEX_DIMS], vmax[INDEX_DIMS];
+	const int32_t *d = b->desc + b->order[lo] * INDEX_DIMS;
+	for (int k = 0; k < INDEX_DIMS; k++) {
+		vmin[k] = vmax[k] = d[k];
+	}
+	for (int i = lo + 1; i < hi; i++)
+	{
+		d = b->desc + b->order[i] * INDEX_DIMS;
+		for (int k = 0; k < INDEX_DIMS; k++)
+		{
+			vmin[k] = d[k] < vmin[k] ? d[k] : vmin[k];
+			vmax[k] = d[k] > vmax[k] ? d[k] : vmax[k];
+		}
+	}
+	int dim = 0;
+	for (int k = 1; k < INDEX_DIMS; k++)
+	{
+		if (vmax[k] - vmin[k] > vmax[dim] - vmin[dim]) dim = k;
+	}
+
+	int mid = (lo + hi) / 2;
+	std::nth_element(b->order + lo, b->order + mid, b->order + hi, DescLess(b->desc, dim));
+	b->split_dim[node] = dim;
+	b->split_val[node] = b->desc[b->order[mid] * INDEX_DIMS + dim];
+
+	build_node(b, 2 * node, lo, mid);
+	build_node(b, 2 * node + 1, mid, hi);
+}
+
+template <typename ImageType>
+void PatchIndex<ImageType>::describe(const PlaneView<ImageType> &image, int x, int y, int32_t *desc)
+{
+	bool inside = image.inside(x, x + psize);
+	for (int k = 0; k < INDEX_DIMS; k++) {
+		desc[k] = 0;
+	}
+	for (int r = 0; r < 4 * cell; r++)
+	{
+		const ImageType *src = image.row(y + r) + x;
+		int32_t *d = desc + r / cell * 4;
+		for (int c = 0; c < 4 * cell; c++)
+		{
+			d[c / cell] += inside ? src[c] : image.at(x + c, y + r);
+		}
+	}
+}
+
+/* The near child is visited first, and the far one only if its split plane is closer than the worst of the best candidates. */
+template <typename ImageType>
+void PatchIndex<ImageType>::search(const Block *b, int node, int lo, int hi, const int32_t *q, int ylo, int yhi, int rx, int ry)
+{
+	if (leaves >= INDEX_MAX_LEAVES) return;
+
+	int dim = b->split_dim[node];
+	if (dim < 0)
+	{
+		leaves++;
+		for (int i = lo; i < hi; i++)
+		{
+			int c = b->order[i];
+			int cx = b->pos[c * 2], cy = b->pos[c * 2 + 1];
+			if (cy < ylo || cy > yhi || (cx == rx && cy == ry)) continue;
+
+			const int32_t *d = b->desc + c * INDEX_DIMS;
+			int64_t dist = 0;
+			for (int k = 0; k < INDEX_DIMS; k++)
+			{
+				int64_t diff = q[k] - d[k];
+				dist += diff * diff;
+			}
+			if (nbest == ncand && dist >= best_d[ncand - 1]) continue;
+
+			// insert into the best candidates sorted by the descriptor distances
+			int k = nbest < ncand ? nbest++ : ncand - 1;
+			for (; k > 0 && best_d[k - 1] > dist; k--)
+			{
+				best_d[k] = best_d[k - 1];
+				best_pos[k * 2] = best_pos[k * 2 - 2];
+				best_pos[k * 2 + 1] = best_pos[k * 2 - 1];
+			}
+			best_d[k] = dist;
+			best_pos[k * 2] = cx;
+			best_pos[k * 2 + 1] = cy;
+		}
+		return;
+	}
+
+	int mid = (lo + hi) / 2;
+	int64_t diff = q[dim] - b->split_val[node];
+	if (diff < 0)
+	{
+		search(b, 2 * node, lo, mid, q, ylo, yhi, rx, ry);
+		if (nbest < ncand || diff * diff < best_d[nbest - 1])
+			search(b, 2 * node + 1, mid, hi, q, ylo, yhi, rx, ry);
+	}
+	else
+	{
+		search(b, 2 * node + 1, mid, hi, q, ylo, yhi, rx, ry);
+		if (nbest < ncand || diff * diff < best_d[nbest - 1])
+			search(b, 2 * node, lo, mid, q, ylo, yhi, rx, ry);
+	}
+}
+
+template <typename ImageType>
+DistType PatchIndex<ImageType>::distance(const PlaneView<ImageType> &image, int rx, int ry, int cx, int cy)
+{
+	bool inside = image.inside(rx, rx + psize);
+	DistType d = 0;
+	for (int r = 0; r < psize; r++)
+	{
+		const ImageType *rrow = image.row(ry + r) + rx;
+		const ImageType *crow = image.row(cy + r) + cx;
+		for (int c = 0; c < psize; c++)
+		{
+			int diff = (int)(inside ? rrow[c] : image.at(rx + c, ry + r)) - crow[c];
+#if USE_L2_DIST
+			d += (DistType)((int64_t)diff * diff);
+#else
+			d += diff >= 0 ? diff : -diff;
+#endif
+		}
+	}
+	return d;
+}
+
+/* The trees of the blocks overlapping the band are searched with the same best candidates,
+ * each with its own budget of leaves, and the best ones are matched by their exact distances.
+ */
+template <typename ImageType>
+void PatchIndex<ImageType>::match(const PlaneView<ImageType> &image, int rx, int ry, Group3D *g3d)
+{
+	g3d->set_reference();
+
+	int32_t q[INDEX_DIMS];
+	describe(image, rx, ry, q);
+
+	int ylo = ry - swinrv, yhi = ry + swinrv;
+	nbest = 0;
+	for (int k = 0; k < count; k++)
+	{
+		const Block *b = blocks + (first + k) % nblocks;
+		if (b->n == 0 || b->y1 <= ylo || b->y0 > yhi) continue;
+		leaves = 0;
+		search(b, 1, 0, b->n, q, ylo, yhi, rx, ry);
+	}
+
+	for (int i = 0; i < nbest; i++)
+	{
+		int cx = best_pos[i * 2], cy = best_pos[i * 2 + 1];
+		g3d->insert_patch(cx - rx, cy - ry, distance(image, rx, ry, cx, cy));
+	}
+}
+
+template struct PatchIndex<uint8_t>;
+template struct PatchIndex<uint16_t>;
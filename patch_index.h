@@ -0,0 +1,89 @@
+#ifndef __PATCH_INDEX_H__
+#define __PATCH_INDEX_H__
+
+#include <iostream>
+
+#include "global_define.h"
+#include "plane_view.h"
+#include "group_3d.h"
+
+#define INDEX_DIMS				16		// dimensions of a descriptor, the sums of the 4x4 cells of a patch
+
+/* Index of the candidate patches of the whole width of the image, for the global search (SEARCH_MODE_INDEX).
+ * The descriptor of a patch is the sums of its 4x4 cells, i.e. its low-frequency content,
+ * whose distance is a lower bound of the patch distance (scaled by the pixels of a cell),
+ * so the nearest descriptors are likely the nearest patches.
+ * The candidates are indexed by blocks of rows (INDEX_BLOCK_ROWS), each of which has its own k-d tree,
+ * and the blocks are built when their rows are available and dropped when they leave the band of the search window,
+ * so that the index follows the line buffers (the rows streamed from a RowSource too).
+ * A query visits at most (INDEX_MAX_LEAVES) leaves of each tree of the band, which is approximate but logarithmic,
+ * and the best (candidates) descriptors are ranked by the exact distances of their patches.
+ * The candidates are limited to the rows [ry - swinrv, ry + swinrv] of the band,
+ * as the matched patches are aggregated into the line buffers, but they can be anywhere in a row.
+ */
+template <typename ImageType>
+struct PatchIndex
+{
+	/* A block of rows of candidates with its k-d tree, whose points are stored in the order of the leaves. */
+	struct Block
+	{
+		int y0;				// first row of the candidates
+		int y1;				// last row of the candidates, exclusive
+		int n;				// number of candidates
+		int cap;			// capacity of the candidates
+		int32_t *desc;		// descriptors, size: cap * INDEX_DIMS
+		int *pos;			// columns and rows of the candidates, size: cap * 2
+		int *order;			// order of the candidates to build the tree, size: cap
+		int *split_dim;		// split dimension of each node (heap order from 1), -1 for a leaf
+		int32_t *split_val;	// split value of each node
+		int nodes;			// capacity of the nodes
+	};
+
+	int psize;				// patch size
+	int ssteph;				// step of the candidate columns
+	int swinrv;				// vertical search window radius
+	int ncand;				// candidates ranked by the exact distances
+	int cell;				// width and height of a cell of the descriptors, psize / 4
+	int brows;				// rows of a block, INDEX_BLOCK_ROWS at most, so that a block being built is within the band
+
+	Block *blocks;			// ring of the blocks of the band
+	int nblocks;			// capacity of the ring
+	int first;				// first block of the band in the ring
+	int count;				// number of blocks of the band
+	int next_row;			// first row of candidates not indexed yet
+	int last_ry;			// row of the last line, to detect a new image
+
+	int32_t *hsum;			// horizontal sums of a cell of each row of a block, size: (INDEX_BLOCK_ROWS + psize) * w
+	int hsum_cap;			// capacity of the (hsum)
+
+	int64_t *best_d;		// descriptor distances of the best candidates of a query, size: ncand
+	int *best_pos;			// columns and rows of the best candidates, size: ncand * 2
+	int nbest;				// number of the best candidates
+	int leaves;				// leaves visited by the query of a tree
+
+	PatchIndex(int psize_, int ssteph_, int swinrv_, int max_sim);
+	~PatchIndex();
+
+	// index the candidates of the band of the line at the row (ry), a new image if it's above the last line
+	void start_line(const PlaneView<ImageType> &image, int ry);
+
+	// find the similar patches of the reference patch at (rx, ry) in the band
+	void match(const PlaneView<ImageType> &image, int rx, int ry, Group3D *g3d);
+
+	// compute the descriptors of the candidate rows [y0, y1), and build their tree
+	void build(const PlaneView<ImageType> &image, Block *b, int y0, int y1);
+
+	// build the subtree (node) of the candidates [lo, hi) of the (order)
+	void build_node(Block *b, int node, int lo, int hi);
+
+	// descriptor of the patch at (x, y), which can be out of the image
+	void describe(const PlaneView<ImageType> &image, int x, int y, int32_t *desc);
+
+	// visit the subtree (node) of the candidates [lo, hi) for the query (q), whose candidates are in the rows [ylo, yhi]
+	void search(const Block *b, int node, int lo, int hi, const int32_t *q, int ylo, int yhi, int rx, int ry);
+
+	// exact distance between the patches at (rx, ry) and (cx, cy)
+	DistType distance(const PlaneView<ImageType> &image, int rx, int ry, int cx, int cy);
+};
+
+#endif
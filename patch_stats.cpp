@@ -0,0 +1,119 @@
+#include <iostream>
+#include "patch_stats.h"
+
+template <typename ImageType>
+PatchStats<ImageType>::PatchStats(int psize_, int pstep_, int w_, int back_)
+	: psize(psize_), pstep(pstep_), w(w_), back(back_), row(-1), sum(0), sqr(0), dif(0), x(0)
+{
+	col_sum = new AccType[w];
+	col_sqr = new AccType[w];
+	col_dif = new AccType[w];
+}
+
+template <typename ImageType>
+PatchStats<ImageType>::~PatchStats()
+{
+	delete[] col_sum;
+	delete[] col_sqr;
+	delete[] col_dif;
+}
+
+template <typename ImageType>
+void PatchStats<ImageType>::reset()
+{
+	row = -1;
+}
+
+/* The columns out of the plane are replicated as the PlaneView does, so their differences are zeros.
+ * The subtraction of the unsigned sums wraps around, but the results are exact as the sums themselves never overflow.
+ */
+template <typename ImageType>
+void PatchStats<ImageType>::accumulate(const PlaneView<ImageType> &image, int y0, int y1, int sign)
+{
+	int n = w < image.w_ext ? w : image.w_ext;
+	for (int y = y0; y < y1; y++)
+	{
+		const ImageType *r = image.row(y);
+		for (int c = 0; c < n; c++)
+		{
+			AccType v = r[c < image.w ? c : image.w - 1];
+			AccType d = c + 1 < image.w ? (r[c + 1] > r[c] ? r[c + 1] - r[c] : r[c] - r[c + 1]) : 0;
+			if (sign > 0) {
+				col_sum[c] += v;
+				col_sqr[c] += v * v;
+				col_dif[c] += d * d;
+			}
+			else {
+				col_sum[c] -= v;
+				col_sqr[c] -= v * v;
+				col_dif[c] -= d * d;
+			}
+		}
+	}
+}
+
+template <typename ImageType>
+void PatchStats<ImageType>::start_line(const PlaneView<ImageType> &image, int ry)
+{
+	if (row >= 0 && ry - row == pstep && pstep <= psize && pstep <= back)
+	{
+		// the line overlaps the last one except the top/bottom (pstep) rows
+		accumulate(image, row, ry, -1);
+		accumulate(image, row + psize, ry + psize, 1);
+	}
+	else
+	{
+		memset(col_sum, 0, w * sizeof(AccType));
+		memset(col_sqr, 0, w * sizeof(AccType));
+		memset(col_dif, 0, w * sizeof(AccType));
+		accumulate(image, ry, ry + psize, 1);
+	}
+	row = ry;
+
+	x = 0;
+	sum = 0;
+	sqr = 0;
+	dif = 0;
+	for (int c = 0; c < psize; c++)
+	{
+		sum += col_sum[c];
+		sqr += col_sqr[c];
+		if (c < psize - 1) dif += col_dif[c];
+	}
+}
+
+template <typename ImageType>
+void PatchStats<ImageType>::next_patch()
+{
+	for (int c = x; c < x + pstep; c++)
+	{
+		// the columns beyond the sums are never used by a reference patch
+		if (c + psize < w) {
+			sum += col_sum[c + psize];
+			sqr += col_sqr[c + psize];
+		}
+		if (c + psize - 1 < w) dif += col_dif[c + psize - 1];
+		sum -= col_sum[c];
+		sqr -= col_sqr[c];
+		dif -= col_dif[c];
+	}
+	x += pstep;
+}
+
+template <typename ImageType>
+double PatchStats<ImageType>::variance() const
+{
+	double n = psize * psize;
+	double mean = sum / n;
+	return sqr / n - mean * mean;
+}
+
+// the difference of two neighbours of the noise is 2 * sigma^2
+template <typename ImageType>
+double PatchStats<ImageType>::noise() const
+{
+	return psize > 1 ? dif / (2.0 * psize * (psize - 1)) : 0;
+}
+
+template struct PatchStats<uint8_t>;
+template struct PatchStats<uint16_t>;
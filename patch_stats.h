@@ -0,0 +1,58 @@
+#ifndef __PATCH_STATS_H__
+#define __PATCH_STATS_H__
+
+#include <iostream>
+
+#include "global_define.h"
+#include "plane_view.h"
+
+/* Running sums of the samples, the squared samples and the squared differences of the horizontal neighbours
+ * of a line of reference patches, which give the variance and the noise of each reference patch at a constant cost.
+ * The column sums over the (psize) rows of the line are updated incrementally when stepping downward (pstep rows),
+ * and the sums of the reference patch are slid along the line when stepping forward (pstep columns).
+ * Stepping downward subtracts the rows leaving the line, so the sums are recomputed instead 
+ * when those rows may be gone, i.e. more than (back) rows above the line, e.g. out of the ring of a row source.
+ */
+template <typename ImageType>
+struct PatchStats
+{
+	typedef typename SampleTraits<ImageType>::AccType AccType;
+
+	int psize;				// patch size
+	int pstep;				// reference patch step
+	int w;					// number of columns of the sums
+	int back;				// rows above the line still readable, e.g. the vertical search window radius
+
+	AccType *col_sum;		// sums of the samples of each column of the line
+	AccType *col_sqr;		// sums of the squared samples of each column of the line
+	AccType *col_dif;		// sums of the squared differences between each column and the next one of the line
+	int row;				// top row of the column sums, -1 if there is no valid line
+
+	AccType sum;			// sum of the samples of the current reference patch
+	AccType sqr;			// sum of the squared samples of the current reference patch
+	AccType dif;			// sum of the squared differences of the horizontal neighbours of the current reference patch
+	int x;					// column of the current reference patch
+
+	PatchStats(int psize_, int pstep_, int w_, int back_);
+	~PatchStats();
+
+	// invalidate the column sums, e.g. for a new image
+	void reset();
+
+	// update the column sums for the line of reference patches at the row (ry), and restart from the first patch
+	void start_line(const PlaneView<ImageType> &image, int ry);
+
+	// step forward to the next reference patch, (pstep) right to the current one
+	void next_patch();
+
+	// variance of the samples of the current reference patch
+	double variance() const;
+
+	// variance of the noise of the current reference patch, estimated by the differences of the horizontal neighbours
+	double noise() const;
+
+	// add the rows [y0, y1) of the image to the column sums (sign > 0) or subtract them (sign < 0)
+	void accumulate(const PlaneView<ImageType> &image, int y0, int y1, int sign);
+};
+
+#endif
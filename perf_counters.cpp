@@ -0,0 +1,145 @@
+#include "perf_counters.h"
+
+#if USE_PERF_COUNTERS && defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define PERF_EVENT_OPEN			1
+#else
+#define PERF_EVENT_OPEN			0
+#endif
+
+const char *const PerfCounters::stage_names[PERF_STAGES] = {"grouping", "filtering", "aggregation", "shift"};
+
+PerfCounters::PerfCounters()
+{
+	state = USE_PERF_COUNTERS ? 0 : -1;
+	nopen = 0;
+	tstart = 0;
+	for (int e = 0; e < PERF_EVENTS; e++)
+	{
+		fds[e] = -1;
+		start[e] = 0;
+	}
+	reset();
+}
+
+PerfCounters::~PerfCounters()
+{
+#if PERF_EVENT_OPEN
+	for (int e = PERF_EVENTS - 1; e >= 0; e--)
+	{
+		if (fds[e] >= 0) close(fds[e]);
+	}
+#endif
+}
+
+void PerfCounters::reset()
+{
+	memset(counts, 0, sizeof(counts));
+}
+
+#if PERF_EVENT_OPEN
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = group_fd < 0;		// the group is enabled at once by the leader
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result)
+{
+	return cache | (op << 8) | (result << 16);
+}
+#endif
+
+/* The cycles are the group leader, without which nothing is counted.
+ * The L2 misses have no generic event, so the LLC references are counted instead,
+ * which are the requests missing the L2 cache on most hosts.
+ */
+void PerfCounters::open()
+{
+	state = -1;
+#if PERF_EVENT_OPEN
+	static const uint32_t types[PERF_EVENTS] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+	};
+	const uint64_t configs[PERF_EVENTS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+		PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	for (int e = 0; e < PERF_EVENTS; e++)
+	{
+		fds[e] = open_event(types[e], configs[e], e == 0 ? -1 : fds[0]);
+		if (fds[0] < 0)
+		{
+			std::cout << "perf_event_open failed, the hardware counters are disabled" << std::endl;
+			return;
+		}
+		nopen += fds[e] >= 0;
+	}
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	state = 1;
+#endif
+}
+
+/* The values of the group are in the order of the events opened. */
+void PerfCounters::read_events(uint64_t *values)
+{
+#if PERF_EVENT_OPEN
+	uint64_t buf[1 + PERF_EVENTS];
+	if (read(fds[0], buf, sizeof(buf)) < (ssize_t)((1 + nopen) * sizeof(uint64_t))) return;
+	for (int e = 0, k = 1; e < PERF_EVENTS; e++)
+	{
+		values[e] = fds[e] >= 0 ? buf[k++] : 0;
+	}
+#endif
+}
+
+void PerfCounters::report(const char *name) const
+{
+	if (state <= 0) return;
+
+	static const char *events[PERF_EVENTS] = {"cycles", "instructions", "L1D-miss", "LLC-ref", "LLC-miss", "br-miss"};
+	char line[256];
+
+	std::cout << name << " counters:" << std::endl;
+	int n = sprintf(line, "%-12s", "stage");
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		n += sprintf(line + n, " %14s", events[e]);
+	}
+	sprintf(line + n, " %6s %9s %9s", "IPC", "L1D/kI", "LLC/kI");
+	std::cout << line << std::endl;
+
+	for (int s = 0; s < PERF_STAGES; s++)
+	{
+		n = sprintf(line, "%-12s", stage_names[s]);
+		for (int e = 0; e < PERF_EVENTS; e++)
+		{
+			if (available(e))
+				n += sprintf(line + n, " %14llu", (unsigned long long)counts[s][e]);
+			else
+				n += sprintf(line + n, " %14s", "n/a");
+		}
+
+		// the instructions per cycle, and the misses per kilo-instructions
+		double kinst = counts[s][PERF_INSTRUCTIONS] / 1000.0;
+		sprintf(line + n, " %6.2f %9.2f %9.2f",
+			counts[s][PERF_CYCLES] ? (double)counts[s][PERF_INSTRUCTIONS] / counts[s][PERF_CYCLES] : 0.0,
+			kinst > 0 ? counts[s][PERF_L1D_MISSES] / kinst : 0.0,
+			kinst > 0 ? counts[s][PERF_LLC_MISSES] / kinst : 0.0);
+		std::cout << line << std::endl;
+	}
+}
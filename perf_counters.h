@@ -0,0 +1,94 @@
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <iostream>
+#include "global_define.h"
+#include "trace.h"
+
+#define PERF_STAGE_GROUPING		0		// block-matching and the patches of the group
+#define PERF_STAGE_FILTERING	1		// transforms and shrinkage of the group
+#define PERF_STAGE_AGGREGATION	2		// aggregation of the group into the line buffers
+#define PERF_STAGE_SHIFT		3		// shift of the numerator/denominator line buffers
+#define PERF_STAGES				4
+
+#define PERF_CYCLES				0		// CPU cycles
+#define PERF_INSTRUCTIONS		1		// retired instructions
+#define PERF_L1D_MISSES			2		// L1 data cache read misses
+#define PERF_LLC_REFERENCES		3		// last level cache references, i.e. the L2 misses on most hosts
+#define PERF_LLC_MISSES			4		// last level cache misses
+#define PERF_BRANCH_MISSES		5		// mispredicted branches
+#define PERF_EVENTS				6
+
+/* Hardware performance counters of each stage of the pipeline, by the Linux perf_event_open.
+ * The counters are opened by the thread which first begins a stage, i.e. the thread running the engine,
+ * and only count that thread, so the work of the other OpenMP threads in the grouping or the aggregation
+ * is not counted (run with OMP_THREAD_LIMIT=1 to count all the work of a stage).
+ * The kernel and hypervisor events are excluded, so that the counters work with perf_event_paranoid <= 2.
+ * If the counters are disabled (USE_PERF_COUNTERS), begin() and end() only record the spans of the stages to the trace,
+ * if it's being recorded (USE_TRACE).
+ * An event which is not supported by the host, e.g. the cache events in a virtual machine, is reported as n/a.
+ */
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	// start counting a stage
+	void begin(int stage)
+	{
+#if USE_PERF_COUNTERS
+		if (state == 0) open();
+		if (state > 0) read_events(start);
+#endif
+#if USE_TRACE
+		tstart = trace_begin();
+#endif
+	}
+
+	// stop counting a stage, and add the events since begin() to it, and its span to the trace (USE_TRACE)
+	void end(int stage)
+	{
+#if USE_TRACE
+		trace_span(stage_names[stage], tstart);
+#endif
+#if USE_PERF_COUNTERS
+		if (state <= 0) return;
+		uint64_t now[PERF_EVENTS];
+		read_events(now);
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			counts[stage][e] += now[e] - start[e];
+		}
+#endif
+	}
+
+	// clear the counts of all the stages, e.g. for a new frame
+	void reset();
+
+	// count of an event of a stage
+	uint64_t count(int stage, int event) const { return counts[stage][event]; }
+
+	// whether the event is counted on the host
+	bool available(int event) const { return state > 0 && fds[event] >= 0; }
+
+	// print the counts of the stages and the derived ratios, e.g. the IPC and the misses per kilo-instructions
+	void report(const char *name) const;
+
+protected:
+	// open the events of the calling thread as a group
+	void open();
+
+	// read all the events at once
+	void read_events(uint64_t *values);
+
+	int state;				// 0 if not opened yet, 1 if opened, -1 if failed or disabled
+	int fds[PERF_EVENTS];	// file descriptors of the events, -1 if not supported, the first one is the group leader
+	int nopen;				// number of the events opened, in the order of the (fds)
+	uint64_t start[PERF_EVENTS];				// counts at the beginning of the current stage
+	uint64_t counts[PERF_STAGES][PERF_EVENTS];	// accumulated counts of each stage
+	double tstart;			// beginning of the span of the current stage in the trace
+
+	static const char *const stage_names[PERF_STAGES];
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __PLANE_VIEW_H__
+#define __PLANE_VIEW_H__
+
+#include <iostream>
+#include "global_define.h"
+
+/* Read-only view of a caller-owned image plane with an arbitrary stride.
+ * The plane is read in place, and the border needed by the search window is addressed virtually,
+ * which is the same as the padded copy of the image used before: 
+ * the last row/column is replicated to complete the last reference step, and the remains are zeros.
+ * Most of the patches lie inside the plane, and only those in a small band along the border 
+ * have to be read pixel by pixel with the clamped addressing.
+ */
+template <typename ImageType>
+struct PlaneView
+{
+	const ImageType *data;	// top-left pixel of the plane
+	int stride;				// distance (in pixels) between two adjacent rows
+	int w;					// plane width
+	int h;					// plane height
+	int w_ext;				// plane width with the replicated columns
+	int h_ext;				// plane height with the replicated rows
+	const ImageType *zeros;	// a row of (w) zeros, used for the rows out of the plane
+	int ring;				// rows of the ring buffer if only the latest rows of the plane are kept, 0 for a whole plane
+
+	PlaneView() : data(NULL), stride(0), w(0), h(0), w_ext(0), h_ext(0), zeros(NULL), ring(0) {}
+
+	PlaneView(const ImageType *data_, int stride_, int w_, int h_, int w_ext_, int h_ext_, const ImageType *zeros_, int ring_ = 0)
+		: data(data_), stride(stride_), w(w_), h(h_), w_ext(w_ext_), h_ext(h_ext_), zeros(zeros_), ring(ring_) {}
+
+	// row (y) of the plane, where (y) can be out of the plane
+	const ImageType *row(int y) const
+	{
+		if (y < 0 || y >= h_ext) return zeros;
+		y = y < h ? y : h - 1;
+		return data + (ring ? y % ring : y) * stride;
+	}
+
+	// pixel (x, y) of the plane, where (x, y) can be out of the plane
+	ImageType at(int x, int y) const
+	{
+		if (x < 0 || x >= w_ext) return 0;
+		return row(y)[x < w ? x : w - 1];
+	}
+
+	// whether the columns [x0, x1) are inside the plane, so that they can be read from the rows directly
+	bool inside(int x0, int x1) const
+	{
+		return x0 >= 0 && x1 <= w;
+	}
+};
+
+/* Writable plane of the output image, with the same ring addressing as the PlaneView. */
+template <typename ImageType>
+struct PlaneOut
+{
+	ImageType *data;		// top-left pixel of the plane
+	int stride;				// distance (in pixels) between two adjacent rows
+	int ring;				// rows of the ring buffer, 0 for a whole plane
+	int top;				// image row of the first row of (data) if only a window of rows is kept, 0 for a whole plane or a ring
+
+	PlaneOut() : data(NULL), stride(0), ring(0), top(0) {}
+
+	PlaneOut(ImageType *data_, int stride_, int ring_ = 0, int top_ = 0)
+		: data(data_), stride(stride_), ring(ring_), top(top_) {}
+
+	// row (y) of the plane, y >= top
+	ImageType *row(int y) const { return data + (ring ? y % ring : y - top) * stride; }
+};
+
+#endif
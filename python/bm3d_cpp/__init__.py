@@ -0,0 +1,71 @@
+"""BM3D denoising of NumPy images in place, without the YUV files of main.cpp.
+
+A grayscale image is a (H, W) array, and a colour one is either a (3, H, W) array
+of the Y/U/V planes, or a (H, W, 3) array of packed RGB/BGR pixels with format='rgb'
+or 'bgr', which is denoised as YCbCr. The samples are uint8, or uint16 for the bit
+depths above 8, and the sigmas are in the unit of the samples.
+
+An object keeps its engine across the calls, so it should be reused for the images
+of the same size, e.g. a dataset. The GIL is released while an image is denoised,
+so the images can be denoised by threads, with an object per thread.
+
+    step1, step2 = CBM3D(), CBM3D_WIE()
+    basic = step1.denoise(img, 36, format='bgr')
+    clean = step2.denoise(img, 25, basic, format='bgr')
+"""
+import numpy as np
+
+from ._engine import Engine
+
+__all__ = ['BM3D', 'CBM3D', 'BM3D_WIE', 'CBM3D_WIE']
+
+
+class _Step(object):
+    kind = None
+
+    def __init__(self, bit_depth=8, max_sim=16, pstep=3, swinr=16, sstep=1):
+        self.engine = Engine(self.kind, bit_depth, max_sim, pstep, swinr, sstep)
+
+    def _denoise(self, noisy, sigma, basic, out, max_mdist, sigmau, sigmav, format):
+        if out is None:
+            out = np.empty_like(noisy)
+        self.engine.denoise(noisy, out, sigma, basic, max_mdist, sigmau, sigmav, format)
+        return out
+
+
+class BM3D(_Step):
+    """First step (hard-thresholding) of the grayscale images."""
+    kind = 'BM3D'
+
+    def denoise(self, noisy, sigma, out=None, max_mdist=2500):
+        return self._denoise(noisy, sigma, None, out, max_mdist, -1, -1, None)
+
+
+class CBM3D(_Step):
+    """First step (hard-thresholding) of the colour images."""
+    kind = 'CBM3D'
+
+    def denoise(self, noisy, sigma, out=None, max_mdist=2500, sigmau=-1, sigmav=-1, format=None):
+        return self._denoise(noisy, sigma, None, out, max_mdist, sigmau, sigmav, format)
+
+
+class BM3D_WIE(_Step):
+    """Second step (Wiener filtering) of the grayscale images, with the result of the first step as the basic estimate."""
+    kind = 'BM3D_WIE'
+
+    def __init__(self, bit_depth=8, max_sim=32, pstep=3, swinr=16, sstep=1):
+        _Step.__init__(self, bit_depth, max_sim, pstep, swinr, sstep)
+
+    def denoise(self, noisy, sigma, basic, out=None, max_mdist=2500):
+        return self._denoise(noisy, sigma, basic, out, max_mdist, -1, -1, None)
+
+
+class CBM3D_WIE(_Step):
+    """Second step (Wiener filtering) of the colour images, with the result of the first step as the basic estimate."""
+    kind = 'CBM3D_WIE'
+
+    def __init__(self, bit_depth=8, max_sim=32, pstep=3, swinr=16, sstep=1):
+        _Step.__init__(self, bit_depth, max_sim, pstep, swinr, sstep)
+
+    def denoise(self, noisy, sigma, basic, out=None, max_mdist=2500, sigmau=-1, sigmav=-1, format=None):
+        return self._denoise(noisy, sigma, basic, out, max_mdist, sigmau, sigmav, format)
@@ -0,0 +1,413 @@
+/* Python binding of the engines, i.e. the extension module bm3d_cpp._engine.
+ * The images are passed by the buffer protocol (e.g. NumPy arrays) and read or written in place without any copy:
+ * a grayscale image is a (H, W) array, and a colour one is either a (3, H, W) array of the Y/U/V planes
+ * or a (H, W, 3) array of packed RGB/BGR pixels, where the rows can have any stride.
+ * The engine of an object is kept across the calls and rebuilt only if the size of the image changes,
+ * and the GIL is released while the image is denoised.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string.h>
+
+#include "bm3d.h"
+#include "bm3d_wiener.h"
+#include "cbm3d.h"
+#include "cbm3d_wiener.h"
+
+#define KIND_BM3D		0		// first step for grayscale images
+#define KIND_BM3D_WIE	1		// second step for grayscale images
+#define KIND_CBM3D		2		// first step for colour images
+#define KIND_CBM3D_WIE	3		// second step for colour images
+
+#define LAYOUT_GRAY		0		// (H, W) grayscale image
+#define LAYOUT_PLANAR	1		// (3, H, W) Y/U/V planes
+#define LAYOUT_PACKED	2		// (H, W, 3) packed RGB/BGR pixels
+
+static const char *kind_names[4] = {"BM3D", "BM3D_WIE", "CBM3D", "CBM3D_WIE"};
+
+/* Engines of one sample type, only one of which is used by an object. */
+template <typename ImageType>
+struct Engines
+{
+	BM3D_T<ImageType> *step1;		// BM3D or CBM3D
+	BM3D_WIE_T<ImageType> *step2;	// BM3D_WIE or CBM3D_WIE
+};
+
+typedef struct
+{
+	PyObject_HEAD
+	int kind;				// KIND_BM3D, KIND_BM3D_WIE, KIND_CBM3D or KIND_CBM3D_WIE
+	int bit_depth;			// bit depth of the samples, the 16-bit engines are used if above 8
+	int max_sim;			// maximum similar patches
+	int pstep;				// reference patch step
+	int swinr;				// search window radius
+	int sstep;				// search step
+	int w;					// width of the engine, 0 if not built yet
+	int h;					// height of the engine
+	int busy;				// the engine is denoising an image with the GIL released
+	Engines<uint8_t> e8;	// 8-bit engines
+	Engines<uint16_t> e16;	// 9 to 16-bit engines
+} EngineObject;
+
+template <typename ImageType> Engines<ImageType> &engines(EngineObject *self);
+template <> Engines<uint8_t>  &engines<uint8_t>(EngineObject *self)  { return self->e8; }
+template <> Engines<uint16_t> &engines<uint16_t>(EngineObject *self) { return self->e16; }
+
+/* An image passed to denoise(), located by its first sample and its strides (in samples). */
+struct Image
+{
+	Py_buffer view;
+	char *data;				// first sample
+	Py_ssize_t sp;			// stride of the planes, 0 for the grayscale and packed images
+	Py_ssize_t sy;			// stride of the rows
+	int w;
+	int h;
+};
+
+/* Arguments of a call shared by all the engines. */
+struct Call
+{
+	int layout;				// LAYOUT_GRAY, LAYOUT_PLANAR or LAYOUT_PACKED
+	int format;				// FRAME_FORMAT_RGB or FRAME_FORMAT_BGR for the packed images
+	int sigma;
+	int sigmau;
+	int sigmav;
+	DistType max_mdist;
+};
+
+template <typename ImageType>
+static void free_engines(Engines<ImageType> &e)
+{
+	delete e.step1;
+	delete e.step2;
+	e.step1 = NULL;
+	e.step2 = NULL;
+}
+
+template <typename ImageType>
+static void build_engines(EngineObject *self, int w, int h)
+{
+	Engines<ImageType> &e = engines<ImageType>(self);
+	free_engines(e);
+
+	// at present the psize must be 8
+	int s = self->swinr, t = self->sstep, d = self->bit_depth, n = self->max_sim, p = self->pstep;
+	switch (self->kind)
+	{
+	case KIND_BM3D:      e.step1 = new BM3D_T<ImageType>(w, h, n, 8, p, s, t, s, t, d); break;
+	case KIND_CBM3D:     e.step1 = new CBM3D_T<ImageType>(w, h, n, 8, p, s, t, s, t, d); break;
+	case KIND_BM3D_WIE:  e.step2 = new BM3D_WIE_T<ImageType>(w, h, n, 8, p, s, t, s, t, d); break;
+	case KIND_CBM3D_WIE: e.step2 = new CBM3D_WIE_T<ImageType>(w, h, n, 8, p, s, t, s, t, d); break;
+	}
+}
+
+/* Denoise a whole image, called without the GIL. */
+template <typename ImageType>
+static void run_engine(EngineObject *self, const Call &c, const Image &noisy, const Image *basic, Image &out)
+{
+	Engines<ImageType> &e = engines<ImageType>(self);
+
+	const ImageType *in[3], *bs[3];
+	int in_strides[3], bs_strides[3];
+	PlaneOut<ImageType> po[3];
+	for (int i = 0; i < 3; i++)
+	{
+		in[i] = (const ImageType *)noisy.data + i * noisy.sp;
+		in_strides[i] = (int)noisy.sy;
+		po[i] = PlaneOut<ImageType>((ImageType *)out.data + i * out.sp, (int)out.sy);
+		if (basic)
+		{
+			bs[i] = (const ImageType *)basic->data + i * basic->sp;
+			bs_strides[i] = (int)basic->sy;
+		}
+	}
+	ImageType *op = (ImageType *)out.data;
+	int op_stride = (int)out.sy;
+
+	switch (self->kind)
+	{
+	case KIND_BM3D:
+		e.step1->load_planes(in, in_strides, c.sigma, c.max_mdist);
+		while (e.step1->next_line_planes(po) >= 0);
+		break;
+
+	case KIND_BM3D_WIE:
+		e.step2->load_planes(in, in_strides, bs, bs_strides, c.sigma, c.max_mdist);
+		while (e.step2->next_line_planes(po) >= 0);
+		break;
+
+	case KIND_CBM3D:
+	{
+		CBM3D_T<ImageType> *cb = static_cast<CBM3D_T<ImageType> *>(e.step1);
+		if (c.layout == LAYOUT_PACKED)
+		{
+			cb->load_packed(in, in_strides, c.format, c.sigma, c.max_mdist, c.sigmau, c.sigmav);
+			while (cb->next_line_packed(&op, &op_stride) >= 0);
+		}
+		else
+		{
+			cb->load_planes(in, in_strides, c.sigma, c.max_mdist, c.sigmau, c.sigmav);
+			while (cb->next_line_planes(po) >= 0);
+		}
+		break;
+	}
+
+	case KIND_CBM3D_WIE:
+	{
+		CBM3D_WIE_T<ImageType> *cw = static_cast<CBM3D_WIE_T<ImageType> *>(e.step2);
+		if (c.layout == LAYOUT_PACKED)
+		{
+			cw->load_packed(in, in_strides, bs, bs_strides, c.format, c.sigma, c.max_mdist, c.sigmau, c.sigmav);
+			while (cw->next_line_packed(&op, &op_stride) >= 0);
+		}
+		else
+		{
+			cw->load_planes(in, in_strides, bs, bs_strides, c.sigma, c.max_mdist, c.sigmau, c.sigmav);
+			while (cw->next_line_planes(po) >= 0);
+		}
+		break;
+	}
+	}
+}
+
+/* Get the buffer of an image and check its sample type and layout. Returns false with an exception set if not valid. */
+static bool get_image(PyObject *obj, const char *name, bool writable, int itemsize, int layout, Image &img)
+{
+	int flags = PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+	if (PyObject_GetBuffer(obj, &img.view, flags) < 0) return false;
+
+	Py_buffer &v = img.view;
+	const char *fmt = v.format ? v.format : "B";
+	char type = fmt[strlen(fmt) - 1];
+	if (v.itemsize != itemsize || (type != 'B' && type != 'H'))
+	{
+		PyErr_Format(PyExc_TypeError, "%s: expected %s samples", name, itemsize == 1 ? "uint8" : "uint16");
+		PyBuffer_Release(&v);
+		return false;
+	}
+
+	// the samples of a row must be contiguous, or interleaved by 3 for the packed pixels
+	bool ok = false;
+	Py_ssize_t ys = 0, xs = 1;
+	if (layout == LAYOUT_GRAY && v.ndim == 2)
+	{
+		ok = v.strides[1] == itemsize;
+		img.h = (int)v.shape[0], img.w = (int)v.shape[1];
+		img.sp = 0, ys = v.strides[0];
+	}
+	else if (layout == LAYOUT_PLANAR && v.ndim == 3 && v.shape[0] == 3)
+	{
+		ok = v.strides[2] == itemsize && v.strides[0] > 0 && v.strides[0] % itemsize == 0;
+		img.h = (int)v.shape[1], img.w = (int)v.shape[2];
+		img.sp = v.strides[0] / itemsize, ys = v.strides[1];
+	}
+	else if (layout == LAYOUT_PACKED && v.ndim == 3 && v.shape[2] == 3)
+	{
+		ok = v.strides[2] == itemsize && v.strides[1] == 3 * itemsize;
+		img.h = (int)v.shape[0], img.w = (int)v.shape[1];
+		img.sp = 0, ys = v.strides[0], xs = 3;
+	}
+	ok = ok && ys > 0 && ys % itemsize == 0 && ys / itemsize >= xs * (Py_ssize_t)img.w && ys / itemsize <= INT_MAX;
+	if (!ok)
+	{
+		static const char *shapes[3] = {"(H, W)", "(3, H, W)", "(H, W, 3)"};
+		PyErr_Format(PyExc_ValueError, "%s: expected a %s array whose rows are contiguous", name, shapes[layout]);
+		PyBuffer_Release(&v);
+		return false;
+	}
+	img.sy = ys / itemsize;
+	img.data = (char *)v.buf;
+	return true;
+}
+
+/* Engine(kind, bit_depth=8, max_sim=16, pstep=3, swinr=16, sstep=1) */
+static int Engine_init(EngineObject *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"kind", "bit_depth", "max_sim", "pstep", "swinr", "sstep", NULL};
+	const char *kind;
+	int bit_depth = 8, max_sim = 16, pstep = 3, swinr = 16, sstep = 1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iiiii", (char **)kwlist, &kind, &bit_depth, &max_sim, &pstep, &swinr, &sstep))
+		return -1;
+	if (self->busy)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "engine is busy");
+		return -1;
+	}
+
+	self->kind = -1;
+	for (int i = 0; i < 4; i++)
+	{
+		if (strcmp(kind, kind_names[i]) == 0) self->kind = i;
+	}
+	if (self->kind < 0)
+	{
+		PyErr_Format(PyExc_ValueError, "unknown engine '%s'", kind);
+		return -1;
+	}
+	if (bit_depth < 1 || bit_depth > 16 || max_sim < 1 || pstep < 1 || pstep > 8 || swinr < 0 || sstep < 1)
+	{
+		PyErr_SetString(PyExc_ValueError, "invalid engine parameters");
+		return -1;
+	}
+	free_engines(self->e8);
+	free_engines(self->e16);
+	self->bit_depth = bit_depth;
+	self->max_sim = max_sim;
+	self->pstep = pstep;
+	self->swinr = swinr;
+	self->sstep = sstep;
+	self->w = 0;
+	self->h = 0;
+	return 0;
+}
+
+static void Engine_dealloc(EngineObject *self)
+{
+	free_engines(self->e8);
+	free_engines(self->e16);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* denoise(noisy, out, sigma, basic=None, max_mdist=2500, sigmau=-1, sigmav=-1, format=None) */
+static PyObject *Engine_denoise(EngineObject *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"noisy", "out", "sigma", "basic", "max_mdist", "sigmau", "sigmav", "format", NULL};
+	PyObject *noisy_obj, *out_obj, *basic_obj = Py_None;
+	unsigned long long max_mdist = 2500;
+	const char *format = NULL;
+	Call c;
+	c.sigmau = -1;
+	c.sigmav = -1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOi|OKiiz", (char **)kwlist,
+		&noisy_obj, &out_obj, &c.sigma, &basic_obj, &max_mdist, &c.sigmau, &c.sigmav, &format))
+		return NULL;
+	c.max_mdist = max_mdist;
+
+	if (self->kind < 0 || self->bit_depth == 0)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "engine not initialized");
+		return NULL;
+	}
+	if (self->busy)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "engine is busy, use an engine per thread");
+		return NULL;
+	}
+
+	bool colour = self->kind == KIND_CBM3D || self->kind == KIND_CBM3D_WIE;
+	bool wiener = self->kind == KIND_BM3D_WIE || self->kind == KIND_CBM3D_WIE;
+	c.layout = colour ? LAYOUT_PLANAR : LAYOUT_GRAY;
+	c.format = 0;
+	if (format)
+	{
+		if (!colour || (strcmp(format, "rgb") != 0 && strcmp(format, "bgr") != 0))
+		{
+			PyErr_SetString(PyExc_ValueError, "format must be 'rgb' or 'bgr', for the colour engines only");
+			return NULL;
+		}
+		c.layout = LAYOUT_PACKED;
+		c.format = strcmp(format, "rgb") == 0 ? FRAME_FORMAT_RGB : FRAME_FORMAT_BGR;
+	}
+	if (wiener != (basic_obj != Py_None))
+	{
+		PyErr_SetString(PyExc_ValueError, wiener ? "the basic estimate is required" : "the basic estimate is for the second step only");
+		return NULL;
+	}
+
+	int itemsize = self->bit_depth > 8 ? 2 : 1;
+	Image noisy, basic, out;
+	if (!get_image(noisy_obj, "noisy", false, itemsize, c.layout, noisy)) return NULL;
+	if (!get_image(out_obj, "out", true, itemsize, c.layout, out))
+	{
+		PyBuffer_Release(&noisy.view);
+		return NULL;
+	}
+	if (wiener && !get_image(basic_obj, "basic", false, itemsize, c.layout, basic))
+	{
+		PyBuffer_Release(&noisy.view);
+		PyBuffer_Release(&out.view);
+		return NULL;
+	}
+
+	const char *error = NULL;
+	if (out.w != noisy.w || out.h != noisy.h || (wiener && (basic.w != noisy.w || basic.h != noisy.h)))
+		error = "the images must have the same size";
+	else if (noisy.w < 8 || noisy.h < 8)
+		error = "the images must be 8x8 at least";
+
+	if (error == NULL)
+	{
+		// the engine is rebuilt only if the size of the image changes
+		self->busy = 1;
+		Py_BEGIN_ALLOW_THREADS
+		if (noisy.w != self->w || noisy.h != self->h)
+		{
+			if (itemsize == 1)
+				build_engines<uint8_t>(self, noisy.w, noisy.h);
+			else
+				build_engines<uint16_t>(self, noisy.w, noisy.h);
+			self->w = noisy.w;
+			self->h = noisy.h;
+		}
+		if (itemsize == 1)
+			run_engine<uint8_t>(self, c, noisy, wiener ? &basic : NULL, out);
+		else
+			run_engine<uint16_t>(self, c, noisy, wiener ? &basic : NULL, out);
+		Py_END_ALLOW_THREADS
+		self->busy = 0;
+	}
+
+	PyBuffer_Release(&noisy.view);
+	PyBuffer_Release(&out.view);
+	if (wiener) PyBuffer_Release(&basic.view);
+
+	if (error)
+	{
+		PyErr_SetString(PyExc_ValueError, error);
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef Engine_methods[] = {
+	{"denoise", (PyCFunction)Engine_denoise, METH_VARARGS | METH_KEYWORDS,
+	 "denoise(noisy, out, sigma, basic=None, max_mdist=2500, sigmau=-1, sigmav=-1, format=None)\n"
+	 "Denoise the image (noisy) into (out), with the basic estimate for the second step."},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject EngineType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"bm3d_cpp._engine.Engine",		// tp_name
+	sizeof(EngineObject),			// tp_basicsize
+};
+
+static struct PyModuleDef engine_module = {
+	PyModuleDef_HEAD_INIT,
+	"_engine",
+	"BM3D engines operating on buffers in place.",
+	-1,
+	NULL
+};
+
+PyMODINIT_FUNC PyInit__engine(void)
+{
+	EngineType.tp_dealloc = (destructor)Engine_dealloc;
+	EngineType.tp_flags = Py_TPFLAGS_DEFAULT;
+	EngineType.tp_doc = "Engine(kind, bit_depth=8, max_sim=16, pstep=3, swinr=16, sstep=1)";
+	EngineType.tp_methods = Engine_methods;
+	EngineType.tp_init = (initproc)Engine_init;
+	EngineType.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&EngineType) < 0) return NULL;
+
+	PyObject *m = PyModule_Create(&engine_module);
+	if (m == NULL) return NULL;
+	Py_INCREF(&EngineType);
+	if (PyModule_AddObject(m, "Engine", (PyObject *)&EngineType) < 0)
+	{
+		Py_DECREF(&EngineType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
+}
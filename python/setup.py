@@ -0,0 +1,23 @@
+# Build the Python binding in place with:  python setup.py build_ext --inplace
+# or install it with:                      pip install .
+import os
+import sys
+from setuptools import setup, Extension
+
+root = os.path.join('..')
+sources = ['engine.cpp'] + [os.path.join(root, f) for f in sorted(os.listdir(root))
+                            if f.endswith('.cpp') and f != 'main.cpp']
+
+if sys.platform == 'win32':
+    cflags, lflags = ['/O2', '/openmp'], []
+else:
+    cflags, lflags = ['-O3', '-fopenmp'], ['-fopenmp']
+
+setup(
+    name='bm3d_cpp',
+    version='1.0',
+    description='BM3D denoising of NumPy images in place',
+    packages=['bm3d_cpp'],
+    ext_modules=[Extension('bm3d_cpp._engine', sources, include_dirs=[root],
+                           extra_compile_args=cflags, extra_link_args=lflags, language='c++')],
+)
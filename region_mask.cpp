@@ -0,0 +1,159 @@
+#include <iostream>
+#include "region_mask.h"
+#include "kernels.h"
+
+#define MAX_REGION_CHANNELS		3		// channels of an output row, e.g. the Y/U/V
+
+RegionMask::RegionMask(int w_, int h_, int psize_, int pstep_)
+	: w(w_), h(h_), psize(psize_), pstep(pstep_), enabled(false), halo(0), mask(NULL), stride(0), ry0(0), ry1(0),
+	crop(false), cx0(0), cx1(w_)
+{
+	nrefs = w > psize ? (w - psize + pstep - 1) / pstep + 1 : 1;
+	rect_row = new uint8_t[w]();
+	zero_row = new uint8_t[w]();
+	col_sum  = new int[w + 1];
+	ref_on   = new uint8_t[nrefs];
+}
+
+RegionMask::~RegionMask()
+{
+	delete[] rect_row;
+	delete[] zero_row;
+	delete[] col_sum;
+	delete[] ref_on;
+}
+
+void RegionMask::set_mask(const uint8_t *mask_, int stride_, int halo_)
+{
+	enabled = mask_ != NULL;
+	crop = false;
+	mask = mask_;
+	stride = stride_;
+	halo = halo_;
+}
+
+void RegionMask::set_roi(int x, int y, int rw, int rh, int halo_)
+{
+	enabled = true;
+	crop = false;
+	mask = NULL;
+	halo = halo_;
+	ry0 = y;
+	ry1 = y + rh;
+	for (int c = 0; c < w; c++) {
+		rect_row[c] = c >= x && c < x + rw;
+	}
+}
+
+void RegionMask::set_tile(int x, int y, int tw, int th, int halo_)
+{
+	set_roi(x, y, tw, th, halo_);
+	crop = true;
+	cx0 = x;
+	cx1 = x + tw;
+}
+
+/* The first line whose rows [ry - halo, ry + psize + halo) reach the first row of the region, on the grid of (pstep). */
+int RegionMask::first_line() const
+{
+	if (!enabled || mask) return 0;
+	int ry = ry0 - psize - halo + 1;
+	return ry > 0 ? (ry + pstep - 1) / pstep * pstep : 0;
+}
+
+const uint8_t *RegionMask::row(int y) const
+{
+	if (mask) return mask + (size_t)y * stride;
+	return y >= ry0 && y < ry1 ? rect_row : zero_row;
+}
+
+/* A reference patch at the column (x) touches the region if any pixel of the columns [x - halo, x + psize + halo)
+ * of the rows [ry - halo, ry + psize + halo) is in the region, which is a difference of the prefix sums of the columns.
+ * The last reference patch may be beyond the image, whose columns are clipped.
+ */
+int RegionMask::start_line(int ry)
+{
+	if (!enabled) return nrefs;
+
+	int y0 = ry - halo > 0 ? ry - halo : 0;
+	int y1 = ry + psize + halo < h ? ry + psize + halo : h;
+	memset(col_sum, 0, (w + 1) * sizeof(int));
+	for (int y = y0; y < y1; y++)
+	{
+		const uint8_t *r = row(y);
+		for (int c = 0; c < w; c++) {
+			col_sum[c + 1] |= r[c];
+		}
+	}
+	for (int c = 0; c < w; c++) {
+		col_sum[c + 1] = col_sum[c] + (col_sum[c + 1] != 0);
+	}
+
+	int n = 0;
+	for (int k = 0; k < nrefs; k++)
+	{
+		int x0 = k * pstep - halo;
+		int x1 = k * pstep + psize + halo;
+		x0 = x0 > 0 ? x0 : 0;
+		x0 = x0 < w ? x0 : w;
+		x1 = x1 < w ? x1 : w;
+		ref_on[k] = col_sum[x1] > col_sum[x0];
+		n += ref_on[k];
+	}
+	return n;
+}
+
+/* The runs of the pixels of the region are normalized, so that the empty denominators out of the region are never divided. */
+template <typename ImageType>
+void RegionMask::output_row(ImageType *const *out, const ImageType *const *in, const PatchType *const *numer,
+	const PatchType *const *denom, int nch, int y, int vmax, int shift) const
+{
+	if (!enabled)
+	{
+		normalize_row(out, numer, denom, nch, w, vmax, shift);
+		return;
+	}
+	if (crop)
+	{
+		const PatchType *nu[MAX_REGION_CHANNELS];
+		const PatchType *de[MAX_REGION_CHANNELS];
+		for (int ch = 0; ch < nch; ch++)
+		{
+			nu[ch] = numer[ch] + cx0;
+			de[ch] = denom[ch] + cx0;
+		}
+		normalize_row(out, nu, de, nch, cx1 - cx0, vmax, shift);
+		return;
+	}
+
+	const uint8_t *r = row(y);
+	for (int x0 = 0, x1; x0 < w; x0 = x1)
+	{
+		bool on = r[x0] != 0;
+		for (x1 = x0 + 1; x1 < w && (r[x1] != 0) == on; x1++);
+		if (on)
+		{
+			ImageType *o[MAX_REGION_CHANNELS];
+			const PatchType *nu[MAX_REGION_CHANNELS];
+			const PatchType *de[MAX_REGION_CHANNELS];
+			for (int ch = 0; ch < nch; ch++)
+			{
+				o[ch]  = out[ch] + x0;
+				nu[ch] = numer[ch] + x0;
+				de[ch] = denom[ch] + x0;
+			}
+			normalize_row(o, nu, de, nch, x1 - x0, vmax, shift);
+		}
+		else
+		{
+			for (int ch = 0; ch < nch; ch++) {
+				memcpy(out[ch] + x0, in[ch] + x0, (x1 - x0) * sizeof(ImageType));
+			}
+		}
+	}
+}
+
+template void RegionMask::output_row(uint8_t  *const *, const uint8_t  *const *, const PatchType *const *, const PatchType *const *,
+	int, int, int, int) const;
+template void RegionMask::output_row(uint16_t *const *, const uint16_t *const *, const PatchType *const *, const PatchType *const *,
+	int, int, int, int) const;
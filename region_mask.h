@@ -0,0 +1,75 @@
+#ifndef __REGION_MASK_H__
+#define __REGION_MASK_H__
+
+#include <iostream>
+#include "global_define.h"
+
+/* Region of the image to denoise, i.e. the nonzero pixels of a caller-owned mask, or a rectangle (ROI).
+ * Only the reference patches touching the region dilated by the (halo) are grouped, filtered and aggregated,
+ * so the cost is relative to the area of the region rather than the image, and the lines out of it cost nothing.
+ * The pixels of the region are denoised, and the others are passed through from the input.
+ * With no halo, every pixel of the region has the groups of its own reference patches,
+ * but not those of the reference patches out of the region whose groups would have matched it,
+ * and a halo of the search window radius (max(swinrh, swinrv)) gives the same pixels as denoising the whole image.
+ * The Step2 groups are matched on the basic image, which is the noisy one out of the Step1 region,
+ * so the Step1 region should be larger than the Step2 one by the search window radius for the same results.
+ * A tile is a rectangle whose pixels are the only ones written, from the column of the tile of the output rows.
+ */
+struct RegionMask
+{
+	int w;					// image width
+	int h;					// image height
+	int psize;				// patch size
+	int pstep;				// reference patch step
+	int nrefs;				// reference patches of a line
+
+	bool enabled;			// whether only the region is denoised
+	int halo;				// dilation of the region to select the reference patches
+	const uint8_t *mask;	// nonzero pixels to denoise, NULL for the rectangle
+	int stride;				// distance (in pixels) between two adjacent rows of the (mask)
+	int ry0;				// first row of the rectangle
+	int ry1;				// last row of the rectangle, exclusive
+	bool crop;				// whether only the rectangle is written, i.e. a tile
+	int cx0;				// first column of the tile
+	int cx1;				// last column of the tile, exclusive
+	uint8_t *rect_row;		// a row of the rectangle, size: w
+	uint8_t *zero_row;		// a row out of the region, size: w
+
+	int *col_sum;			// prefix sums of the columns touched by the region in the rows of the line, size: w + 1
+	uint8_t *ref_on;		// flags of the reference patches of the line touching the region, size: nrefs
+
+	RegionMask(int w_, int h_, int psize_, int pstep_);
+	~RegionMask();
+
+	// denoise the nonzero pixels of the mask only, which is kept valid until the whole image is processed, NULL for the whole image
+	void set_mask(const uint8_t *mask_, int stride_, int halo_);
+
+	// denoise the rectangle [x, x + rw) x [y, y + rh) only
+	void set_roi(int x, int y, int rw, int rh, int halo_);
+
+	// denoise and write the tile [x, x + tw) x [y, y + th) only
+	void set_tile(int x, int y, int tw, int th, int halo_);
+
+	// first line of reference patches touching the region, the lines above it are never processed
+	int first_line() const;
+
+	// whether the row (y) is written to the output
+	bool writes(int y) const { return !crop || (y >= ry0 && y < ry1); }
+
+	// row (y) of the region, nonzero to denoise
+	const uint8_t *row(int y) const;
+
+	// flag the reference patches of the line at the row (ry) touching the region, returns the number of them
+	int start_line(int ry);
+
+	// whether the (k)th reference patch of the line is processed
+	bool active(int k) const { return !enabled || ref_on[k]; }
+
+	// normalize the row (y) of the region from the line buffers as normalize_row(), and copy the other pixels from the input rows,
+	// or normalize the columns of the tile only into the output rows beginning at the tile
+	template <typename ImageType>
+	void output_row(ImageType *const *out, const ImageType *const *in, const PatchType *const *numer, const PatchType *const *denom,
+		int nch, int y, int vmax, int shift) const;
+};
+
+#endif
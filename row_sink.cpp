@@ -0,0 +1,40 @@
+#include <iostream>
+#include "row_sink.h"
+
+template <typename ImageType>
+SinkRows<ImageType>::SinkRows(int nplanes_, int w_, int rows_)
+	: nplanes(nplanes_), w(w_), rows(rows_)
+{
+	data = new ImageType[nplanes * rows * w];
+}
+
+template <typename ImageType>
+SinkRows<ImageType>::~SinkRows()
+{
+	delete[] data;
+}
+
+template <typename ImageType>
+void SinkRows<ImageType>::out_planes(PlaneOut<ImageType> *out, int y) const
+{
+	for (int i = 0; i < nplanes; i++)
+	{
+		out[i] = PlaneOut<ImageType>(data + i * rows * w, w, 0, y);
+	}
+}
+
+template <typename ImageType>
+void SinkRows<ImageType>::flush(RowSink<ImageType> *sink, int y, int n) const
+{
+	if (n <= 0) return;
+
+	const ImageType *src[max_planes];
+	for (int i = 0; i < nplanes; i++)
+	{
+		src[i] = data + i * rows * w;
+	}
+	sink->write_rows(y, n, src, w);
+}
+
+template struct SinkRows<uint8_t>;
+template struct SinkRows<uint16_t>;
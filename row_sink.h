@@ -0,0 +1,45 @@
+#ifndef __ROW_SINK_H__
+#define __ROW_SINK_H__
+
+#include <iostream>
+#include "global_define.h"
+#include "plane_view.h"
+
+/* Sink of the denoised rows, which is called by the engines as soon as the rows are completed,
+ * so that the rows can be piped to an encoder or a writer directly rather than held in a whole output frame.
+ */
+template <typename ImageType>
+struct RowSink
+{
+	virtual ~RowSink() {}
+
+	// write the (n) completed rows from the row (y) of each output plane, 
+	// where rows[i] is the first row of the plane (i), e.g. the Y/U/V rows for the CBM3D, and the rows are (stride) pixels apart
+	virtual void write_rows(int y, int n, const ImageType *const *rows, int stride) = 0;
+};
+
+/* Rows of the output planes completed by a line of reference patches, which are passed to a row sink at once.
+ * Each line completes at most (rows) rows, which are stored contiguously from the first one.
+ */
+template <typename ImageType>
+struct SinkRows
+{
+	static const int max_planes = 3;	// e.g. the Y/U/V planes of the CBM3D
+
+	int nplanes;			// number of planes, at most (max_planes)
+	int w;					// width of the planes
+	int rows;				// rows of each plane
+
+	ImageType *data;		// rows of all the planes, size: nplanes * rows * w
+
+	SinkRows(int nplanes_, int w_, int rows_);
+	~SinkRows();
+
+	// output planes whose first row is the image row (y)
+	void out_planes(PlaneOut<ImageType> *out, int y) const;
+
+	// pass the (n) rows from the image row (y) to the sink, if any
+	void flush(RowSink<ImageType> *sink, int y, int n) const;
+};
+
+#endif
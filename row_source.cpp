@@ -0,0 +1,35 @@
+#include <iostream>
+#include "row_source.h"
+
+template <typename ImageType>
+RowRing<ImageType>::RowRing(int nplanes_, int w_, int h_, int rows_)
+	: nplanes(nplanes_), w(w_), h(h_), rows(rows_), source(NULL), done(0)
+{
+	data = new ImageType[nplanes * rows * w];
+}
+
+template <typename ImageType>
+RowRing<ImageType>::~RowRing()
+{
+	delete[] data;
+}
+
+template <typename ImageType>
+void RowRing<ImageType>::fill(int y1)
+{
+	if (source == NULL) return;
+
+	y1 = y1 < h ? y1 : h;
+	for (; done < y1; done++)
+	{
+		ImageType *dst[max_planes];
+		for (int i = 0; i < nplanes; i++)
+		{
+			dst[i] = ring(i) + done % rows * w;
+		}
+		source->read_row(done, dst);
+	}
+}
+
+template struct RowRing<uint8_t>;
+template struct RowRing<uint16_t>;
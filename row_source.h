@@ -0,0 +1,53 @@
+#ifndef __ROW_SOURCE_H__
+#define __ROW_SOURCE_H__
+
+#include <iostream>
+#include "global_define.h"
+
+/* Source of the rows of the input planes, which are pulled by the engines row by row in order,
+ * so that a very large image (e.g. a scan or a panorama) can be read or decoded progressively 
+ * rather than held in memory as a whole.
+ */
+template <typename ImageType>
+struct RowSource
+{
+	virtual ~RowSource() {}
+
+	// read the row (y) of each input plane of the engine into rows[i], e.g. the noisy Y/U/V rows for the CBM3D
+	virtual void read_row(int y, ImageType *const *rows) = 0;
+};
+
+/* Rings of the latest rows pulled from a row source, which are the only input rows kept by the engines.
+ * The row (y) of each plane is stored in the ring row (y % rows), and read by the PlaneView with the same ring.
+ */
+template <typename ImageType>
+struct RowRing
+{
+	static const int max_planes = 6;	// e.g. the noisy and basic Y/U/V planes of the CBM3D_WIE
+
+	int nplanes;			// number of planes, at most (max_planes)
+	int w;					// width of the planes
+	int h;					// height of the planes
+	int rows;				// rows of each ring
+
+	ImageType *data;		// rings of all the planes, size: nplanes * rows * w
+	RowSource<ImageType> *source;	// source of the rows, NULL if the planes are not streamed
+	int done;				// rows pulled from the source
+
+	RowRing(int nplanes_, int w_, int h_, int rows_);
+	~RowRing();
+
+	// pull the rows from a new source, starting from the first row
+	void set_source(RowSource<ImageType> *source_) { source = source_; done = 0; }
+
+	// restart from the first row of the source, which must be able to provide the rows again
+	void restart() { done = 0; }
+
+	// ring of the plane (i)
+	ImageType *ring(int i) const { return data + i * rows * w; }
+
+	// pull the rows before the row (y1) from the source
+	void fill(int y1);
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include <omp.h>
+#include "trace.h"
+
+#if USE_TRACE
+
+/* An event of the timeline, a span (ph = 'X') or a value of a counter (ph = 'C'). */
+struct TraceEvent
+{
+	const char *name;		// name of the span or the counter track
+	char ph;				// type of the event
+	int arg;				// argument of the span, -1 if none
+	double ts;				// beginning of the span or time of the counter, in microseconds
+	double value;			// duration of the span, or value of the counter
+};
+
+/* Events of a thread. */
+struct TraceThread
+{
+	int tid;				// sequential id of the thread in the timeline
+	int n;					// number of events
+	int cap;				// capacity of the (events)
+	TraceEvent *events;		// events in the order of their ends
+};
+
+volatile bool trace_active = false;
+
+static TraceThread **threads = NULL;	// buffers of all the threads recorded
+static int nthreads = 0;
+static int threads_cap = 0;
+static char *trace_fname = NULL;
+static double trace_t0 = 0;
+static int trace_epoch = 0;				// incremented by trace_start(), so that the buffers of a former trace are not reused
+
+static TraceThread *local = NULL;
+static int local_epoch = -1;
+#pragma omp threadprivate(local, local_epoch)
+
+double trace_clock()
+{
+	return (omp_get_wtime() - trace_t0) * 1e6;
+}
+
+// the buffer of the calling thread, registered at its first event
+static TraceThread *local_thread()
+{
+	if (local == NULL || local_epoch != trace_epoch)
+	{
+		local = new TraceThread;
+		local->n = 0;
+		local->cap = 4096;
+		local->events = new TraceEvent[local->cap];
+		local_epoch = trace_epoch;
+#pragma omp critical(trace_threads)
+		{
+			if (nthreads == threads_cap)
+			{
+				threads_cap = threads_cap ? threads_cap * 2 : 16;
+				TraceThread **t = new TraceThread*[threads_cap];
+				for (int i = 0; i < nthreads; i++) {
+					t[i] = threads[i];
+				}
+				delete[] threads;
+				threads = t;
+			}
+			local->tid = nthreads;
+			threads[nthreads++] = local;
+		}
+	}
+	return local;
+}
+
+static TraceEvent *new_event()
+{
+	TraceThread *t = local_thread();
+	if (t->n == t->cap)
+	{
+		TraceEvent *e = new TraceEvent[t->cap * 2];
+		memcpy(e, t->events, t->n * sizeof(TraceEvent));
+		delete[] t->events;
+		t->events = e;
+		t->cap *= 2;
+	}
+	return t->events + t->n++;
+}
+
+void trace_record_span(const char *name, double t0, int arg)
+{
+	double t1 = trace_clock();
+	TraceEvent *e = new_event();
+	e->name = name;
+	e->ph = 'X';
+	e->arg = arg;
+	e->ts = t0;
+	e->value = t1 - t0;
+}
+
+void trace_record_counter(const char *name, double value)
+{
+	TraceEvent *e = new_event();
+	e->name = name;
+	e->ph = 'C';
+	e->arg = -1;
+	e->ts = trace_clock();
+	e->value = value;
+}
+
+#endif
+
+void trace_start(const char *fname)
+{
+#if USE_TRACE
+	trace_stop();
+	trace_fname = new char[strlen(fname) + 1];
+	strcpy(trace_fname, fname);
+	trace_epoch++;
+	trace_t0 = omp_get_wtime();
+	trace_active = true;
+#endif
+}
+
+/* The counters are the tracks of the process, and the spans are in the tracks of their threads. */
+void trace_stop()
+{
+#if USE_TRACE
+	if (!trace_active) return;
+	trace_active = false;
+
+	FILE *f = fopen(trace_fname, "w");
+	if (NULL == f)
+		std::cout << "Failed to open: " << trace_fname << std::endl;
+	else
+	{
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"BM3D\"}}");
+		for (int i = 0; i < nthreads; i++)
+		{
+			const TraceThread *t = threads[i];
+			fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+				t->tid, t->tid);
+			for (int k = 0; k < t->n; k++)
+			{
+				const TraceEvent &e = t->events[k];
+				if (e.ph == 'C')
+					fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {\"value\": %g}}",
+						e.name, e.ts, e.value);
+				else if (e.arg >= 0)
+					fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"index\": %d}}",
+						e.name, t->tid, e.ts, e.value, e.arg);
+				else
+					fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+						e.name, t->tid, e.ts, e.value);
+			}
+		}
+		fprintf(f, "\n]}\n");
+		fclose(f);
+	}
+
+	// the buffers of the threads are dropped, and new ones are registered by the next trace
+	for (int i = 0; i < nthreads; i++)
+	{
+		delete[] threads[i]->events;
+		delete threads[i];
+	}
+	nthreads = 0;
+	delete[] trace_fname;
+	trace_fname = NULL;
+#endif
+}
@@ -0,0 +1,60 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <iostream>
+#include "global_define.h"
+
+/* Timeline of the engines in the trace event format of Chrome (chrome://tracing), which is also loaded by Perfetto.
+ * There is a span for each line of reference patches, each stage and each task of the worker threads
+ * in the parallel regions, and the counter tracks of the mean group size and the output rows of each line,
+ * so that the load imbalance of the parallel regions and the serial stretches between them can be seen.
+ * The events are recorded between trace_start() and trace_stop() if USE_TRACE, otherwise nothing is recorded.
+ * Each thread records its events into its own buffer without locking, and the buffers are written out by trace_stop(),
+ * which must not be called while any engine is running.
+ * The names of the events must be string literals, as only the pointers are recorded.
+ */
+
+// start recording the events, which are written to the file (fname) by trace_stop()
+void trace_start(const char *fname);
+
+// stop recording, and write out the events recorded
+void trace_stop();
+
+#if USE_TRACE
+extern volatile bool trace_active;	// whether the events are being recorded
+
+// microseconds since trace_start()
+double trace_clock();
+
+// record a span of the calling thread from (t0) to now, with an integer argument if (arg) >= 0
+void trace_record_span(const char *name, double t0, int arg);
+
+// record a value of a counter track
+void trace_record_counter(const char *name, double value);
+#endif
+
+// beginning of a span, 0 if not recording
+static inline double trace_begin()
+{
+#if USE_TRACE
+	if (trace_active) return trace_clock();
+#endif
+	return 0;
+}
+
+// end of a span begun by trace_begin()
+static inline void trace_span(const char *name, double t0, int arg = -1)
+{
+#if USE_TRACE
+	if (trace_active) trace_record_span(name, t0, arg);
+#endif
+}
+
+static inline void trace_counter(const char *name, double value)
+{
+#if USE_TRACE
+	if (trace_active) trace_record_counter(name, value);
+#endif
+}
+
+#endif
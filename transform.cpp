@@ -1,31 +1,16 @@
 #include "transform.h"
+#include "kernels.h"
 
-/* Inplace implementation of the forward 2D 8x8 Bior-1.5 wavelet transform.
- * Firstly, the 8x8 matrix below is applied to each row and then each column (vice versa) of the input 8x8 patch. 
- *					[ 64,  64,  11, -11,   0,   0, -11,  11] [x0]
- *					[-11,  11,  64,  64,  11, -11,   0,   0] [x1]
- *		   1		[  0,   0, -11,  11,  64,  64,  11, -11] [x2]
- *	  ----------- *	[ 11, -11,   0,   0, -11,  11,  64,  64] [x3]
- *	   64*sqrt(2)	[ 64, -64,   0,   0,   0,   0,   0,   0] [x4]
- *					[  0,   0,  64, -64,   0,   0,   0,   0] [x5]
- *					[  0,   0,   0,   0,  64, -64,   0,   0] [x6]
- *					[  0,   0,   0,   0,   0,   0,  64, -64] [x7]
- *
- * Secondly, the 4x4 matrix below is applied to each row and then each column of the top-left 4x4 patch 
- * of the output of the fisrt step, and the remains are under *unchanged* (except scaling if necessary).
- *					[1,  1,  0,  0] [x0]
- *			 		[0,  0,  1,  1] [x1]
- *		1/sqrt(2) * [1, -1,  0,  0] [x2]
- *					[0,  0,  1, -1] [x3]
- *
- * Finally, the 2x2 matrix below is applied to each row and then each column of the top-left 2x2 patch 
- * of the output of the second step, and the remains are under *unchanged* (except scaling if necessary).
- *					[1,  1] [x0]
- *		1/sqrt(2) * [1, -1] [x1]
+#if USE_CPU_DISPATCH
+#include <immintrin.h>
+#endif
+
+/* The 8x8 matrices of the Bior-1.5 transforms below, i.e. the 1st step of the forward transform and the 3rd step of the backward one,
+ * which are the most of the operations, and there are the AVX2 versions of them.
  */
-void inplace_forward_bior15_2d_8x8(float *src)
+static void forward_bior15_8x8(float *src)
 {
-	static float buf[4];
+	float buf[4];
 	float *org_src = src;
 
 	// horizontal transform of the 1st step (8x8)
@@ -76,147 +61,13 @@ void inplace_forward_bior15_2d_8x8(float *src)
 			src[8 * i + j] /= 8192.f;	// (64 * 2^0.5)^2, normalization
 		}
 	}
-
-	// horizontal transform of the 2nd step (4x4)
-	for (int i = 0; i < 4; i++)
-	{
-		buf[0] = src[0] - src[1];
-		buf[1] = src[2] - src[3];
-		src[0] = src[0] + src[1];
-		src[1] = src[2] + src[3];
-		src[2] = buf[0];
-		src[3] = buf[1];
-		src += 8;
-	}
-
-	// vertical transform of the 2nd step (4x4)
-	src = org_src;
-	for (int j = 0; j < 4; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		buf[1] = src[2 * 8 + j] - src[3 * 8 + j];
-		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
-		src[1 * 8 + j] = src[2 * 8 + j] + src[3 * 8 + j];
-		src[2 * 8 + j] = buf[0];
-		src[3 * 8 + j] = buf[1];
-	}
-
-	for (int i = 0; i < 4; i++)
-	{
-		for (int j = 0; j < 4; j++) {
-			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
-		}
-	}
-
-	// horizontal transform of the 3rd step (2x2)
-	for (int i = 0; i < 2; i++)
-	{
-		buf[0] = src[0] - src[1];
-		src[0] = src[0] + src[1];
-		src[1] = buf[0];
-		src += 8;
-	}
-
-	// vertical transform of the 3rd step (2x2)
-	src = org_src;
-	for (int j = 0; j < 2; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
-		src[1 * 8 + j] = buf[0];
-	}
-
-	for (int i = 0; i < 2; i++)
-	{
-		for (int j = 0; j < 2; j++) {
-			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
-		}
-	}
 }
 
-/* Inplace implementation of the backward 2D 8x8 Bior-1.5 wavelet transform.
- * Firstly, the 2x2 matrix below is applied to each column and then each row (vice versa)
- * of the top-left 2x2 patch of the input, and the remains are under *unchanged* (except scaling if necessary).
- * Note that the output 2x2 patch will replace the original top-left 2x2 patch of the input.
- *					[1,  1] [x0]
- *		1/sqrt(2) * [1, -1] [x1]
- *
- * Secondly, the 4x4 matrix below is applied to each column and then each row of the top-left 4x4 patch 
- * of the input after the fisrt step, and the remains are under *unchanged* (except scaling if necessary).
- *					[1,  0,  1,  0] [x0]
- *			 		[1,  0, -1,  0] [x1]
- *		1/sqrt(2) * [0,  1,  0,  1] [x2]
- *					[0,  1,  0, -1] [x3]
- *
- * Finally, the 8x8 matrix below is applied to each column and then each row 
- * of the whole input patch after the second step.
- *					[ 64,   0,   0,   0,  64, -11,   0,  11] [x0]
- *					[ 64,   0,   0,   0, -64, -11,   0,  11] [x1]
- *         1		[  0,  64,   0,   0,  11,  64, -11,   0] [x2]
- *    ----------- *	[  0,  64,   0,   0,  11, -64, -11,   0] [x3]
- *	   64*sqrt(2)	[  0.,  0,  64,   0,   0,  11,  64, -11] [x4]
- *					[  0.,  0,  64,   0,   0,  11, -64, -11] [x5]
- *					[  0,   0,   0,  64, -11,   0,  11,  64] [x6]
- *					[  0,   0,   0,  64, -11,   0,  11, -64] [x7]
- */
-void inplace_backward_bior15_2d_8x8(float *src)
+static void backward_bior15_8x8(float *src)
 {
-	static float buf[4];
+	float buf[4];
 	float *org_src = src;
 
-	// vertical transform of the 1st step (2x2)
-	for (int j = 0; j < 2; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
-		src[1 * 8 + j] = buf[0];
-	}
-
-	// horizontal transform of the 1st step (2x2)
-	for (int i = 0; i < 2; i++)
-	{
-		buf[0] = src[0] - src[1];
-		src[0] = src[0] + src[1];
-		src[1] = buf[0];
-		src += 8;
-	}
-	src = org_src;
-
-	for (int i = 0; i < 2; i++)
-	{
-		for (int j = 0; j < 2; j++) {
-			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
-		}
-	}
-
-	// vertical transform of the 2nd step (4x4)
-	for (int j = 0; j < 4; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[2 * 8 + j];
-		buf[1] = src[1 * 8 + j] - src[3 * 8 + j];
-		src[0 * 8 + j] = src[0 * 8 + j] + src[2 * 8 + j];
-		src[2 * 8 + j] = src[1 * 8 + j] + src[3 * 8 + j];
-		src[1 * 8 + j] = buf[0];
-		src[3 * 8 + j] = buf[1];
-	}
-
-	// horizontal transform of the 2nd step (4x4)
-	for (int i = 0; i < 4; i++)
-	{
-		buf[0] = src[0] - src[2];
-		buf[1] = src[1] - src[3];
-		src[0] = src[0] + src[2];
-		src[2] = src[1] + src[3];
-		src[1] = buf[0];
-		src[3] = buf[1];
-		src += 8;
-	}
-	src = org_src;
-
-	for (int i = 0; i < 4; i++)
-		for (int j = 0; j < 4; j++)
-			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
-
 	// vertical transform of the 3rd step (8x8)
 	for (int j = 0; j < 8; j++)
 	{
@@ -289,16 +140,9 @@ void inplace_backward_bior15_2d_8x8(float *src)
 	}
 }
 
-
-/* Integer version of the 8x8 Bior-1.5 forward transform.
- * It's almost the same as the floating-point version but only the scaling.
- * The output coefficients are multiplied by 2 in comparision with the floating-point ones.
- * There are 5 more bits of the ouput coefficients than the input values, and totally at most 
- * 18 bits are needed for the intermediate results compared to the input values, e.g. 26 bits for uint8.
- */
-void inplace_forward_bior15_2d_8x8(int *src)
+static void forward_bior15_8x8(int *src)
 {
-	static int buf[4];
+	int buf[4];
 	int *org_src = src;
 
 	// horizontal transform of the 1st step (8x8)
@@ -342,76 +186,523 @@ void inplace_forward_bior15_2d_8x8(int *src)
 		src[6 * 8 + j] = buf[2] * 64;
 		src[7 * 8 + j] = buf[3] * 64;
 	}
+}
 
-	// horizontal transform of the 2nd step (4x4)
-	for (int i = 0; i < 4; i++)
-	{
-		buf[0] = src[0] - src[1];
-		buf[1] = src[2] - src[3];
-		src[0] = src[0] + src[1];
-		src[1] = src[2] + src[3];
-		src[2] = buf[0];
-		src[3] = buf[1];
-		src += 8;
-	}
+static void backward_bior15_8x8(int *src)
+{
+	int buf[4];
+	int *org_src = src;
 
-	// vertical transform of the 2nd step (4x4)
-	src = org_src;
-	for (int j = 0; j < 4; j++)
+	// vertical transform of the 3rd step (8x8)
+	for (int j = 0; j < 8; j++)
 	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		buf[1] = src[2 * 8 + j] - src[3 * 8 + j];
-		src[0 * 8 + j] = (src[0 * 8 + j] + src[1 * 8 + j] + 1) >> 1;
-		src[1 * 8 + j] = (src[2 * 8 + j] + src[3 * 8 + j] + 1) >> 1;
-		src[2 * 8 + j] = (buf[0] + 1) >> 1;
-		src[3 * 8 + j] = (buf[1] + 1) >> 1;
-	}
+		buf[0] = (src[0 * 8 + j] - src[4 * 8 + j]) * 64;
+		buf[1] = (src[1 * 8 + j] - src[5 * 8 + j]) * 64;
+		buf[2] = (src[2 * 8 + j] - src[6 * 8 + j]) * 64;
+		buf[3] = (src[3 * 8 + j] - src[7 * 8 + j]) * 64;
 
-	// horizontal transform of the 3rd step (2x2)
-	for (int i = 0; i < 2; i++)
-	{
-		buf[0] = src[0] - src[1];
-		src[0] = src[0] + src[1];
-		src[1] = buf[0];
-		src += 8;
-	}
+		src[0 * 8 + j] = (src[0 * 8 + j] + src[4 * 8 + j]) * 64;
+		src[1 * 8 + j] = (src[1 * 8 + j] + src[5 * 8 + j]) * 64;
+		src[2 * 8 + j] = (src[2 * 8 + j] + src[6 * 8 + j]) * 64;
+		src[3 * 8 + j] = (src[3 * 8 + j] + src[7 * 8 + j]) * 64;
 
-	// vertical transform of the 3rd step (2x2)
-	src = org_src;
-	for (int j = 0; j < 2; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		src[0 * 8 + j] = (src[0 * 8 + j] + src[1 * 8 + j] + 1) >> 1;
-		src[1 * 8 + j] = (buf[0] + 1) >> 1;
-	}
+		src[5 * 8 + j] = (src[5 * 8 + j] - src[7 * 8 + j]) * 11;
+		src[6 * 8 + j] = (src[6 * 8 + j] - src[4 * 8 + j]) * 11;
 
-	// normalization
-	for (int i = 0; i < 64; i++) 
-	{
-		src[i] = (src[i] + (1 << 11)) >> 12;
-	}
-}
+		src[4 * 8 + j] = src[5 * 8 + j];
+		src[5 * 8 + j] = buf[2] + src[5 * 8 + j];
+		src[7 * 8 + j] = buf[3] + src[6 * 8 + j];
 
-/* Integer version of the 8x8 Bior-1.5 backward transform.
- * It's almost the same as the floating-point version but only the scaling.
- * The output has the same bits as the original image values.
- * The bits needed for the intermediate results remain the same as the forward transform.
- */
-void inplace_backward_bior15_2d_8x8(int *src)
-{
-	static int buf[4];
-	int *org_src = src;
+		src[0 * 8 + j] = src[0 * 8 + j] - src[4 * 8 + j];
 
-	// vertical transform of the 1st step (2x2)
-	for (int j = 0; j < 2; j++)
-	{
-		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
-		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
-		src[1 * 8 + j] = buf[0];
+		buf[2] = src[1 * 8 + j];
+		buf[3] = src[2 * 8 + j];
+		src[1 * 8 + j] = buf[0] - src[4 * 8 + j];
+		src[2 * 8 + j] = buf[2] - src[6 * 8 + j];
+
+		buf[0] = src[3 * 8 + j];
+		src[3 * 8 + j] = buf[1] - src[6 * 8 + j];
+		src[4 * 8 + j] = buf[3] + src[4 * 8 + j];
+		src[6 * 8 + j] = buf[0] + src[6 * 8 + j];
 	}
 
-	// horizontal transform of the 1st step (2x2)
-	for (int i = 0; i < 2; i++)
+	// horizontal transform of the 3rd step (8x8)
+	for (int i = 0; i < 8; i++)
+	{
+		buf[0] = (src[0] - src[4]) * 64;
+		src[0] = (src[0] + src[4]) * 64;
+		buf[1] = (src[1] - src[5]) * 64;
+		src[1] = (src[1] + src[5]) * 64;
+		buf[2] = (src[2] - src[6]) * 64;
+		src[2] = (src[2] + src[6]) * 64;
+		buf[3] = (src[3] - src[7]) * 64;
+		src[3] = (src[3] + src[7]) * 64;
+
+		src[5] = (src[5] - src[7]) * 11;
+		src[6] = (src[6] - src[4]) * 11;
+		src[4] = src[5];
+		src[5] = buf[2] + src[5];
+		src[7] = buf[3] + src[6];
+		src[0] = src[0] - src[4];
+
+		buf[2] = src[1];
+		buf[3] = src[2];
+		src[1] = buf[0] - src[4];
+		src[2] = buf[2] - src[6];
+		buf[0] = src[3];
+		src[3] = buf[1] - src[6];
+		src[4] = buf[3] + src[4];
+		src[6] = buf[0] + src[6];
+		src += 8;
+	}
+	src = org_src;
+
+	// normalization
+	for (int i = 0; i < 64; i++)
+	{
+		src[i] = (src[i] + (1 << 13)) >> 14;
+	}
+}
+
+#if USE_CPU_DISPATCH
+/* The 8 rows of a patch are held by 8 vectors, so that the 8x8 matrix is applied to the 8 columns at once,
+ * and it is applied to the rows by transposing the patch before and after.
+ * The operations are the same as the scalar ones, so the results are exactly the same.
+ */
+TARGET_AVX2 static inline void load_8x8(const float *src, __m256 *r)
+{
+	for (int i = 0; i < 8; i++) r[i] = _mm256_loadu_ps(src + 8 * i);
+}
+
+TARGET_AVX2 static inline void load_8x8(const int *src, __m256i *r)
+{
+	for (int i = 0; i < 8; i++) r[i] = _mm256_loadu_si256((const __m256i *)(src + 8 * i));
+}
+
+TARGET_AVX2 static inline void store_8x8(float *src, const __m256 *r)
+{
+	for (int i = 0; i < 8; i++) _mm256_storeu_ps(src + 8 * i, r[i]);
+}
+
+TARGET_AVX2 static inline void store_8x8(int *src, const __m256i *r)
+{
+	for (int i = 0; i < 8; i++) _mm256_storeu_si256((__m256i *)(src + 8 * i), r[i]);
+}
+
+TARGET_AVX2 static inline void transpose_8x8(__m256 *r)
+{
+	__m256 t[8], u[8];
+	for (int i = 0; i < 8; i += 2)
+	{
+		t[i]     = _mm256_unpacklo_ps(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+	}
+	for (int i = 0; i < 8; i += 4)
+	{
+		u[i]     = _mm256_shuffle_ps(t[i],     t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+		u[i + 1] = _mm256_shuffle_ps(t[i],     t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+		u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+		u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		r[i]     = _mm256_permute2f128_ps(u[i], u[i + 4], 0x20);
+		r[i + 4] = _mm256_permute2f128_ps(u[i], u[i + 4], 0x31);
+	}
+}
+
+TARGET_AVX2 static inline void transpose_8x8(__m256i *r)
+{
+	transpose_8x8((__m256 *)r);
+}
+
+TARGET_AVX2 static inline __m256  vadd(__m256  a, __m256  b) { return _mm256_add_ps(a, b); }
+TARGET_AVX2 static inline __m256i vadd(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+TARGET_AVX2 static inline __m256  vsub(__m256  a, __m256  b) { return _mm256_sub_ps(a, b); }
+TARGET_AVX2 static inline __m256i vsub(__m256i a, __m256i b) { return _mm256_sub_epi32(a, b); }
+TARGET_AVX2 static inline __m256  vmul64(__m256  a) { return _mm256_mul_ps(a, _mm256_set1_ps(64.f)); }
+TARGET_AVX2 static inline __m256i vmul64(__m256i a) { return _mm256_slli_epi32(a, 6); }
+TARGET_AVX2 static inline __m256  vmul11(__m256  a) { return _mm256_mul_ps(a, _mm256_set1_ps(11.f)); }
+TARGET_AVX2 static inline __m256i vmul11(__m256i a) { return _mm256_mullo_epi32(a, _mm256_set1_epi32(11)); }
+
+// the 8x8 matrix of the forward transform applied to each column
+template <typename V>
+TARGET_AVX2 static inline void forward_bior15_cols(V *r)
+{
+	V b0 = vsub(r[0], r[1]);
+	V b1 = vsub(r[2], r[3]);
+	V b2 = vsub(r[4], r[5]);
+	V b3 = vsub(r[6], r[7]);
+
+	r[0] = vadd(vmul64(vadd(r[0], r[1])), vmul11(vsub(b1, b3)));
+	r[1] = vadd(vmul64(vadd(r[2], r[3])), vmul11(vsub(b2, b0)));
+	r[2] = vadd(vmul64(vadd(r[4], r[5])), vmul11(vsub(b3, b1)));
+	r[3] = vadd(vmul64(vadd(r[6], r[7])), vmul11(vsub(b0, b2)));
+
+	r[4] = vmul64(b0);
+	r[5] = vmul64(b1);
+	r[6] = vmul64(b2);
+	r[7] = vmul64(b3);
+}
+
+// the 8x8 matrix of the backward transform applied to each column
+template <typename V>
+TARGET_AVX2 static inline void backward_bior15_cols(V *r)
+{
+	V a = vmul11(vsub(r[5], r[7]));
+	V b = vmul11(vsub(r[6], r[4]));
+
+	V s0 = vmul64(vadd(r[0], r[4]));
+	V s1 = vmul64(vsub(r[0], r[4]));
+	V s2 = vmul64(vadd(r[1], r[5]));
+	V s3 = vmul64(vsub(r[1], r[5]));
+	V s4 = vmul64(vadd(r[2], r[6]));
+	V s5 = vmul64(vsub(r[2], r[6]));
+	V s6 = vmul64(vadd(r[3], r[7]));
+	V s7 = vmul64(vsub(r[3], r[7]));
+
+	r[0] = vsub(s0, a);
+	r[1] = vsub(s1, a);
+	r[2] = vsub(s2, b);
+	r[3] = vsub(s3, b);
+	r[4] = vadd(s4, a);
+	r[5] = vadd(s5, a);
+	r[6] = vadd(s6, b);
+	r[7] = vadd(s7, b);
+}
+
+TARGET_AVX2 static void forward_bior15_8x8_avx2(float *src)
+{
+	__m256 r[8];
+	load_8x8(src, r);
+	transpose_8x8(r);
+	forward_bior15_cols(r);
+	transpose_8x8(r);
+	forward_bior15_cols(r);
+	for (int i = 0; i < 8; i++)
+	{
+		r[i] = _mm256_div_ps(r[i], _mm256_set1_ps(8192.f));	// (64 * 2^0.5)^2, normalization
+	}
+	store_8x8(src, r);
+}
+
+TARGET_AVX2 static void backward_bior15_8x8_avx2(float *src)
+{
+	__m256 r[8];
+	load_8x8(src, r);
+	backward_bior15_cols(r);
+	transpose_8x8(r);
+	backward_bior15_cols(r);
+	transpose_8x8(r);
+	for (int i = 0; i < 8; i++)
+	{
+		r[i] = _mm256_div_ps(r[i], _mm256_set1_ps(8192.f));	// (64 * 2^0.5)^2, normalization
+	}
+	store_8x8(src, r);
+}
+
+TARGET_AVX2 static void forward_bior15_8x8_avx2(int *src)
+{
+	__m256i r[8];
+	load_8x8(src, r);
+	transpose_8x8(r);
+	forward_bior15_cols(r);
+	transpose_8x8(r);
+	forward_bior15_cols(r);
+	store_8x8(src, r);
+}
+
+TARGET_AVX2 static void backward_bior15_8x8_avx2(int *src)
+{
+	__m256i r[8];
+	load_8x8(src, r);
+	backward_bior15_cols(r);
+	transpose_8x8(r);
+	backward_bior15_cols(r);
+	transpose_8x8(r);
+	for (int i = 0; i < 8; i++)
+	{
+		r[i] = _mm256_srai_epi32(_mm256_add_epi32(r[i], _mm256_set1_epi32(1 << 13)), 14);	// normalization
+	}
+	store_8x8(src, r);
+}
+#endif
+
+
+/* Inplace implementation of the forward 2D 8x8 Bior-1.5 wavelet transform.
+ * Firstly, the 8x8 matrix below is applied to each row and then each column (vice versa) of the input 8x8 patch. 
+ *					[ 64,  64,  11, -11,   0,   0, -11,  11] [x0]
+ *					[-11,  11,  64,  64,  11, -11,   0,   0] [x1]
+ *		   1		[  0,   0, -11,  11,  64,  64,  11, -11] [x2]
+ *	  ----------- *	[ 11, -11,   0,   0, -11,  11,  64,  64] [x3]
+ *	   64*sqrt(2)	[ 64, -64,   0,   0,   0,   0,   0,   0] [x4]
+ *					[  0,   0,  64, -64,   0,   0,   0,   0] [x5]
+ *					[  0,   0,   0,   0,  64, -64,   0,   0] [x6]
+ *					[  0,   0,   0,   0,   0,   0,  64, -64] [x7]
+ *
+ * Secondly, the 4x4 matrix below is applied to each row and then each column of the top-left 4x4 patch 
+ * of the output of the fisrt step, and the remains are under *unchanged* (except scaling if necessary).
+ *					[1,  1,  0,  0] [x0]
+ *			 		[0,  0,  1,  1] [x1]
+ *		1/sqrt(2) * [1, -1,  0,  0] [x2]
+ *					[0,  0,  1, -1] [x3]
+ *
+ * Finally, the 2x2 matrix below is applied to each row and then each column of the top-left 2x2 patch 
+ * of the output of the second step, and the remains are under *unchanged* (except scaling if necessary).
+ *					[1,  1] [x0]
+ *		1/sqrt(2) * [1, -1] [x1]
+ */
+void inplace_forward_bior15_2d_8x8(float *src)
+{
+	float buf[4];
+	float *org_src = src;
+
+	// the 8x8 matrix of the 1st step, and the normalization
+#if USE_CPU_DISPATCH
+	if (cpu_level() >= CPU_LEVEL_AVX2)
+		forward_bior15_8x8_avx2(src);
+	else
+#endif
+		forward_bior15_8x8(src);
+
+	// horizontal transform of the 2nd step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[1];
+		buf[1] = src[2] - src[3];
+		src[0] = src[0] + src[1];
+		src[1] = src[2] + src[3];
+		src[2] = buf[0];
+		src[3] = buf[1];
+		src += 8;
+	}
+
+	// vertical transform of the 2nd step (4x4)
+	src = org_src;
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		buf[1] = src[2 * 8 + j] - src[3 * 8 + j];
+		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
+		src[1 * 8 + j] = src[2 * 8 + j] + src[3 * 8 + j];
+		src[2 * 8 + j] = buf[0];
+		src[3 * 8 + j] = buf[1];
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++) {
+			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
+		}
+	}
+
+	// horizontal transform of the 3rd step (2x2)
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = src[0] + src[1];
+		src[1] = buf[0];
+		src += 8;
+	}
+
+	// vertical transform of the 3rd step (2x2)
+	src = org_src;
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
+		src[1 * 8 + j] = buf[0];
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		for (int j = 0; j < 2; j++) {
+			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
+		}
+	}
+}
+
+/* Inplace implementation of the backward 2D 8x8 Bior-1.5 wavelet transform.
+ * Firstly, the 2x2 matrix below is applied to each column and then each row (vice versa)
+ * of the top-left 2x2 patch of the input, and the remains are under *unchanged* (except scaling if necessary).
+ * Note that the output 2x2 patch will replace the original top-left 2x2 patch of the input.
+ *					[1,  1] [x0]
+ *		1/sqrt(2) * [1, -1] [x1]
+ *
+ * Secondly, the 4x4 matrix below is applied to each column and then each row of the top-left 4x4 patch 
+ * of the input after the fisrt step, and the remains are under *unchanged* (except scaling if necessary).
+ *					[1,  0,  1,  0] [x0]
+ *			 		[1,  0, -1,  0] [x1]
+ *		1/sqrt(2) * [0,  1,  0,  1] [x2]
+ *					[0,  1,  0, -1] [x3]
+ *
+ * Finally, the 8x8 matrix below is applied to each column and then each row 
+ * of the whole input patch after the second step.
+ *					[ 64,   0,   0,   0,  64, -11,   0,  11] [x0]
+ *					[ 64,   0,   0,   0, -64, -11,   0,  11] [x1]
+ *         1		[  0,  64,   0,   0,  11,  64, -11,   0] [x2]
+ *    ----------- *	[  0,  64,   0,   0,  11, -64, -11,   0] [x3]
+ *	   64*sqrt(2)	[  0.,  0,  64,   0,   0,  11,  64, -11] [x4]
+ *					[  0.,  0,  64,   0,   0,  11, -64, -11] [x5]
+ *					[  0,   0,   0,  64, -11,   0,  11,  64] [x6]
+ *					[  0,   0,   0,  64, -11,   0,  11, -64] [x7]
+ */
+void inplace_backward_bior15_2d_8x8(float *src)
+{
+	float buf[4];
+	float *org_src = src;
+
+	// vertical transform of the 1st step (2x2)
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
+		src[1 * 8 + j] = buf[0];
+	}
+
+	// horizontal transform of the 1st step (2x2)
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = src[0] + src[1];
+		src[1] = buf[0];
+		src += 8;
+	}
+	src = org_src;
+
+	for (int i = 0; i < 2; i++)
+	{
+		for (int j = 0; j < 2; j++) {
+			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
+		}
+	}
+
+	// vertical transform of the 2nd step (4x4)
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[2 * 8 + j];
+		buf[1] = src[1 * 8 + j] - src[3 * 8 + j];
+		src[0 * 8 + j] = src[0 * 8 + j] + src[2 * 8 + j];
+		src[2 * 8 + j] = src[1 * 8 + j] + src[3 * 8 + j];
+		src[1 * 8 + j] = buf[0];
+		src[3 * 8 + j] = buf[1];
+	}
+
+	// horizontal transform of the 2nd step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[2];
+		buf[1] = src[1] - src[3];
+		src[0] = src[0] + src[2];
+		src[2] = src[1] + src[3];
+		src[1] = buf[0];
+		src[3] = buf[1];
+		src += 8;
+	}
+	src = org_src;
+
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			src[8 * i + j] /= 2.f;	// (2^0.5)^2, normalization
+
+	// the 8x8 matrix of the 3rd step, and the normalization
+#if USE_CPU_DISPATCH
+	if (cpu_level() >= CPU_LEVEL_AVX2)
+		backward_bior15_8x8_avx2(src);
+	else
+#endif
+		backward_bior15_8x8(src);
+}
+
+
+/* Integer version of the 8x8 Bior-1.5 forward transform.
+ * It's almost the same as the floating-point version but only the scaling.
+ * The output coefficients are multiplied by 2 in comparision with the floating-point ones.
+ * There are 5 more bits of the ouput coefficients than the input values, and totally at most 
+ * 18 bits are needed for the intermediate results compared to the input values, e.g. 26 bits for uint8.
+ */
+void inplace_forward_bior15_2d_8x8(int *src)
+{
+	int buf[4];
+	int *org_src = src;
+
+	// the 8x8 matrix of the 1st step
+#if USE_CPU_DISPATCH
+	if (cpu_level() >= CPU_LEVEL_AVX2)
+		forward_bior15_8x8_avx2(src);
+	else
+#endif
+		forward_bior15_8x8(src);
+
+	// horizontal transform of the 2nd step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[1];
+		buf[1] = src[2] - src[3];
+		src[0] = src[0] + src[1];
+		src[1] = src[2] + src[3];
+		src[2] = buf[0];
+		src[3] = buf[1];
+		src += 8;
+	}
+
+	// vertical transform of the 2nd step (4x4)
+	src = org_src;
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		buf[1] = src[2 * 8 + j] - src[3 * 8 + j];
+		src[0 * 8 + j] = (src[0 * 8 + j] + src[1 * 8 + j] + 1) >> 1;
+		src[1 * 8 + j] = (src[2 * 8 + j] + src[3 * 8 + j] + 1) >> 1;
+		src[2 * 8 + j] = (buf[0] + 1) >> 1;
+		src[3 * 8 + j] = (buf[1] + 1) >> 1;
+	}
+
+	// horizontal transform of the 3rd step (2x2)
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = src[0] + src[1];
+		src[1] = buf[0];
+		src += 8;
+	}
+
+	// vertical transform of the 3rd step (2x2)
+	src = org_src;
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		src[0 * 8 + j] = (src[0 * 8 + j] + src[1 * 8 + j] + 1) >> 1;
+		src[1 * 8 + j] = (buf[0] + 1) >> 1;
+	}
+
+	// normalization
+	for (int i = 0; i < 64; i++) 
+	{
+		src[i] = (src[i] + (1 << 11)) >> 12;
+	}
+}
+
+/* Integer version of the 8x8 Bior-1.5 backward transform.
+ * It's almost the same as the floating-point version but only the scaling.
+ * The output has the same bits as the original image values.
+ * The bits needed for the intermediate results remain the same as the forward transform.
+ */
+void inplace_backward_bior15_2d_8x8(int *src)
+{
+	int buf[4];
+	int *org_src = src;
+
+	// vertical transform of the 1st step (2x2)
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 8 + j] - src[1 * 8 + j];
+		src[0 * 8 + j] = src[0 * 8 + j] + src[1 * 8 + j];
+		src[1 * 8 + j] = buf[0];
+	}
+
+	// horizontal transform of the 1st step (2x2)
+	for (int i = 0; i < 2; i++)
 	{
 		buf[0] = src[0] - src[1];
 		src[0] = (src[0] + src[1] + 1) >> 1;
@@ -444,73 +735,239 @@ void inplace_backward_bior15_2d_8x8(int *src)
 	}
 	src = org_src;
 
-	// vertical transform of the 3rd step (8x8)
-	for (int j = 0; j < 8; j++)
+	// the 8x8 matrix of the 3rd step, and the normalization
+#if USE_CPU_DISPATCH
+	if (cpu_level() >= CPU_LEVEL_AVX2)
+		backward_bior15_8x8_avx2(src);
+	else
+#endif
+		backward_bior15_8x8(src);
+}
+
+
+/* Inplace implementation of the forward 2D 4x4 Haar wavelet transform (2 levels), used for the 4x4 chroma patches.
+ * The Bior-1.5 wavelet degenerates to the Haar wavelet for 4 points, as there are no neighbours for its 11-taps.
+ * Firstly, the 4x4 matrix below is applied to each row and then each column of the input 4x4 patch.
+ *					[1,  1,  0,  0] [x0]
+ *			 		[0,  0,  1,  1] [x1]
+ *		1/sqrt(2) * [1, -1,  0,  0] [x2]
+ *					[0,  0,  1, -1] [x3]
+ *
+ * Secondly, the 2x2 matrix below is applied to each row and then each column of the top-left 2x2 patch 
+ * of the output of the fisrt step, and the remains are under *unchanged*.
+ *					[1,  1] [x0]
+ *		1/sqrt(2) * [1, -1] [x1]
+ */
+void inplace_forward_haar_2d_4x4(float *src)
+{
+	float buf[2];
+	float *org_src = src;
+
+	// horizontal transform of the 1st step (4x4)
+	for (int i = 0; i < 4; i++)
 	{
-		buf[0] = (src[0 * 8 + j] - src[4 * 8 + j]) * 64;
-		buf[1] = (src[1 * 8 + j] - src[5 * 8 + j]) * 64;
-		buf[2] = (src[2 * 8 + j] - src[6 * 8 + j]) * 64;
-		buf[3] = (src[3 * 8 + j] - src[7 * 8 + j]) * 64;
+		buf[0] = src[0] - src[1];
+		buf[1] = src[2] - src[3];
+		src[0] = src[0] + src[1];
+		src[1] = src[2] + src[3];
+		src[2] = buf[0];
+		src[3] = buf[1];
+		src += 4;
+	}
 
-		src[0 * 8 + j] = (src[0 * 8 + j] + src[4 * 8 + j]) * 64;
-		src[1 * 8 + j] = (src[1 * 8 + j] + src[5 * 8 + j]) * 64;
-		src[2 * 8 + j] = (src[2 * 8 + j] + src[6 * 8 + j]) * 64;
-		src[3 * 8 + j] = (src[3 * 8 + j] + src[7 * 8 + j]) * 64;
+	// vertical transform of the 1st step (4x4)
+	src = org_src;
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		buf[1] = src[2 * 4 + j] - src[3 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[1 * 4 + j];
+		src[1 * 4 + j] = src[2 * 4 + j] + src[3 * 4 + j];
+		src[2 * 4 + j] = buf[0];
+		src[3 * 4 + j] = buf[1];
+	}
 
-		src[5 * 8 + j] = (src[5 * 8 + j] - src[7 * 8 + j]) * 11;
-		src[6 * 8 + j] = (src[6 * 8 + j] - src[4 * 8 + j]) * 11;
+	for (int i = 0; i < 16; i++) {
+		src[i] /= 2.f;	// (2^0.5)^2, normalization
+	}
 
-		src[4 * 8 + j] = src[5 * 8 + j];
-		src[5 * 8 + j] = buf[2] + src[5 * 8 + j];
-		src[7 * 8 + j] = buf[3] + src[6 * 8 + j];
+	// horizontal transform of the 2nd step (2x2)
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = src[0] + src[1];
+		src[1] = buf[0];
+		src += 4;
+	}
 
-		src[0 * 8 + j] = src[0 * 8 + j] - src[4 * 8 + j];
+	// vertical transform of the 2nd step (2x2)
+	src = org_src;
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[1 * 4 + j];
+		src[1 * 4 + j] = buf[0];
+	}
 
-		buf[2] = src[1 * 8 + j];
-		buf[3] = src[2 * 8 + j];
-		src[1 * 8 + j] = buf[0] - src[4 * 8 + j];
-		src[2 * 8 + j] = buf[2] - src[6 * 8 + j];
+	for (int i = 0; i < 2; i++)
+	{
+		for (int j = 0; j < 2; j++) {
+			src[4 * i + j] /= 2.f;	// (2^0.5)^2, normalization
+		}
+	}
+}
 
-		buf[0] = src[3 * 8 + j];
-		src[3 * 8 + j] = buf[1] - src[6 * 8 + j];
-		src[4 * 8 + j] = buf[3] + src[4 * 8 + j];
-		src[6 * 8 + j] = buf[0] + src[6 * 8 + j];
+/* Inplace implementation of the backward 2D 4x4 Haar wavelet transform (2 levels).
+ * The 2x2 and then the 4x4 matrices of the forward transform are transposed and applied in reverse order.
+ */
+void inplace_backward_haar_2d_4x4(float *src)
+{
+	float buf[2];
+	float *org_src = src;
+
+	// vertical and horizontal transform of the 1st step (2x2)
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[1 * 4 + j];
+		src[1 * 4 + j] = buf[0];
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = (src[0] + src[1]) / 2.f;	// (2^0.5)^2, normalization
+		src[1] = buf[0] / 2.f;
+		src += 4;
 	}
 
-	// horizontal transform of the 3rd step (8x8)
-	for (int i = 0; i < 8; i++)
+	// vertical transform of the 2nd step (4x4)
+	src = org_src;
+	for (int j = 0; j < 4; j++)
 	{
-		buf[0] = (src[0] - src[4]) * 64;
-		src[0] = (src[0] + src[4]) * 64;
-		buf[1] = (src[1] - src[5]) * 64;
-		src[1] = (src[1] + src[5]) * 64;
-		buf[2] = (src[2] - src[6]) * 64;
-		src[2] = (src[2] + src[6]) * 64;
-		buf[3] = (src[3] - src[7]) * 64;
-		src[3] = (src[3] + src[7]) * 64;
+		buf[0] = src[0 * 4 + j] - src[2 * 4 + j];
+		buf[1] = src[1 * 4 + j] - src[3 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[2 * 4 + j];
+		src[2 * 4 + j] = src[1 * 4 + j] + src[3 * 4 + j];
+		src[1 * 4 + j] = buf[0];
+		src[3 * 4 + j] = buf[1];
+	}
 
-		src[5] = (src[5] - src[7]) * 11;
-		src[6] = (src[6] - src[4]) * 11;
-		src[4] = src[5];
-		src[5] = buf[2] + src[5];
-		src[7] = buf[3] + src[6];
-		src[0] = src[0] - src[4];
+	// horizontal transform of the 2nd step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[2];
+		buf[1] = src[1] - src[3];
+		src[0] = (src[0] + src[2]) / 2.f;	// (2^0.5)^2, normalization
+		src[2] = (src[1] + src[3]) / 2.f;
+		src[1] = buf[0] / 2.f;
+		src[3] = buf[1] / 2.f;
+		src += 4;
+	}
+}
 
-		buf[2] = src[1];
-		buf[3] = src[2];
-		src[1] = buf[0] - src[4];
-		src[2] = buf[2] - src[6];
-		buf[0] = src[3];
-		src[3] = buf[1] - src[6];
-		src[4] = buf[3] + src[4];
-		src[6] = buf[0] + src[6];
-		src += 8;
+/* Integer version of the 4x4 Haar forward transform.
+ * The output coefficients are multiplied by 2 in comparision with the floating-point ones, 
+ * the same as the 8x8 Bior-1.5 one, so that they share the same thresholds.
+ */
+void inplace_forward_haar_2d_4x4(int *src)
+{
+	int buf[2];
+	int *org_src = src;
+
+	// horizontal transform of the 1st step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[1];
+		buf[1] = src[2] - src[3];
+		src[0] = src[0] + src[1];
+		src[1] = src[2] + src[3];
+		src[2] = buf[0];
+		src[3] = buf[1];
+		src += 4;
+	}
+
+	// vertical transform of the 1st step (4x4), the coefficients are multiplied by 2 now
+	src = org_src;
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		buf[1] = src[2 * 4 + j] - src[3 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[1 * 4 + j];
+		src[1 * 4 + j] = src[2 * 4 + j] + src[3 * 4 + j];
+		src[2 * 4 + j] = buf[0];
+		src[3 * 4 + j] = buf[1];
+	}
+
+	// horizontal transform of the 2nd step (2x2)
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = src[0] + src[1];
+		src[1] = buf[0];
+		src += 4;
+	}
+
+	// vertical transform of the 2nd step (2x2)
+	src = org_src;
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		src[0 * 4 + j] = (src[0 * 4 + j] + src[1 * 4 + j] + 1) >> 1;
+		src[1 * 4 + j] = (buf[0] + 1) >> 1;
+	}
+}
+
+/* Integer version of the 4x4 Haar backward transform.
+ * The output has the same bits as the original image values.
+ */
+void inplace_backward_haar_2d_4x4(int *src)
+{
+	int buf[2];
+	int *org_src = src;
+
+	// vertical and horizontal transform of the 1st step (2x2)
+	for (int j = 0; j < 2; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[1 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[1 * 4 + j];
+		src[1 * 4 + j] = buf[0];
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		buf[0] = src[0] - src[1];
+		src[0] = (src[0] + src[1] + 1) >> 1;
+		src[1] = (buf[0] + 1) >> 1;
+		src += 4;
 	}
+
+	// vertical transform of the 2nd step (4x4)
 	src = org_src;
+	for (int j = 0; j < 4; j++)
+	{
+		buf[0] = src[0 * 4 + j] - src[2 * 4 + j];
+		buf[1] = src[1 * 4 + j] - src[3 * 4 + j];
+		src[0 * 4 + j] = src[0 * 4 + j] + src[2 * 4 + j];
+		src[2 * 4 + j] = src[1 * 4 + j] + src[3 * 4 + j];
+		src[1 * 4 + j] = buf[0];
+		src[3 * 4 + j] = buf[1];
+	}
+
+	// horizontal transform of the 2nd step (4x4)
+	for (int i = 0; i < 4; i++)
+	{
+		buf[0] = src[0] - src[2];
+		buf[1] = src[1] - src[3];
+		src[0] = src[0] + src[2];
+		src[2] = src[1] + src[3];
+		src[1] = buf[0];
+		src[3] = buf[1];
+		src += 4;
+	}
 
 	// normalization
-	for (int i = 0; i < 64; i++)
+	src = org_src;
+	for (int i = 0; i < 16; i++)
 	{
-		src[i] = (src[i] + (1 << 13)) >> 14;
+		src[i] = (src[i] + (1 << 1)) >> 2;
 	}
 }
@@ -7,4 +7,10 @@ void inplace_backward_bior15_2d_8x8(float *src);
 void inplace_forward_bior15_2d_8x8 (int *src);
 void inplace_backward_bior15_2d_8x8(int *src);
 
+void inplace_forward_haar_2d_4x4 (float *src);
+void inplace_backward_haar_2d_4x4(float *src);
+
+void inplace_forward_haar_2d_4x4 (int *src);
+void inplace_backward_haar_2d_4x4(int *src);
+
 #endif